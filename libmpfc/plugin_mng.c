@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fts.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <gst/gst.h>
 #include "types.h"
 #include "cfg.h"
@@ -32,12 +34,242 @@
 #include "genp.h"
 #include "plugin.h"
 #include "pmng.h"
+#include "profiler.h"
 #include "util.h"
 #include "wnd.h"
 
-/* Build supported media file extensions list */
-static bool_t pmng_fill_media_file_exts( pmng_t *pmng )
+/* Media file extensions cache file format version */
+#define PMNG_EXTS_CACHE_VERSION 1
+
+/* Map extension character to trie alphabet index (0 if not supported) */
+static int pmng_ext_char_index( char c )
+{
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 1;
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 1;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 27;
+	switch (c)
+	{
+	case '-':
+		return 37;
+	case '_':
+		return 38;
+	case '+':
+		return 39;
+	}
+	return 0;
+} /* End of 'pmng_ext_char_index' function */
+
+/* Add extension to the trie. Returns FALSE if it has characters outside
+ * of the alphabet */
+static bool_t pmng_ext_trie_add( pmng_ext_trie_t *trie, const char *ext )
+{
+	int node = 0;
+
+	for ( ; *ext; ext++ )
+	{
+		int c = pmng_ext_char_index(*ext);
+		if (!c)
+			return FALSE;
+
+		if (!trie->m_nodes[node].m_next[c])
+		{
+			/* Add a node */
+			if (trie->m_num_nodes >= trie->m_allocated)
+			{
+				trie->m_allocated = trie->m_allocated ? 
+					2 * trie->m_allocated : 64;
+				trie->m_nodes = (struct tag_pmng_ext_trie_node_t *)realloc(
+						trie->m_nodes, 
+						trie->m_allocated * sizeof(*trie->m_nodes));
+				assert(trie->m_nodes);
+			}
+			memset(&trie->m_nodes[trie->m_num_nodes], 0, 
+					sizeof(*trie->m_nodes));
+			trie->m_nodes[node].m_next[c] = trie->m_num_nodes++;
+		}
+		node = trie->m_nodes[node].m_next[c];
+	}
+	trie->m_nodes[node].m_terminal = TRUE;
+	return TRUE;
+} /* End of 'pmng_ext_trie_add' function */
+
+/* Build extensions trie from the list */
+static void pmng_ext_trie_build( pmng_ext_trie_t *trie, char *exts )
 {
+	memset(trie, 0, sizeof(*trie));
+	trie->m_allocated = 64;
+	trie->m_nodes = (struct tag_pmng_ext_trie_node_t *)malloc(
+			trie->m_allocated * sizeof(*trie->m_nodes));
+	assert(trie->m_nodes);
+	memset(&trie->m_nodes[0], 0, sizeof(*trie->m_nodes));
+	trie->m_num_nodes = 1;
+	trie->m_exts = exts;
+
+	for ( ; *exts; exts = strchr(exts, 0) + 1 )
+	{
+		if (!pmng_ext_trie_add(trie, exts))
+			trie->m_has_others = TRUE;
+	}
+} /* End of 'pmng_ext_trie_build' function */
+
+/* Check if extension is in the trie (case-insensitively) */
+static bool_t pmng_ext_trie_lookup( pmng_ext_trie_t *trie, const char *ext )
+{
+	const char *p;
+	int node = 0;
+
+	if (!trie->m_nodes)
+		return FALSE;
+
+	for ( p = ext; *p; p++ )
+	{
+		int c = pmng_ext_char_index(*p);
+
+		/* Such extension may be only among those left out of the trie */
+		if (!c)
+		{
+			if (!trie->m_has_others)
+				return FALSE;
+			for ( p = trie->m_exts; *p; p = strchr(p, 0) + 1 )
+			{
+				if (!strcasecmp(p, ext))
+					return TRUE;
+			}
+			return FALSE;
+		}
+		node = trie->m_nodes[node].m_next[c];
+		if (!node)
+			return FALSE;
+	}
+	return trie->m_nodes[node].m_terminal;
+} /* End of 'pmng_ext_trie_lookup' function */
+
+/* Hash a string (FNV-1a) */
+static guint64 pmng_hash_str( guint64 h, const char *str )
+{
+	for ( ; str && *str; str++ )
+	{
+		h ^= (unsigned char)(*str);
+		h *= 1099511628211ULL;
+	}
+	return h;
+} /* End of 'pmng_hash_str' function */
+
+/* Hash a number */
+static guint64 pmng_hash_num( guint64 h, guint64 n )
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%llu;", (unsigned long long)n);
+	return pmng_hash_str(h, buf);
+} /* End of 'pmng_hash_num' function */
+
+/* Calculate GStreamer registry fingerprint. It changes whenever GStreamer
+ * is upgraded or a plugin is added, removed or replaced */
+static guint64 pmng_registry_fingerprint( void )
+{
+	const guint64 basis = 14695981039346656037ULL;
+	gchar *version = gst_version_string();
+	guint64 fp = pmng_hash_str(basis, version);
+	g_free(version);
+
+	/* Plugins order is not guaranteed, so combine their hashes with
+	 * an order-independent operation */
+	GList *plugins = gst_registry_get_plugin_list(gst_registry_get());
+	for ( GList *p = plugins; p; p = p->next )
+	{
+		GstPlugin *plugin = GST_PLUGIN(p->data);
+		const gchar *filename = gst_plugin_get_filename(plugin);
+		guint64 h = basis;
+
+		h = pmng_hash_str(h, gst_plugin_get_name(plugin));
+		h = pmng_hash_str(h, gst_plugin_get_version(plugin));
+		h = pmng_hash_str(h, filename);
+		if (filename)
+		{
+			struct stat st;
+			if (!stat(filename, &st))
+			{
+				h = pmng_hash_num(h, st.st_size);
+				h = pmng_hash_num(h, st.st_mtime);
+			}
+		}
+		fp += h;
+	}
+	gst_plugin_list_free(plugins);
+	return fp;
+} /* End of 'pmng_registry_fingerprint' function */
+
+/* Get extensions cache file name */
+static char *pmng_exts_cache_name( void )
+{
+	return util_strcat(getenv("HOME"), "/.mpfc/media_exts", NULL);
+} /* End of 'pmng_exts_cache_name' function */
+
+/* Load extensions list from cache. Returns NULL if cache is missing or
+ * stale */
+static char *pmng_load_exts_cache( pmng_t *pmng, guint64 fp )
+{
+	char *name = pmng_exts_cache_name();
+	char *exts = NULL;
+	FILE *fd = fopen(name, "rt");
+	if (!fd)
+		goto finally;
+
+	int version;
+	unsigned long long cached_fp;
+	if (fscanf(fd, "%d %llx\n", &version, &cached_fp) != 2 ||
+			version != PMNG_EXTS_CACHE_VERSION || cached_fp != fp)
+		goto finally;
+
+	size_t size = 0;
+	if (getline(&exts, &size, fd) < 0)
+	{
+		free(exts);
+		exts = NULL;
+		goto finally;
+	}
+	util_del_nl(exts, exts);
+	logger_debug(pmng->m_log, "media file extensions loaded from cache");
+
+finally:
+	if (fd)
+		fclose(fd);
+	free(name);
+	return exts;
+} /* End of 'pmng_load_exts_cache' function */
+
+/* Save extensions list to cache */
+static void pmng_save_exts_cache( pmng_t *pmng, guint64 fp, const char *exts )
+{
+	char *name = pmng_exts_cache_name();
+	char *tmp_name = util_strcat(name, ".tmp", NULL);
+
+	/* Write to a temporary file and then replace the cache at once */
+	FILE *fd = fopen(tmp_name, "wt");
+	if (!fd)
+	{
+		logger_debug(pmng->m_log, "unable to write %s", tmp_name);
+		goto finally;
+	}
+	fprintf(fd, "%d %llx\n%s\n", PMNG_EXTS_CACHE_VERSION, 
+			(unsigned long long)fp, exts);
+	if (fclose(fd) || rename(tmp_name, name))
+		unlink(tmp_name);
+
+finally:
+	free(tmp_name);
+	free(name);
+} /* End of 'pmng_save_exts_cache' function */
+
+/* Scan GStreamer registry for supported media file extensions. 
+ * Returns ';'-separated list */
+static char *pmng_scan_media_file_exts( pmng_t *pmng )
+{
+	int span = prof_begin("scan media file extensions");
+
 	/* First collect all mimetypes which might correspond to audio */
 	GHashTable *all_mimes = g_hash_table_new(g_str_hash, g_str_equal);
     GList* factories = gst_registry_get_feature_list(gst_registry_get(),
@@ -118,15 +350,33 @@ static bool_t pmng_fill_media_file_exts( pmng_t *pmng )
 	gst_plugin_feature_list_free(tffs);
 	g_hash_table_destroy(all_mimes);
 
-	pmng->m_media_file_exts = strdup(STR_TO_CPTR(media_exts));
+	char *exts = strdup(STR_TO_CPTR(media_exts));
 	str_free(media_exts);
 
+	prof_end(span);
+	return exts;
+} /* End of 'pmng_scan_media_file_exts' function */
+
+/* Build supported media file extensions list */
+bool_t pmng_fill_media_file_exts( pmng_t *pmng )
+{
+	int span = prof_begin("pmng_fill_media_file_exts");
+
+	/* Use cached list if GStreamer configuration is unchanged */
+	guint64 fp = pmng_registry_fingerprint();
+	char *exts = pmng_load_exts_cache(pmng, fp);
+	if (!exts)
+	{
+		exts = pmng_scan_media_file_exts(pmng);
+		pmng_save_exts_cache(pmng, fp, exts);
+	}
+
 	logger_message(pmng->m_log, 1, _("Supported media file extensions: %s"),
-			pmng->m_media_file_exts);
+			exts);
 
 	/* Replace ';' with 0 and calculate maximal extension length */
 	size_t max_len = 0, len = 0;
-	for ( char *p = pmng->m_media_file_exts;; ++p, ++len )
+	for ( char *p = exts;; ++p, ++len )
 	{
 		bool_t end = ((*p) == 0);
 
@@ -141,11 +391,32 @@ static bool_t pmng_fill_media_file_exts( pmng_t *pmng )
 				break;
 		}
 	}
+
+	/* Publish the list */
+	pthread_mutex_lock(&pmng->m_media_exts_mutex);
+	pmng_ext_trie_build(&pmng->m_media_exts_trie, exts);
+	pmng->m_media_file_exts = exts;
 	pmng->m_media_ext_max_len = max_len;
+	pmng->m_media_exts_ready = TRUE;
+	pthread_cond_broadcast(&pmng->m_media_exts_cond);
+	pthread_mutex_unlock(&pmng->m_media_exts_mutex);
 
+	prof_end(span);
 	return TRUE;
 } /* End of 'pmng_fill_media_file_exts' function */
 
+/* Wait until media file extensions list is built */
+void pmng_wait_media_exts( pmng_t *pmng )
+{
+	if (pmng->m_media_exts_ready)
+		return;
+
+	pthread_mutex_lock(&pmng->m_media_exts_mutex);
+	while (!pmng->m_media_exts_ready)
+		pthread_cond_wait(&pmng->m_media_exts_cond, &pmng->m_media_exts_mutex);
+	pthread_mutex_unlock(&pmng->m_media_exts_mutex);
+} /* End of 'pmng_wait_media_exts' function */
+
 /* Initialize plugins */
 pmng_t *pmng_init( cfg_node_t *list, logger_t *log, wnd_t *wnd_root )
 {
@@ -159,16 +430,23 @@ pmng_t *pmng_init( cfg_node_t *list, logger_t *log, wnd_t *wnd_root )
 	pmng->m_cfg_list = list;
 	pmng->m_log = log;
 	pmng->m_root_wnd = wnd_root;
+	pthread_mutex_init(&pmng->m_media_exts_mutex, NULL);
+	pthread_cond_init(&pmng->m_media_exts_cond, NULL);
 	
 	/* Load plugins */
-	if (!pmng_load_plugins(pmng))
+	int span = prof_begin("pmng_load_plugins");
+	bool_t loaded = pmng_load_plugins(pmng);
+	prof_end(span);
+	if (!loaded)
 	{
 		pmng_free(pmng);
 		return NULL;
 	}
 
-	/* Fill m_media_file_exts */
-	pmng_fill_media_file_exts(pmng);
+	/* Fill m_media_file_exts. In fast start mode this is done later
+	 * by the player asynchronously */
+	if (!cfg_get_var_bool(list, "fast-start"))
+		pmng_fill_media_file_exts(pmng);
 
 	/* Autostart general plugins */
 	pmng_autostart_general(pmng);
@@ -185,6 +463,10 @@ void pmng_free( pmng_t *pmng )
 
 	if (pmng->m_media_file_exts)
 		free(pmng->m_media_file_exts);
+	if (pmng->m_media_exts_trie.m_nodes)
+		free(pmng->m_media_exts_trie.m_nodes);
+	pthread_mutex_destroy(&pmng->m_media_exts_mutex);
+	pthread_cond_destroy(&pmng->m_media_exts_cond);
 
 	for ( i = 0; i < pmng->m_num_plugins; i ++ )
 		plugin_free(pmng->m_plugins[i]);
@@ -203,10 +485,18 @@ void pmng_add_plugin( pmng_t *pmng, plugin_t *p )
 	pmng->m_plugins[pmng->m_num_plugins ++] = p;
 } /* End of 'pmng_add_plugin' function */
 
-/* Execute a command with a list of parameters */
+/* Execute a command with a list of parameters. Commands are handled by
+ * the player window; there is none in daemon mode */
 void pmng_player_command_obj( pmng_t *pmng, char *cmd, 
 		cmd_params_list_t *params )
 {
+	if (pmng->m_player_wnd == NULL)
+	{
+		logger_debug(pmng->m_log, "no player window for command '%s'", cmd);
+		if (params != NULL)
+			cmd_free_params(params);
+		return;
+	}
 	wnd_msg_send(pmng->m_player_wnd, "command", 
 			player_msg_command_new(cmd, params));
 } /* End of 'pmng_player_command_obj' function */
@@ -245,15 +535,8 @@ bool_t pmng_search_format( pmng_t *pmng, const char *filename, const char *forma
 	if (pmng == NULL || (!(*filename) && !(*format)))
 		return FALSE;
 
-	logger_debug(pmng->m_log, "pmng_search_format(%s, %s)", filename, format);
-
-	for ( char *ext = pmng_first_media_ext(pmng); ext; 
-			ext = pmng_next_media_ext(ext) )
-	{
-		if (!strcasecmp(ext, format))
-			return TRUE;
-	}
-	return FALSE;
+	pmng_wait_media_exts(pmng);
+	return pmng_ext_trie_lookup(&pmng->m_media_exts_trie, format);
 } /* End of 'pmng_search_format' function */
 
 /* Search for plugin with a specified name */
@@ -488,6 +771,8 @@ void pmng_hook( pmng_t *pmng, char *hook )
 /* Start media extensions list iteration */
 char *pmng_first_media_ext( pmng_t *pmng )
 {
+	pmng_wait_media_exts(pmng);
+
 	char *res = pmng->m_media_file_exts;
 	if (!(*res))
 		return NULL; /* Empty list */
@@ -0,0 +1,128 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Startup profiler functions implementation.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "profiler.h"
+
+/* Collected spans */
+static struct
+{
+	/* Span name */
+	const char *m_name;
+
+	/* Start and end times in microseconds (end is -1 if still running) */
+	int64_t m_start, m_end;
+
+	/* Nesting level */
+	int m_depth;
+
+	/* Has span been started not in the main thread? */
+	bool_t m_async;
+} prof_spans[PROF_MAX_SPANS];
+static int prof_num_spans = 0;
+static pthread_mutex_t prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Thread which has started the first span */
+static pthread_t prof_main_thread;
+
+/* Current nesting level in the calling thread */
+static __thread int prof_depth = 0;
+
+/* Get current time */
+static int64_t prof_now( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* End of 'prof_now' function */
+
+/* Start a timing span. Returns span handle */
+int prof_begin( const char *name )
+{
+	int span = -1;
+
+	pthread_mutex_lock(&prof_mutex);
+	if (prof_num_spans == 0)
+		prof_main_thread = pthread_self();
+	if (prof_num_spans < PROF_MAX_SPANS)
+	{
+		span = prof_num_spans++;
+		prof_spans[span].m_name = name;
+		prof_spans[span].m_start = prof_now();
+		prof_spans[span].m_end = -1;
+		prof_spans[span].m_depth = prof_depth++;
+		prof_spans[span].m_async = 
+			!pthread_equal(prof_main_thread, pthread_self());
+	}
+	pthread_mutex_unlock(&prof_mutex);
+	return span;
+} /* End of 'prof_begin' function */
+
+/* Finish a timing span */
+void prof_end( int span )
+{
+	if (span < 0)
+		return;
+
+	pthread_mutex_lock(&prof_mutex);
+	prof_spans[span].m_end = prof_now();
+	prof_depth = prof_spans[span].m_depth;
+	pthread_mutex_unlock(&prof_mutex);
+} /* End of 'prof_end' function */
+
+/* Add a zero-length span marking a moment */
+void prof_mark( const char *name )
+{
+	prof_end(prof_begin(name));
+} /* End of 'prof_mark' function */
+
+/* Print collected spans */
+void prof_print( FILE *fd )
+{
+	pthread_mutex_lock(&prof_mutex);
+	if (prof_num_spans == 0)
+		goto finally;
+
+	int64_t origin = prof_spans[0].m_start;
+	fprintf(fd, "%10s %10s  %s\n", "start, ms", "time, ms", "phase");
+	for ( int i = 0; i < prof_num_spans; i ++ )
+	{
+		int64_t start = prof_spans[i].m_start - origin;
+		fprintf(fd, "%10.3f ", start / 1000.);
+		if (prof_spans[i].m_end < 0)
+			fprintf(fd, "%10s  ", "-");
+		else
+			fprintf(fd, "%10.3f  ", 
+					(prof_spans[i].m_end - prof_spans[i].m_start) / 1000.);
+		fprintf(fd, "%*s%s%s\n", 2 * prof_spans[i].m_depth, "", 
+				prof_spans[i].m_name, prof_spans[i].m_async ? " (async)" : "");
+	}
+
+finally:
+	pthread_mutex_unlock(&prof_mutex);
+} /* End of 'prof_print' function */
+
+/* End of 'profiler.c' file */
@@ -421,6 +421,10 @@ void wnd_deinit( wnd_t *wnd_root )
 	wnd_mouse_free(global->m_mouse_data);
 	wnd_kbind_free(global->m_kbind_data);
 	wnd_kbd_free(global->m_kbd_data);
+	logger_debug(global->m_log, "messages posted: %u, coalesced: %u, "
+			"processed: %u", global->m_msg_queue->m_num_posted,
+			global->m_msg_queue->m_num_coalesced, 
+			global->m_msg_queue->m_num_processed);
 	wnd_msg_queue_free(global->m_msg_queue);
 	pthread_mutex_destroy(&global->m_curses_mutex);
 
@@ -513,16 +517,24 @@ void wnd_main( wnd_t *wnd_root )
 			wnd_msg_handler_t *handler, **ph;
 			wnd_msg_retcode_t ret;
 
-			/* Choose appropriate callback for calling handler */
+			/* Message is taken, so the next one may be posted */
 			target = msg.m_wnd;
 			assert(target);
-			ph = wnd_class_get_msg_info(target, msg.m_name, &callback);
+			if (msg.m_atom == WND_MSG_DISPLAY)
+				__atomic_store_n(&target->m_display_pending, FALSE,
+						__ATOMIC_RELEASE);
+			else if (msg.m_atom == WND_MSG_UPDATE_SCREEN)
+				__atomic_store_n(&WND_GLOBAL(target)->m_update_pending, 
+						FALSE, __ATOMIC_RELEASE);
+
+			/* Choose appropriate callback for calling handler */
+			ph = wnd_class_get_msg_handlers(target, msg.m_atom, &callback);
 			if (ph == NULL)
 				continue;
 			handler = *ph;
 
 			/* Call handler */
-			if (!strcmp(msg.m_name, "display"))
+			if (msg.m_atom == WND_MSG_DISPLAY)
 				target->m_is_invalid = FALSE;
 			ret = wnd_call_handler(target, msg.m_name, handler, callback, 
 					&msg.m_data);
@@ -530,20 +542,20 @@ void wnd_main( wnd_t *wnd_root )
 			if (ret == WND_MSG_RETCODE_EXIT)
 				break;
 
-			/* Check for invalid windows */
-			if (wnd_check_invalid(wnd_root))
-				wnd_msg_send(wnd_root, "update_screen",
-						wnd_msg_update_screen_new());
+			/* Handle all the messages taken from queue before finishing
+			 * the frame */
+			if (WND_MSG_QUEUE(wnd_root)->m_base != NULL)
+				continue;
 		}
+
+		/* Frame end: repaint invalid windows and synchronize screen 
+		 * once for all of them */
+		if (wnd_check_invalid(wnd_root))
+			wnd_msg_send_atom(wnd_root, WND_MSG_UPDATE_SCREEN,
+					wnd_msg_update_screen_new());
 		else
-		{
-			if (wnd_check_invalid(wnd_root))
-			{
-				wnd_msg_send(wnd_root, "update_screen",
-						wnd_msg_update_screen_new());
-			}
-			util_wait();
-		}
+			wnd_msg_queue_wait(WND_MSG_QUEUE(wnd_root), 
+					&WND_GLOBAL(wnd_root)->m_invalid_exist, WND_IDLE_TIMEOUT);
 	}
 } /* End of 'wnd_main' function */
 
@@ -603,14 +615,18 @@ bool_t wnd_check_invalid( wnd_t *wnd )
 	bool_t need_update = FALSE;
 	wnd_t *child;
 
-	/* Do nothing if we have no invalid windows at all */
-	if (!WND_GLOBAL(wnd)->m_invalid_exist)
+	/* Do nothing if we have no invalid windows at all. The flag is 
+	 * reset before looking at windows, so that windows invalidated by 
+	 * other threads meanwhile are caught the next time */
+	if (wnd == WND_ROOT(wnd) && !__atomic_exchange_n(
+				&WND_GLOBAL(wnd)->m_invalid_exist, FALSE, __ATOMIC_SEQ_CST))
 		return FALSE;
 
-	/* Invalidate this window */
-	if (wnd->m_is_invalid)
+	/* Invalidate this window (unless it is going to be repainted 
+	 * anyway) */
+	if (wnd->m_is_invalid && !wnd->m_display_pending)
 	{
-		wnd_msg_send(wnd, "erase_back", wnd_msg_erase_back_new());
+		wnd_msg_send_atom(wnd, WND_MSG_ERASE_BACK, wnd_msg_erase_back_new());
 		wnd_send_repaint(wnd, TRUE);
 		need_update = TRUE;
 	}
@@ -623,9 +639,6 @@ bool_t wnd_check_invalid( wnd_t *wnd )
 				need_update = TRUE;
 		}
 	}
-	/* If this is the first-level call, we have no invalid windows */
-	if (wnd == WND_ROOT(wnd))
-		WND_GLOBAL(wnd)->m_invalid_exist = FALSE;
 	return need_update;
 } /* End of 'wnd_check_invalid' function */
 
@@ -1066,14 +1079,16 @@ void wnd_invalidate( wnd_t *wnd )
 	if (wnd != NULL)
 	{
 		wnd->m_is_invalid = TRUE;
-		WND_GLOBAL(wnd)->m_invalid_exist = TRUE;
+		__atomic_store_n(&WND_GLOBAL(wnd)->m_invalid_exist, TRUE, 
+				__ATOMIC_SEQ_CST);
+		wnd_msg_queue_wakeup(WND_MSG_QUEUE(wnd));
 	}
 } /* End of 'wnd_invalidate' function */
 
 /* Send repainting messages to a window */
 void wnd_send_repaint( wnd_t *wnd, bool_t send_to_children )
 {
-	wnd_msg_send(wnd, "display", wnd_msg_display_new());
+	wnd_msg_send_atom(wnd, WND_MSG_DISPLAY, wnd_msg_display_new());
 	if (send_to_children)
 	{
 		wnd_t *child;
@@ -1091,6 +1106,7 @@ void wnd_sync_screen( wnd_t *wnd )
 	wnd_t *wnd_focus;
 	static bool_t prev_cursor_state = TRUE;
 	static int count = 0;
+	struct timeval tv;
 
 	pthread_mutex_lock(&WND_CURSES_MUTEX(wnd));
 
@@ -1146,6 +1162,10 @@ void wnd_sync_screen( wnd_t *wnd )
 	/* Refresh screen */
 	refresh();
 	buf->m_dirty = FALSE;
+	gettimeofday(&tv, NULL);
+	__atomic_store_n(&WND_GLOBAL(wnd)->m_last_sync, 
+			(int64_t)tv.tv_sec * 1000000 + tv.tv_usec, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&WND_GLOBAL(wnd)->m_num_syncs, 1, __ATOMIC_RELEASE);
 
 	if (buf->m_title_dirty && wnd_set_title_seq_start)
 	{
@@ -1359,11 +1379,12 @@ void wnd_repos_internal( wnd_t *wnd, int x, int y, int w, int h )
 		wnd_msg_t msg;
 
 		msg.m_wnd = child;
-		msg.m_name = strdup("parent_repos");
+		msg.m_atom = WND_MSG_PARENT_REPOS;
+		msg.m_name = wnd_msg_atom_name(WND_MSG_PARENT_REPOS);
 		msg.m_data = wnd_msg_parent_repos_new(px, py, pw, ph, x, y, w, h);
 
-		wnd_msg_handler_t *handler = *wnd_class_get_msg_info(msg.m_wnd, 
-				msg.m_name, &callback);
+		wnd_msg_handler_t *handler = *wnd_class_get_msg_handlers(msg.m_wnd, 
+				msg.m_atom, &callback);
 		wnd_call_handler(msg.m_wnd, msg.m_name, handler, callback, 
 				&msg.m_data);
 		wnd_msg_free(&msg);
@@ -1443,7 +1464,8 @@ void wnd_redisplay( wnd_t *wnd )
 	wnd_global_update_visibility(root);
 
 	wnd_send_repaint(root, TRUE);
-	wnd_msg_send(root, "update_screen", wnd_msg_update_screen_new());
+	wnd_msg_send_atom(root, WND_MSG_UPDATE_SCREEN, 
+			wnd_msg_update_screen_new());
 } /* End of 'wnd_redisplay' function */
 
 /* Update the whole visibility information */
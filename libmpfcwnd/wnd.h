@@ -24,6 +24,7 @@
 #define __SG_MPFC_WND_H__
 
 #include <curses.h>
+#include <sys/time.h>
 #include "types.h"
 #include "cfg.h"
 #include "logger.h"
@@ -37,6 +38,10 @@
 #include "wnd_print.h"
 #include "wnd_types.h"
 
+/* Maximal time (in milliseconds) the main loop sleeps waiting for 
+ * messages. Screen size changes are checked with this period */
+#define WND_IDLE_TIMEOUT 100
+
 /* Window flags */
 typedef enum
 {
@@ -159,6 +164,14 @@ struct tag_wnd_global_data_t
 	/* Do any invalid windows exist now? */
 	bool_t m_invalid_exist;
 
+	/* Is 'update_screen' message already in queue? */
+	bool_t m_update_pending;
+
+	/* Screen synchronizations counter and the last one time (in 
+	 * microseconds). Other threads read them atomically */
+	dword m_num_syncs;
+	int64_t m_last_sync;
+
 	/* Logger */
 	logger_t *m_log;
 
@@ -270,6 +283,9 @@ struct tag_wnd_t
 	/* Window invalidity flag */
 	bool_t m_is_invalid;
 
+	/* Is 'display' message for this window already in queue? */
+	bool_t m_display_pending;
+
 	/* Configuration list for storing window parameters */
 	cfg_node_t *m_cfg_list;
 
@@ -58,6 +58,8 @@ wnd_class_t *wnd_class_new( wnd_global_data_t *global, char *name,
 	klass->m_free_handlers = free_handlers_func;
 	klass->m_cfg_list = cfg_new_list(global->m_classes_cfg, name, 
 			set_def_styles, CFG_NODE_RUNTIME | CFG_NODE_MEDIUM_LIST, 0);
+	klass->m_msg_table = (wnd_class_msg_entry_t *)calloc(WND_MSG_MAX_ATOMS,
+			sizeof(*klass->m_msg_table));
 	klass->m_next = NULL;
 
 	/* Insert class to the classes table */
@@ -75,6 +77,8 @@ void wnd_class_free( wnd_class_t *klass )
 		return;
 	if (klass->m_name != NULL)
 		free(klass->m_name);
+	if (klass->m_msg_table != NULL)
+		free(klass->m_msg_table);
 	free(klass);
 } /* End of 'wnd_class_free' function */
 
@@ -96,6 +100,44 @@ wnd_msg_handler_t **wnd_class_get_msg_info( wnd_t *wnd, char *msg_name,
 	return NULL;
 } /* End of 'wnd_class_get_msg_info' function */
 
+/* Get message handler and callback function using dispatch table */
+wnd_msg_handler_t **wnd_class_get_msg_handlers( wnd_t *wnd, 
+		wnd_msg_atom_t atom, wnd_class_msg_callback_t *callback )
+{
+	wnd_class_t *klass = wnd->m_class;
+	wnd_class_msg_entry_t *entry;
+
+	if (atom < 0 || atom >= WND_MSG_MAX_ATOMS)
+		return NULL;
+
+	/* No table - do a slow lookup */
+	if (klass->m_msg_table == NULL)
+		return wnd_class_get_msg_info(wnd, wnd_msg_atom_name(atom), 
+				callback);
+
+	/* Ask class about this message only once */
+	entry = &klass->m_msg_table[atom];
+	if (entry->m_state == WND_CLASS_MSG_UNKNOWN)
+	{
+		wnd_class_msg_callback_t cb = NULL;
+		wnd_msg_handler_t **h = wnd_class_get_msg_info(wnd, 
+				wnd_msg_atom_name(atom), &cb);
+		if (h == NULL)
+			entry->m_state = WND_CLASS_MSG_UNSUPPORTED;
+		else
+		{
+			entry->m_offset = (byte *)h - (byte *)wnd;
+			entry->m_callback = cb;
+			entry->m_state = WND_CLASS_MSG_SUPPORTED;
+		}
+	}
+	if (entry->m_state == WND_CLASS_MSG_UNSUPPORTED)
+		return NULL;
+	if (callback != NULL)
+		(*callback) = entry->m_callback;
+	return (wnd_msg_handler_t **)((byte *)wnd + entry->m_offset);
+} /* End of 'wnd_class_get_msg_handlers' function */
+
 /* Call 'free_handlers' function */
 void wnd_class_free_handlers( wnd_t *wnd )
 {
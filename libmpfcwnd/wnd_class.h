@@ -27,6 +27,7 @@
 #include "types.h"
 #include "cfg.h"
 #include "wnd_class.h"
+#include "wnd_msg.h"
 #include "wnd_types.h"
 
 /* Callback function for a message (i.e. function that calls the handler
@@ -41,6 +42,23 @@ typedef wnd_msg_handler_t **(*wnd_class_msg_get_info_t)( wnd_t *wnd,
 /* Free window's message handlers */
 typedef void (*wnd_class_free_handlers_t)( wnd_t *wnd );
 
+/* Message dispatch table entry state */
+typedef enum
+{
+	WND_CLASS_MSG_UNKNOWN = 0,
+	WND_CLASS_MSG_SUPPORTED,
+	WND_CLASS_MSG_UNSUPPORTED
+} wnd_class_msg_state_t;
+
+/* Message dispatch table entry. Handlers chain always lives inside the
+ * window object, so we remember its offset from the object start */
+typedef struct
+{
+	wnd_class_msg_state_t m_state;
+	size_t m_offset;
+	wnd_class_msg_callback_t m_callback;
+} wnd_class_msg_entry_t;
+
 /* Window class data */
 struct tag_wnd_class_t
 {
@@ -57,6 +75,9 @@ struct tag_wnd_class_t
 	/* Class configuration */
 	cfg_node_t *m_cfg_list;
 
+	/* Message dispatch table (indexed by message atom, filled lazily) */
+	wnd_class_msg_entry_t *m_msg_table;
+
 	/* Next class in the classes table */
 	wnd_class_t *m_next;
 };
@@ -74,6 +95,10 @@ void wnd_class_free( wnd_class_t *klass );
 wnd_msg_handler_t **wnd_class_get_msg_info( wnd_t *wnd, char *msg_name,
 		wnd_class_msg_callback_t *callback );
 
+/* Get message handler and callback function using dispatch table */
+wnd_msg_handler_t **wnd_class_get_msg_handlers( wnd_t *wnd, 
+		wnd_msg_atom_t atom, wnd_class_msg_callback_t *callback );
+
 /* Call 'free_handlers' function */
 void wnd_class_free_handlers( wnd_t *wnd );
 
@@ -23,28 +23,36 @@
 #include <assert.h>
 #include <curses.h>
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "types.h"
 #include "wnd.h"
 #include "wnd_kbd.h"
 #include "wnd_msg.h"
 #include "util.h"
 
+static void wnd_kbd_wakeup( wnd_kbd_data_t *data );
+
 /* Initialize keyboard management system */
 wnd_kbd_data_t *wnd_kbd_init( wnd_t *wnd_root )
 {
 	/* Create data */
 	wnd_kbd_data_t *data = (wnd_kbd_data_t *)malloc(sizeof(wnd_kbd_data_t));
 	data->m_end_thread = FALSE;
+	data->m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 	data->m_wnd_root = wnd_root;
 	data->m_global = WND_GLOBAL(data->m_wnd_root);
 
 	/* Start thread */
 	if (pthread_create(&data->m_tid, NULL, wnd_kbd_thread, data))
 	{
+		if (data->m_wake_fd >= 0)
+			close(data->m_wake_fd);
 		free(data);
 		return NULL;
 	}
@@ -56,8 +64,11 @@ void wnd_kbd_free( wnd_kbd_data_t *data )
 {
 	/* Stop keyboard thread */
 	data->m_end_thread = TRUE;
+	wnd_kbd_wakeup(data);
 	pthread_join(data->m_tid, NULL);
 	logger_debug(data->m_global->m_log, "keyboard thread terminated");
+	if (data->m_wake_fd >= 0)
+		close(data->m_wake_fd);
 	free(data);
 } /* End of 'wnd_kbd_free' function */
 
@@ -80,7 +91,21 @@ void *wnd_kbd_thread( void *arg )
 		pthread_mutex_unlock(&global->m_curses_mutex);
 		if (key == ERR)
 		{
-			util_wait();
+			struct pollfd pfd[2];
+			uint64_t val;
+
+			/* Wait for input, but not too long, since we have to check
+			 * the thread termination flag */
+			pfd[0].fd = 0;
+			pfd[0].events = POLLIN;
+			pfd[1].fd = data->m_wake_fd;
+			pfd[1].events = POLLIN;
+			if (poll(pfd, (data->m_wake_fd >= 0) ? 2 : 1, 10) != 0 && 
+					!(pfd[0].revents & POLLIN) && 
+					!(pfd[1].revents & POLLIN))
+				util_wait();
+			if (data->m_wake_fd >= 0)
+				read(data->m_wake_fd, &val, sizeof(val));
 			continue;
 		}
 
@@ -146,11 +171,30 @@ void *wnd_kbd_thread( void *arg )
 		wnd_t *focus = global->m_focus;
 		if (focus != NULL)
 		{
-			wnd_msg_send(focus, "keydown", wnd_msg_key_new(keycode));
+			wnd_msg_send_atom(focus, WND_MSG_KEYDOWN, wnd_msg_key_new(keycode));
 		}
 	}
 	return NULL;
 } /* End of 'wnd_kbd_thread' function */
 
+/* Wake up the keyboard thread waiting for input */
+static void wnd_kbd_wakeup( wnd_kbd_data_t *data )
+{
+	uint64_t val = 1;
+
+	if (data->m_wake_fd >= 0)
+		write(data->m_wake_fd, &val, sizeof(val));
+} /* End of 'wnd_kbd_wakeup' function */
+
+/* Put key to the input as if it was pressed. It goes through the
+ * keyboard thread just like the real ones */
+void wnd_kbd_push_key( wnd_kbd_data_t *data, wnd_key_t key )
+{
+	pthread_mutex_lock(&data->m_global->m_curses_mutex);
+	ungetch(key);
+	pthread_mutex_unlock(&data->m_global->m_curses_mutex);
+	wnd_kbd_wakeup(data);
+} /* End of 'wnd_kbd_push_key' function */
+
 /* End of 'wnd_kbd.c' file */
 
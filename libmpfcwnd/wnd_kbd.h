@@ -73,6 +73,9 @@ typedef struct tag_wnd_kbd_data_t
 	pthread_t m_tid;
 	bool_t m_end_thread;
 
+	/* Event waking the thread up when it waits for input */
+	int m_wake_fd;
+
 	/* Pointer to the root window */
 	wnd_t *m_wnd_root;
 	wnd_global_data_t *m_global;
@@ -93,6 +96,9 @@ void wnd_kbd_free( wnd_kbd_data_t *data );
 /* Keyboard thread function */
 void *wnd_kbd_thread( void *arg );
 
+/* Put key to the input as if it was pressed */
+void wnd_kbd_push_key( wnd_kbd_data_t *data, wnd_key_t key );
+
 #endif
 
 /* End of 'wnd_kbd.h' file */
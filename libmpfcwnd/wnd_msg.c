@@ -21,17 +21,128 @@
  */
 
 #include <assert.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "types.h"
 #include "wnd.h"
 #include "wnd_msg.h"
 
+/* Size of the atoms hash table (power of two, greater than atoms number) */
+#define WND_MSG_ATOMS_HASH_SIZE 512
+
+/* Interned message names (predefined ones come first) */
+static char *wnd_msg_atom_names[WND_MSG_MAX_ATOMS] = 
+{
+	"display", "erase_back", "update_screen", "parent_repos", "destructor",
+	"keydown", "action"
+};
+static int wnd_msg_num_atoms = WND_MSG_NUM_PREDEFINED;
+
+/* Atoms hash table. Each slot holds atom plus one (zero for empty slot).
+ * Slots are filled under the mutex and never change after that, so 
+ * looking up already known names needs no locking */
+static int wnd_msg_atoms_hash[WND_MSG_ATOMS_HASH_SIZE];
+static pthread_mutex_t wnd_msg_atoms_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Calculate message name hash */
+static unsigned wnd_msg_atom_hash( const char *name )
+{
+	unsigned hash = 5381;
+	for ( ; *name; name ++ )
+		hash = hash * 33 + (unsigned char)(*name);
+	return hash;
+} /* End of 'wnd_msg_atom_hash' function */
+
+/* Search atoms hash table for a name. If it is not found, index
+ * of the free slot where it should be inserted is saved */
+static wnd_msg_atom_t wnd_msg_atom_find( const char *name, unsigned hash,
+		int *free_slot )
+{
+	int i;
+
+	for ( i = 0; i < WND_MSG_ATOMS_HASH_SIZE; i ++ )
+	{
+		int slot = (hash + i) & (WND_MSG_ATOMS_HASH_SIZE - 1);
+		int val = __atomic_load_n(&wnd_msg_atoms_hash[slot], 
+				__ATOMIC_ACQUIRE);
+		if (val == 0)
+		{
+			if (free_slot != NULL)
+				(*free_slot) = slot;
+			break;
+		}
+		if (!strcmp(wnd_msg_atom_names[val - 1], name))
+			return val - 1;
+	}
+	return WND_MSG_NO_ATOM;
+} /* End of 'wnd_msg_atom_find' function */
+
+/* Get atom for a message name (interning it if it is new) */
+wnd_msg_atom_t wnd_msg_atom( const char *name )
+{
+	unsigned hash;
+	wnd_msg_atom_t atom;
+	int slot = -1, i;
+
+	assert(name);
+
+	/* Most likely the name is already known */
+	hash = wnd_msg_atom_hash(name);
+	atom = wnd_msg_atom_find(name, hash, NULL);
+	if (atom != WND_MSG_NO_ATOM)
+		return atom;
+
+	/* Insert it */
+	pthread_mutex_lock(&wnd_msg_atoms_mutex);
+	atom = wnd_msg_atom_find(name, hash, &slot);
+	if (atom == WND_MSG_NO_ATOM && slot >= 0)
+	{
+		/* Predefined atoms get to the hash on their first lookup */
+		for ( i = 0; i < WND_MSG_NUM_PREDEFINED; i ++ )
+		{
+			if (!strcmp(wnd_msg_atom_names[i], name))
+			{
+				atom = i;
+				break;
+			}
+		}
+
+		/* Add a new name */
+		if (atom == WND_MSG_NO_ATOM && 
+				wnd_msg_num_atoms < WND_MSG_MAX_ATOMS)
+		{
+			atom = wnd_msg_num_atoms;
+			wnd_msg_atom_names[atom] = strdup(name);
+			__atomic_store_n(&wnd_msg_num_atoms, atom + 1, 
+					__ATOMIC_RELEASE);
+		}
+		if (atom != WND_MSG_NO_ATOM)
+			__atomic_store_n(&wnd_msg_atoms_hash[slot], atom + 1,
+					__ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&wnd_msg_atoms_mutex);
+	assert(atom != WND_MSG_NO_ATOM);
+	return atom;
+} /* End of 'wnd_msg_atom' function */
+
+/* Get message name by its atom */
+char *wnd_msg_atom_name( wnd_msg_atom_t atom )
+{
+	if (atom < 0 || 
+			atom >= __atomic_load_n(&wnd_msg_num_atoms, __ATOMIC_ACQUIRE))
+		return NULL;
+	return wnd_msg_atom_names[atom];
+} /* End of 'wnd_msg_atom_name' function */
+
 /* Initialize message queue */
 wnd_msg_queue_t *wnd_msg_queue_init( void )
 {
 	wnd_msg_queue_t *queue;
+	int i;
 
 	/* Allocate memory */
 	queue = (wnd_msg_queue_t *)malloc(sizeof(wnd_msg_queue_t));
@@ -39,12 +150,110 @@ wnd_msg_queue_t *wnd_msg_queue_init( void )
 		return NULL;
 
 	/* Set fields */
+	queue->m_incoming = NULL;
 	queue->m_base = NULL;
 	queue->m_last = NULL;
-	pthread_mutex_init(&queue->m_mutex, NULL);
+	for ( i = 0; i < WND_MSG_QUEUE_POOL_SIZE; i ++ )
+	{
+		queue->m_pool[i].m_pool_index = i;
+		queue->m_pool[i].m_pool_next = 
+			(i + 1 < WND_MSG_QUEUE_POOL_SIZE) ? i + 2 : 0;
+	}
+	queue->m_free = 1;
+	queue->m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	queue->m_waiting = 0;
+	queue->m_num_posted = 0;
+	queue->m_num_coalesced = 0;
+	queue->m_num_processed = 0;
 	return queue;
 } /* End of 'wnd_msg_queue_init' function */
 
+/* Get a node from the pool or allocate a new one */
+static struct wnd_msg_queue_item_t *wnd_msg_node_new( 
+		wnd_msg_queue_t *queue )
+{
+	uint64_t head, new_head;
+	struct wnd_msg_queue_item_t *node;
+
+	head = __atomic_load_n(&queue->m_free, __ATOMIC_ACQUIRE);
+	for ( ;; )
+	{
+		dword index = (dword)head;
+
+		/* Pool is exhausted */
+		if (index == 0)
+		{
+			node = (struct wnd_msg_queue_item_t *)malloc(
+					sizeof(struct wnd_msg_queue_item_t));
+			if (node != NULL)
+				node->m_pool_index = -1;
+			return node;
+		}
+
+		node = &queue->m_pool[index - 1];
+		new_head = ((head >> 32) + 1) << 32 | 
+			__atomic_load_n(&node->m_pool_next, __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&queue->m_free, &head, new_head,
+					FALSE, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+			return node;
+	}
+} /* End of 'wnd_msg_node_new' function */
+
+/* Return node to the pool */
+static void wnd_msg_node_free( wnd_msg_queue_t *queue,
+		struct wnd_msg_queue_item_t *node )
+{
+	uint64_t head, new_head;
+
+	/* This node is not from pool */
+	if (node->m_pool_index < 0)
+	{
+		free(node);
+		return;
+	}
+
+	head = __atomic_load_n(&queue->m_free, __ATOMIC_RELAXED);
+	do
+	{
+		__atomic_store_n(&node->m_pool_next, (dword)head, __ATOMIC_RELAXED);
+		new_head = ((head >> 32) + 1) << 32 | (node->m_pool_index + 1);
+	} while (!__atomic_compare_exchange_n(&queue->m_free, &head, new_head,
+				FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+} /* End of 'wnd_msg_node_free' function */
+
+/* Move posted messages to the consumer's list */
+static void wnd_msg_take_incoming( wnd_msg_queue_t *queue )
+{
+	struct wnd_msg_queue_item_t *stack, *first = NULL, *last;
+
+	/* Grab the whole stack */
+	stack = __atomic_exchange_n(&queue->m_incoming, NULL, __ATOMIC_ACQUIRE);
+	if (stack == NULL)
+		return;
+
+	/* Stack is in reverse order */
+	for ( last = stack; stack != NULL; )
+	{
+		struct wnd_msg_queue_item_t *next = stack->m_next;
+		stack->m_next = first;
+		if (first != NULL)
+			first->m_prev = stack;
+		first = stack;
+		stack = next;
+	}
+	first->m_prev = NULL;
+
+	/* Append to the list */
+	if (queue->m_last == NULL)
+		queue->m_base = first;
+	else
+	{
+		queue->m_last->m_next = first;
+		first->m_prev = queue->m_last;
+	}
+	queue->m_last = last;
+} /* End of 'wnd_msg_take_incoming' function */
+
 /* Get a message from queue */
 bool_t wnd_msg_get( wnd_msg_queue_t *queue, wnd_msg_t *msg )
 {
@@ -52,10 +261,15 @@ bool_t wnd_msg_get( wnd_msg_queue_t *queue, wnd_msg_t *msg )
 
 	/* Queue is empty */
 	if (queue->m_base == NULL)
-		return FALSE;
+	{
+		wnd_msg_take_incoming(queue);
+		if (queue->m_base == NULL)
+			return FALSE;
+	}
 
 	/* Save message */
 	*msg = queue->m_base->m_msg;
+	queue->m_num_processed ++;
 
 	/* Delete from the queue */
 	wnd_msg_rem(queue, queue->m_base);
@@ -68,9 +282,6 @@ void wnd_msg_rem( wnd_msg_queue_t *queue, struct wnd_msg_queue_item_t *item )
 	assert(queue);
 	assert(item);
 
-	/* Lock queue */
-	wnd_msg_lock_queue(queue);
-
 	/* Remove message from queue */
 	if (item->m_next != NULL)
 		item->m_next->m_prev = item->m_prev;
@@ -80,67 +291,121 @@ void wnd_msg_rem( wnd_msg_queue_t *queue, struct wnd_msg_queue_item_t *item )
 		item->m_prev->m_next = item->m_next;
 	else
 		queue->m_base = item->m_next;
-	free(item);
-
-	/* Unlock queue */
-	wnd_msg_unlock_queue(queue);
+	wnd_msg_node_free(queue, item);
 } /* End of 'wnd_msg_rem' function */
 
 /* Send a message */
 void wnd_msg_send( wnd_t *wnd, char *name, wnd_msg_data_t data )
+{
+	assert(name);
+	wnd_msg_send_atom(wnd, wnd_msg_atom(name), data);
+} /* End of 'wnd_msg_send' function */
+
+/* Send a message with already interned name */
+void wnd_msg_send_atom( wnd_t *wnd, wnd_msg_atom_t atom, 
+		wnd_msg_data_t data )
 {
 	wnd_msg_queue_t *queue;
 	struct wnd_msg_queue_item_t *node;
 
 	assert(wnd);
-	assert(name);
 	assert(WND_GLOBAL(wnd));
 
 	/* We can not send messages to the non-initialized windows */
-	if (!(WND_FLAGS(wnd) & WND_FLAG_INITIALIZED))
+	if (!(WND_FLAGS(wnd) & WND_FLAG_INITIALIZED) || 
+			atom == WND_MSG_NO_ATOM)
 		return;
-
-	/* Lock queue */
 	queue = WND_MSG_QUEUE(wnd);
 	assert(queue);
-	wnd_msg_lock_queue(queue);
+	__atomic_add_fetch(&queue->m_num_posted, 1, __ATOMIC_RELAXED);
+
+	/* Repaint requests are coalesced: the window has at most one 'display'
+	 * and the screen at most one 'update_screen' in queue */
+	if ((atom == WND_MSG_DISPLAY && 
+			__atomic_exchange_n(&wnd->m_display_pending, TRUE, 
+				__ATOMIC_ACQ_REL)) ||
+		(atom == WND_MSG_UPDATE_SCREEN &&
+			__atomic_exchange_n(&WND_GLOBAL(wnd)->m_update_pending, TRUE,
+				__ATOMIC_ACQ_REL)))
+	{
+		wnd_msg_t msg;
+
+		msg.m_data = data;
+		wnd_msg_free(&msg);
+		__atomic_add_fetch(&queue->m_num_coalesced, 1, __ATOMIC_RELAXED);
+		return;
+	}
 
-	/* Allocate new queue node */
-	node = (struct wnd_msg_queue_item_t *)malloc(
-			sizeof(struct wnd_msg_queue_item_t));
+	/* Fill new queue node. If there is no memory the message is lost, 
+	 * but the next repaint request must get to queue */
+	node = wnd_msg_node_new(queue);
+	if (node == NULL)
+	{
+		wnd_msg_t msg;
+
+		if (atom == WND_MSG_DISPLAY)
+			__atomic_store_n(&wnd->m_display_pending, FALSE, 
+					__ATOMIC_RELEASE);
+		else if (atom == WND_MSG_UPDATE_SCREEN)
+			__atomic_store_n(&WND_GLOBAL(wnd)->m_update_pending, FALSE,
+					__ATOMIC_RELEASE);
+		msg.m_data = data;
+		wnd_msg_free(&msg);
+		return;
+	}
 	node->m_msg.m_wnd = wnd;
-	node->m_msg.m_name = strdup(name);
+	node->m_msg.m_atom = atom;
+	node->m_msg.m_name = wnd_msg_atom_name(atom);
 	node->m_msg.m_data = data;
-	node->m_next = NULL;
 	node->m_prev = NULL;
 
-	/* Add it to the list */
-	if (queue->m_last == NULL)
-	{
-		queue->m_base = queue->m_last = node;
-	}
-	else
+	/* Push it to the incoming stack */
+	node->m_next = __atomic_load_n(&queue->m_incoming, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&queue->m_incoming, &node->m_next,
+				node, TRUE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	/* Wake up the consumer */
+	wnd_msg_queue_wakeup(queue);
+} /* End of 'wnd_msg_send_atom' function */
+
+/* Wait until there are messages in queue, the flag (if any) is set or 
+ * timeout (in milliseconds) expires */
+void wnd_msg_queue_wait( wnd_msg_queue_t *queue, bool_t *flag, 
+		int timeout )
+{
+	struct pollfd pfd;
+	uint64_t val;
+
+	assert(queue);
+	if (queue->m_base != NULL)
+		return;
+
+	/* Tell producers that we are going to sleep and check the queue
+	 * and the flag once more, so that no wake up is lost */
+	__atomic_store_n(&queue->m_waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&queue->m_incoming, __ATOMIC_SEQ_CST) == NULL &&
+			(flag == NULL || !__atomic_load_n(flag, __ATOMIC_SEQ_CST)))
 	{
-		queue->m_last->m_next = node;
-		node->m_prev = queue->m_last;
-		queue->m_last = node;
+		pfd.fd = queue->m_event_fd;
+		pfd.events = POLLIN;
+		poll(&pfd, (queue->m_event_fd >= 0) ? 1 : 0, timeout);
 	}
-	
-	/* Unlock queue */
-	wnd_msg_unlock_queue(queue);
-} /* End of 'wnd_msg_send' function */
+	__atomic_store_n(&queue->m_waiting, 0, __ATOMIC_SEQ_CST);
 
-/* Lock message queue */
-void wnd_msg_lock_queue( wnd_msg_queue_t *queue )
-{
-	pthread_mutex_lock(&queue->m_mutex);
-} /* End of 'wnd_msg_lock_queue' function */
+	/* Reset the event */
+	if (queue->m_event_fd >= 0)
+		read(queue->m_event_fd, &val, sizeof(val));
+} /* End of 'wnd_msg_queue_wait' function */
 
-/* Unlock message queue */
-void wnd_msg_unlock_queue( wnd_msg_queue_t *queue )
+/* Wake up the thread waiting for messages */
+void wnd_msg_queue_wakeup( wnd_msg_queue_t *queue )
 {
-	pthread_mutex_unlock(&queue->m_mutex);
-} /* End of 'wnd_msg_unlock_queue' function */
+	uint64_t val = 1;
+
+	if (queue != NULL && queue->m_event_fd >= 0 && 
+			__atomic_exchange_n(&queue->m_waiting, 0, __ATOMIC_SEQ_CST))
+		write(queue->m_event_fd, &val, sizeof(val));
+} /* End of 'wnd_msg_queue_wakeup' function */
 
 /* Free message queue */
 void wnd_msg_queue_free( wnd_msg_queue_t *queue )
@@ -151,18 +416,19 @@ void wnd_msg_queue_free( wnd_msg_queue_t *queue )
 		return;
 
 	/* Free queue */
-	wnd_msg_lock_queue(queue);
+	wnd_msg_take_incoming(queue);
 	for ( ptr = queue->m_base; ptr != NULL; )
 	{
 		struct wnd_msg_queue_item_t *next = ptr->m_next;
 		wnd_msg_free(&ptr->m_msg);
-		free(ptr);
+		if (ptr->m_pool_index < 0)
+			free(ptr);
 		ptr = next;
 	}
-	wnd_msg_unlock_queue(queue);
 
-	/* Destroy mutex */
-	pthread_mutex_destroy(&queue->m_mutex);
+	/* Close event */
+	if (queue->m_event_fd >= 0)
+		close(queue->m_event_fd);
 	free(queue);
 } /* End of 'wnd_msg_queue_free' function */
 
@@ -176,7 +442,6 @@ void wnd_msg_free( wnd_msg_t *msg )
 			(msg->m_data.m_destructor)(msg->m_data.m_data);
 		free(msg->m_data.m_data);
 	}
-	free(msg->m_name);
 } /* End of 'wnd_msg_free' function */
 
 /* Add a handler to the handlers chain */
@@ -190,7 +455,7 @@ void wnd_msg_add_handler( wnd_t *wnd, char *msg_name, void *h )
 	assert(h);
 
 	/* Obtain handlers chain */
-	chain = wnd_class_get_msg_info(wnd, msg_name, NULL);
+	chain = wnd_class_get_msg_handlers(wnd, wnd_msg_atom(msg_name), NULL);
 
 	/* Allocate memory for handler item */
 	handler = (wnd_msg_handler_t *)malloc(sizeof(*handler));
@@ -220,7 +485,7 @@ void wnd_msg_add_handler_to_end( wnd_t *wnd, char *msg_name, void *h )
 	assert(h);
 
 	/* Obtain handlers chain */
-	chain = wnd_class_get_msg_info(wnd, msg_name, NULL);
+	chain = wnd_class_get_msg_handlers(wnd, wnd_msg_atom(msg_name), NULL);
 
 	/* Allocate memory for handler item */
 	handler = (wnd_msg_handler_t *)malloc(sizeof(*handler));
@@ -246,7 +511,7 @@ void wnd_msg_rem_handler( wnd_t *wnd, char *msg_name )
 	wnd_msg_handler_t **chain;
 
 	assert(wnd);
-	chain = wnd_class_get_msg_info(wnd, msg_name, NULL);
+	chain = wnd_class_get_msg_handlers(wnd, wnd_msg_atom(msg_name), NULL);
 	assert(*chain);
 
 	/* Delete handler and move pointer */
@@ -275,6 +540,7 @@ void wnd_msg_queue_remove_by_window( wnd_msg_queue_t *queue, wnd_t *wnd,
 	assert(queue);
 	assert(wnd);
 
+	wnd_msg_take_incoming(queue);
 	for ( item = queue->m_base; item != NULL; )
 	{
 		wnd_t *target = item->m_msg.m_wnd;
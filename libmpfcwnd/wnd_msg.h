@@ -37,13 +37,43 @@ struct tag_wnd_msg_data_t
 	void (*m_destructor)( void *data );
 };
 
+/* Message name atom. Message names are interned into small integers,
+ * so that dispatching does not need any string comparisons */
+typedef int wnd_msg_atom_t;
+
+/* Atoms of the messages that window library sends itself.
+ * They are always interned in this order */
+enum
+{
+	WND_MSG_DISPLAY = 0,
+	WND_MSG_ERASE_BACK,
+	WND_MSG_UPDATE_SCREEN,
+	WND_MSG_PARENT_REPOS,
+	WND_MSG_DESTRUCTOR,
+	WND_MSG_KEYDOWN,
+	WND_MSG_ACTION,
+	WND_MSG_NUM_PREDEFINED
+};
+
+/* Maximal number of different message names */
+#define WND_MSG_MAX_ATOMS 256
+
+/* Invalid atom */
+#define WND_MSG_NO_ATOM (-1)
+
+/* Number of nodes in the queue pool */
+#define WND_MSG_QUEUE_POOL_SIZE 256
+
 /* Message type */
 struct tag_wnd_msg_t 
 {
 	/* Message target window */
 	wnd_t *m_wnd;
 	
-	/* Message name */
+	/* Message name atom */
+	wnd_msg_atom_t m_atom;
+
+	/* Message name (points to the interned string and is not freed) */
 	char *m_name;
 
 	/* Message data */
@@ -74,10 +104,14 @@ struct tag_wnd_msg_handler_t
 typedef wnd_msg_retcode_t (*wnd_msg_callback_t)( struct tag_wnd_t *wnd,
 		wnd_msg_handler_t *h, wnd_msg_data_t *data );
 
-/* Message queue type */
+/* Message queue type.
+ * Messages may be posted from any thread, but only the window library 
+ * thread takes them. Posted messages are pushed to the lock-free 
+ * incoming stack, which the consumer grabs as a whole and moves to 
+ * its own list in the posting order */
 typedef struct tag_wnd_msg_queue_t
 {
-	/* Queue head and tail */
+	/* Incoming messages stack, queue head and tail */
 	struct wnd_msg_queue_item_t 
 	{
 		/* Message parameters */
@@ -85,10 +119,26 @@ typedef struct tag_wnd_msg_queue_t
 
 		/* Next and previous messages in queue */
 		struct wnd_msg_queue_item_t *m_next, *m_prev;
-	} *m_base, *m_last;
 
-	/* Queue mutex */
-	pthread_mutex_t m_mutex;
+		/* Index of this node in the pool (-1 for allocated nodes) 
+		 * and the next free pool node */
+		int m_pool_index;
+		dword m_pool_next;
+	} *m_incoming, *m_base, *m_last;
+
+	/* Pool of nodes. Free list head keeps index of the first free node
+	 * plus one in the low half and modification tag in the high half
+	 * (to avoid ABA problem) */
+	struct wnd_msg_queue_item_t m_pool[WND_MSG_QUEUE_POOL_SIZE];
+	uint64_t m_free;
+
+	/* Event for waking up the consumer and consumer sleeping flag */
+	int m_event_fd;
+	int m_waiting;
+
+	/* Statistics: messages posted, dropped as duplicate repaint requests
+	 * and taken by the consumer */
+	dword m_num_posted, m_num_coalesced, m_num_processed;
 } wnd_msg_queue_t;
 
 /* Initialize message queue */
@@ -100,14 +150,27 @@ bool_t wnd_msg_get( wnd_msg_queue_t *queue, wnd_msg_t *msg );
 /* Send a message */
 void wnd_msg_send( struct tag_wnd_t *wnd, char *name, wnd_msg_data_t data );
 
+/* Send a message with already interned name */
+void wnd_msg_send_atom( struct tag_wnd_t *wnd, wnd_msg_atom_t atom, 
+		wnd_msg_data_t data );
+
+/* Get atom for a message name (interning it if it is new) */
+wnd_msg_atom_t wnd_msg_atom( const char *name );
+
+/* Get message name by its atom */
+char *wnd_msg_atom_name( wnd_msg_atom_t atom );
+
 /* Remove a given item from the queue */
 void wnd_msg_rem( wnd_msg_queue_t *queue, struct wnd_msg_queue_item_t *item );
 
-/* Lock message queue */
-void wnd_msg_lock_queue( wnd_msg_queue_t *queue );
+/* Wait until there are messages in queue, the flag (if any) is set or 
+ * timeout (in milliseconds) expires. Flag setter must wake the queue up
+ * after setting it */
+void wnd_msg_queue_wait( wnd_msg_queue_t *queue, bool_t *flag, 
+		int timeout );
 
-/* Unlock message queue */
-void wnd_msg_unlock_queue( wnd_msg_queue_t *queue );
+/* Wake up the thread waiting for messages */
+void wnd_msg_queue_wakeup( wnd_msg_queue_t *queue );
 
 /* Free message queue */
 void wnd_msg_queue_free( wnd_msg_queue_t *queue );
@@ -0,0 +1,172 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Play list change log functions implementation.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "change_log.h"
+
+/* Get buffer index of the entry at the given position */
+#define CHLOG_INDEX(log, pos) (((log)->m_head + (pos)) % (log)->m_size)
+
+/* Create a new change log */
+chlog_t *chlog_new( int size )
+{
+	chlog_t *log;
+
+	if (size <= 0)
+		size = CHLOG_DEF_SIZE;
+
+	log = (chlog_t *)malloc(sizeof(chlog_t));
+	if (log == NULL)
+		return NULL;
+	memset(log, 0, sizeof(*log));
+	log->m_entries = (chlog_entry_t *)calloc(size, sizeof(chlog_entry_t));
+	if (log->m_entries == NULL)
+	{
+		free(log);
+		return NULL;
+	}
+	log->m_size = size;
+	pthread_mutex_init(&log->m_mutex, NULL);
+	return log;
+} /* End of 'chlog_new' function */
+
+/* Drop the oldest entry */
+static void chlog_drop( chlog_t *log )
+{
+	chlog_entry_t *e = &log->m_entries[log->m_head];
+
+	log->m_trunc_version = e->m_version;
+	if (e->m_transform != NULL)
+	{
+		free(e->m_transform);
+		e->m_transform = NULL;
+	}
+	log->m_head = (log->m_head + 1) % log->m_size;
+	log->m_len --;
+} /* End of 'chlog_drop' function */
+
+/* Free change log */
+void chlog_free( chlog_t *log )
+{
+	if (log == NULL)
+		return;
+
+	while (log->m_len > 0)
+		chlog_drop(log);
+	free(log->m_entries);
+	pthread_mutex_destroy(&log->m_mutex);
+	free(log);
+} /* End of 'chlog_free' function */
+
+/* Add a change. Transform is copied */
+void chlog_add( chlog_t *log, uint64_t version, chlog_type_t type, 
+		int start, int end, int to, int *transform )
+{
+	chlog_entry_t *e;
+	int *t = NULL;
+
+	if (log == NULL)
+		return;
+
+	/* Copy permutation */
+	if (type == CHLOG_SORT)
+	{
+		if (transform != NULL && end > 0 && end <= CHLOG_MAX_TRANSFORM)
+			t = (int *)malloc(sizeof(int) * end);
+		if (t != NULL)
+			memcpy(t, transform, sizeof(int) * end);
+	}
+
+	pthread_mutex_lock(&log->m_mutex);
+	log->m_version = version;
+
+	/* Permutation can't be stored: clients have to resync */
+	if (type == CHLOG_SORT && t == NULL)
+	{
+		while (log->m_len > 0)
+			chlog_drop(log);
+		log->m_trunc_version = version;
+		pthread_mutex_unlock(&log->m_mutex);
+		return;
+	}
+
+	if (log->m_len == log->m_size)
+		chlog_drop(log);
+	e = &log->m_entries[CHLOG_INDEX(log, log->m_len)];
+	e->m_version = version;
+	e->m_type = type;
+	e->m_start = start;
+	e->m_end = end;
+	e->m_to = to;
+	e->m_transform = t;
+	log->m_len ++;
+	pthread_mutex_unlock(&log->m_mutex);
+} /* End of 'chlog_add' function */
+
+/* Call function for every change made after the given version. Returns
+ * FALSE if these changes are not available. Version of the last change
+ * is stored to 'last_version' */
+bool_t chlog_foreach_since( chlog_t *log, uint64_t version, 
+		chlog_func_t f, void *ctx, uint64_t *last_version )
+{
+	int i;
+
+	if (log == NULL)
+		return FALSE;
+
+	pthread_mutex_lock(&log->m_mutex);
+	(*last_version) = log->m_version;
+	if (version < log->m_trunc_version || version > log->m_version)
+	{
+		pthread_mutex_unlock(&log->m_mutex);
+		return FALSE;
+	}
+
+	/* Versions are increasing, so find the first newer entry from
+	 * the end */
+	for ( i = log->m_len; i > 0; i -- )
+	{
+		if (log->m_entries[CHLOG_INDEX(log, i - 1)].m_version <= version)
+			break;
+	}
+	for ( ; i < log->m_len; i ++ )
+		f(&log->m_entries[CHLOG_INDEX(log, i)], ctx);
+	pthread_mutex_unlock(&log->m_mutex);
+	return TRUE;
+} /* End of 'chlog_foreach_since' function */
+
+/* Get change type name */
+const char *chlog_type_name( chlog_type_t type )
+{
+	static const char *names[] = 
+		{ "insert", "remove", "move", "sort", "info", "cur_song" };
+
+	if (type < 0 || type >= sizeof(names) / sizeof(names[0]))
+		return "";
+	return names[type];
+} /* End of 'chlog_type_name' function */
+
+/* End of 'change_log.c' file */
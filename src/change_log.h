@@ -0,0 +1,117 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Interface for play list change log functions.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#ifndef __SG_MPFC_CHANGE_LOG_H__
+#define __SG_MPFC_CHANGE_LOG_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Change types */
+typedef enum
+{
+	/* m_end songs inserted at position m_start */
+	CHLOG_INSERT = 0,
+
+	/* Songs from m_start to m_end removed */
+	CHLOG_REMOVE,
+
+	/* Songs from m_start to m_end moved to position m_to */
+	CHLOG_MOVE,
+
+	/* List of m_end songs sorted; song with index i is moved to 
+	 * m_transform[i] */
+	CHLOG_SORT,
+
+	/* Info of song m_start changed */
+	CHLOG_INFO,
+
+	/* Current song changed to m_start */
+	CHLOG_CUR_SONG
+} chlog_type_t;
+
+/* Change log entry */
+typedef struct
+{
+	/* Play list version after this change */
+	uint64_t m_version;
+
+	/* Change type and parameters */
+	chlog_type_t m_type;
+	int m_start, m_end, m_to;
+	int *m_transform;
+} chlog_entry_t;
+
+/* Change log. This is a ring buffer of the last changes; older entries 
+ * are dropped */
+typedef struct tag_chlog_t
+{
+	/* Entries buffer */
+	chlog_entry_t *m_entries;
+
+	/* Buffer size, index of the oldest entry and number of entries */
+	int m_size, m_head, m_len;
+
+	/* Changes up to this version are lost */
+	uint64_t m_trunc_version;
+
+	/* Version of the last change */
+	uint64_t m_version;
+
+	/* Log mutex */
+	pthread_mutex_t m_mutex;
+} chlog_t;
+
+/* Default log size */
+#define CHLOG_DEF_SIZE 1024
+
+/* Sort permutations longer than this are not stored. Log is truncated
+ * instead */
+#define CHLOG_MAX_TRANSFORM 65536
+
+/* Change handler for iteration function */
+typedef void (*chlog_func_t)( chlog_entry_t *entry, void *ctx );
+
+/* Create a new change log */
+chlog_t *chlog_new( int size );
+
+/* Free change log */
+void chlog_free( chlog_t *log );
+
+/* Add a change. Transform is copied */
+void chlog_add( chlog_t *log, uint64_t version, chlog_type_t type, 
+		int start, int end, int to, int *transform );
+
+/* Call function for every change made after the given version. Returns
+ * FALSE if these changes are not available. Version of the last change
+ * is stored to 'last_version' */
+bool_t chlog_foreach_since( chlog_t *log, uint64_t version, 
+		chlog_func_t f, void *ctx, uint64_t *last_version );
+
+/* Get change type name */
+const char *chlog_type_name( chlog_type_t type );
+
+#endif
+
+/* End of 'change_log.h' file */
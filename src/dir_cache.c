@@ -0,0 +1,266 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Directory listings cache.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "dir_cache.h"
+#include "file_utils.h"
+
+/* Create a new cache */
+dcache_t *dcache_new( int max )
+{
+	dcache_t *cache;
+
+	if (max <= 0)
+		max = DCACHE_DEF_SIZE;
+
+	cache = (dcache_t *)malloc(sizeof(dcache_t));
+	if (cache == NULL)
+		return NULL;
+	memset(cache, 0, sizeof(*cache));
+	cache->m_max = max;
+	pthread_mutex_init(&cache->m_mutex, NULL);
+	return cache;
+} /* End of 'dcache_new' function */
+
+/* Free listing */
+static void dcache_dir_free( dcache_dir_t *dir )
+{
+	free(dir->m_path);
+	if (dir->m_entries != NULL)
+		free(dir->m_entries);
+	if (dir->m_names != NULL)
+		free(dir->m_names);
+	free(dir);
+} /* End of 'dcache_dir_free' function */
+
+/* Remove listing from the list */
+static void dcache_unlink( dcache_t *cache, dcache_dir_t *dir )
+{
+	if (dir->m_prev != NULL)
+		dir->m_prev->m_next = dir->m_next;
+	else
+		cache->m_head = dir->m_next;
+	if (dir->m_next != NULL)
+		dir->m_next->m_prev = dir->m_prev;
+	else
+		cache->m_tail = dir->m_prev;
+	cache->m_num --;
+} /* End of 'dcache_unlink' function */
+
+/* Put listing to the list head */
+static void dcache_push_front( dcache_t *cache, dcache_dir_t *dir )
+{
+	dir->m_prev = NULL;
+	dir->m_next = cache->m_head;
+	if (cache->m_head != NULL)
+		cache->m_head->m_prev = dir;
+	else
+		cache->m_tail = dir;
+	cache->m_head = dir;
+	cache->m_num ++;
+} /* End of 'dcache_push_front' function */
+
+/* Free cache */
+void dcache_free( dcache_t *cache )
+{
+	if (cache == NULL)
+		return;
+
+	while (cache->m_head != NULL)
+	{
+		dcache_dir_t *dir = cache->m_head;
+		dcache_unlink(cache, dir);
+		dcache_dir_free(dir);
+	}
+	pthread_mutex_destroy(&cache->m_mutex);
+	free(cache);
+} /* End of 'dcache_free' function */
+
+/* Compare entries by name */
+static int dcache_cmp( const void *a, const void *b, void *ctx )
+{
+	const dcache_entry_t *e1 = (const dcache_entry_t *)a;
+	const dcache_entry_t *e2 = (const dcache_entry_t *)b;
+	const char *names = (const char *)ctx;
+
+	return strcmp(&names[e1->m_name], &names[e2->m_name]);
+} /* End of 'dcache_cmp' function */
+
+/* Add entry to listing */
+static bool_t dcache_add_entry( dcache_dir_t *dir, const char *name, 
+		bool_t is_dir, int *entries_size, size_t *names_size )
+{
+	size_t len = strlen(name) + 1;
+
+	if (dir->m_num >= (*entries_size))
+	{
+		int size = (*entries_size) ? (*entries_size) * 2 : 64;
+		dcache_entry_t *entries = (dcache_entry_t *)realloc(dir->m_entries,
+				sizeof(dcache_entry_t) * size);
+		if (entries == NULL)
+			return FALSE;
+		dir->m_entries = entries;
+		(*entries_size) = size;
+	}
+	if (dir->m_names_len + len > (*names_size))
+	{
+		size_t size = (*names_size) ? (*names_size) * 2 : 1024;
+		while (size < dir->m_names_len + len)
+			size *= 2;
+		char *names = (char *)realloc(dir->m_names, size);
+		if (names == NULL)
+			return FALSE;
+		dir->m_names = names;
+		(*names_size) = size;
+	}
+
+	memcpy(&dir->m_names[dir->m_names_len], name, len);
+	dir->m_entries[dir->m_num].m_name = dir->m_names_len;
+	dir->m_entries[dir->m_num].m_is_dir = is_dir;
+	dir->m_names_len += len;
+	dir->m_num ++;
+	return TRUE;
+} /* End of 'dcache_add_entry' function */
+
+/* Read directory */
+static dcache_dir_t *dcache_read( const char *path, struct stat *st )
+{
+	dcache_dir_t *dir;
+	fu_dir_t *d;
+	int entries_size = 0;
+	size_t names_size = 0;
+
+	d = fu_opendir(path);
+	if (d == NULL)
+		return NULL;
+
+	dir = (dcache_dir_t *)malloc(sizeof(dcache_dir_t));
+	if (dir == NULL)
+	{
+		fu_closedir(d);
+		return NULL;
+	}
+	memset(dir, 0, sizeof(*dir));
+	dir->m_path = strdup(path);
+	dir->m_dev = st->st_dev;
+	dir->m_ino = st->st_ino;
+	dir->m_mtime = st->st_mtim;
+
+	for ( ;; )
+	{
+		struct dirent *de = fu_readdir(d);
+		bool_t is_dir;
+
+		if (de == NULL)
+			break;
+		if (fu_is_special_dir(de->d_name))
+			continue;
+		if (!fu_entry_type(d, de, &is_dir))
+			continue;
+		if (!dcache_add_entry(dir, de->d_name, is_dir, &entries_size, 
+					&names_size))
+		{
+			fu_closedir(d);
+			dcache_dir_free(dir);
+			return NULL;
+		}
+	}
+	fu_closedir(d);
+
+	qsort_r(dir->m_entries, dir->m_num, sizeof(dcache_entry_t), dcache_cmp,
+			dir->m_names);
+	return dir;
+} /* End of 'dcache_read' function */
+
+/* Get directory listing, reading the directory if it has changed since 
+ * the cached one was made. Cache remains locked until 'dcache_release'
+ * (even if NULL is returned) */
+dcache_dir_t *dcache_get( dcache_t *cache, const char *path )
+{
+	struct stat st;
+	dcache_dir_t *dir;
+
+	pthread_mutex_lock(&cache->m_mutex);
+
+	/* Directory modification time tells if listing is still valid */
+	if (stat(path, &st) || !S_ISDIR(st.st_mode))
+		return NULL;
+	for ( dir = cache->m_head; dir != NULL; dir = dir->m_next )
+	{
+		if (!strcmp(dir->m_path, path))
+			break;
+	}
+	if (dir != NULL)
+	{
+		dcache_unlink(cache, dir);
+		if (dir->m_dev == st.st_dev && dir->m_ino == st.st_ino &&
+				dir->m_mtime.tv_sec == st.st_mtim.tv_sec &&
+				dir->m_mtime.tv_nsec == st.st_mtim.tv_nsec)
+		{
+			dcache_push_front(cache, dir);
+			return dir;
+		}
+		dcache_dir_free(dir);
+	}
+
+	/* Read directory and drop the least recently used listing */
+	dir = dcache_read(path, &st);
+	if (dir == NULL)
+		return NULL;
+	dcache_push_front(cache, dir);
+	if (cache->m_num > cache->m_max)
+	{
+		dcache_dir_t *last = cache->m_tail;
+		dcache_unlink(cache, last);
+		dcache_dir_free(last);
+	}
+	return dir;
+} /* End of 'dcache_get' function */
+
+/* Release listing got by 'dcache_get' */
+void dcache_release( dcache_t *cache )
+{
+	pthread_mutex_unlock(&cache->m_mutex);
+} /* End of 'dcache_release' function */
+
+/* Find the first entry with name not less than the given prefix */
+int dcache_lower_bound( dcache_dir_t *dir, const char *prefix )
+{
+	int lo = 0, hi = dir->m_num;
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (strcmp(DCACHE_NAME(dir, mid), prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+} /* End of 'dcache_lower_bound' function */
+
+/* End of 'dir_cache.c' file */
@@ -0,0 +1,96 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Directory listings cache.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#ifndef __SG_MPFC_DIR_CACHE_H__
+#define __SG_MPFC_DIR_CACHE_H__
+
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* Directory entry */
+typedef struct
+{
+	/* Name offset in the names buffer */
+	int m_name;
+
+	bool_t m_is_dir;
+} dcache_entry_t;
+
+/* Cached directory listing. Entries are sorted by name */
+typedef struct tag_dcache_dir_t
+{
+	char *m_path;
+
+	/* Directory state the listing corresponds to */
+	dev_t m_dev;
+	ino_t m_ino;
+	struct timespec m_mtime;
+
+	dcache_entry_t *m_entries;
+	int m_num;
+
+	/* Names buffer */
+	char *m_names;
+	size_t m_names_len;
+
+	/* Recently used listings go first */
+	struct tag_dcache_dir_t *m_next, *m_prev;
+} dcache_dir_t;
+
+/* Listings cache */
+typedef struct
+{
+	dcache_dir_t *m_head, *m_tail;
+	int m_num, m_max;
+
+	pthread_mutex_t m_mutex;
+} dcache_t;
+
+/* Default number of cached listings */
+#define DCACHE_DEF_SIZE 16
+
+/* Get entry name */
+#define DCACHE_NAME(dir, i) (&(dir)->m_names[(dir)->m_entries[i].m_name])
+
+/* Create a new cache */
+dcache_t *dcache_new( int max );
+
+/* Free cache */
+void dcache_free( dcache_t *cache );
+
+/* Get directory listing, reading the directory if it has changed since 
+ * the cached one was made. Cache remains locked until 'dcache_release'
+ * (even if NULL is returned) */
+dcache_dir_t *dcache_get( dcache_t *cache, const char *path );
+
+/* Release listing got by 'dcache_get' */
+void dcache_release( dcache_t *cache );
+
+/* Find the first entry with name not less than the given prefix */
+int dcache_lower_bound( dcache_dir_t *dir, const char *prefix );
+
+#endif
+
+/* End of 'dir_cache.h' file */
@@ -111,6 +111,32 @@ void fu_closedir(fu_dir_t *dir)
 	free(dir);
 }
 
+/* Determine directory entry type. Type stored in the entry is used 
+ * when file system provides it */
+bool_t fu_entry_type(fu_dir_t *dir, struct dirent *de, bool_t *is_dir)
+{
+	struct stat st;
+
+	if (de->d_type == DT_REG)
+	{
+		(*is_dir) = FALSE;
+		return TRUE;
+	}
+	else if (de->d_type == DT_DIR)
+	{
+		(*is_dir) = TRUE;
+		return TRUE;
+	}
+
+	/* Symbolic link or unknown type: look at the file itself */
+	if (fstatat(dirfd(dir->m_dir), de->d_name, &st, 0))
+		return FALSE;
+	if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+		return FALSE;
+	(*is_dir) = S_ISDIR(st.st_mode);
+	return TRUE;
+}
+
 /* Is this a '.' or '..' ? */
 bool_t fu_is_special_dir(const char *name)
 {
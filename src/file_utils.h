@@ -45,6 +45,10 @@ struct dirent *fu_readdir(fu_dir_t *dir);
 /* Close directory */
 void fu_closedir(fu_dir_t *dir);
 
+/* Determine directory entry type. Type stored in the entry is used 
+ * when file system provides it */
+bool_t fu_entry_type(fu_dir_t *dir, struct dirent *de, bool_t *is_dir);
+
 /* Is this a '.' or '..' ? */
 bool_t fu_is_special_dir(const char *name);
 
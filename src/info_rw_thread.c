@@ -31,6 +31,7 @@
 
 /* Thread queue */
 irw_queue_t *irw_head, *irw_tail;
+int irw_len = 0;
 pthread_mutex_t irw_mutex;
 
 /* Thread info */
@@ -42,6 +43,7 @@ bool_t irw_init( void )
 {
 	/* Initialize queue */
 	irw_head = irw_tail = NULL;
+	irw_len = 0;
 	pthread_mutex_init(&irw_mutex, NULL);
 
 	/* Initialize thread */
@@ -135,6 +137,7 @@ void irw_push( song_t *song, song_flags_t flag )
 			irw_head = node;
 		irw_tail = node;
 	}
+	irw_len++;
 	irw_unlock();
 } /* End of 'irw_push' function */
 
@@ -155,11 +158,23 @@ song_t *irw_pop( void )
 			irw_tail = NULL;
 		else
 			irw_head->m_prev = NULL;
+		irw_len--;
 	}
 	irw_unlock();
 	return s;
 } /* End of 'irw_pop' function */
 
+/* Get number of songs in the queue */
+int irw_get_len( void )
+{
+	int len;
+
+	irw_lock();
+	len = irw_len;
+	irw_unlock();
+	return len;
+} /* End of 'irw_get_len' function */
+
 /* Thread function */
 void *irw_thread( void *arg )
 {
@@ -180,6 +195,7 @@ void *irw_thread( void *arg )
 			if (s->m_flags & SONG_INFO_READ)
 			{
 				song_update_info(s);
+				plist_info_changed(player_plist, s);
 				wnd_invalidate(player_wnd);
 			}
 
@@ -49,6 +49,9 @@ void irw_push( song_t *song, song_flags_t flag );
 /* Get song from the queue */
 song_t *irw_pop( void );
 
+/* Get number of songs in the queue */
+int irw_get_len( void );
+
 /* Thread function */
 void *irw_thread( void *arg );
 
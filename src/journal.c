@@ -0,0 +1,947 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Play list changes journal functions implementation.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include "types.h"
+#include "cfg.h"
+#include "journal.h"
+#include "player.h"
+#include "plist.h"
+#include "snapshot.h"
+#include "song.h"
+#include "song_info.h"
+#include "util.h"
+
+/* Growing data buffer */
+typedef struct
+{
+	uint8_t *m_data;
+	size_t m_len, m_allocated;
+	bool_t m_error;
+} jrn_buf_t;
+
+/* Record payload reader */
+typedef struct
+{
+	const uint8_t *m_ptr, *m_end;
+	bool_t m_error;
+} jrn_reader_t;
+
+/* Journaling state */
+static volatile bool_t jrn_active = FALSE;
+static pthread_t jrn_tid;
+static pthread_mutex_t jrn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jrn_cond = PTHREAD_COND_INITIALIZER;
+static bool_t jrn_end_thread = FALSE;
+static bool_t jrn_compact_request = FALSE;
+static uint64_t jrn_seq = 0;
+static plist_t *jrn_plist = NULL;
+static char *jrn_filename = NULL, *jrn_snapshot_name = NULL;
+static int jrn_fd = -1;
+static off_t jrn_size = 0;
+
+/* Records not written to the file yet */
+static jrn_buf_t jrn_pending;
+
+/* Last logged player state */
+static snapshot_state_t jrn_last_state;
+static bool_t jrn_state_logged = FALSE;
+
+/*****
+ *
+ * Records building and parsing
+ *
+ *****/
+
+/* Append data to buffer */
+static void jrn_put( jrn_buf_t *buf, const void *data, size_t len )
+{
+	if (buf->m_error || !len)
+		return;
+
+	/* Reallocate memory */
+	if (buf->m_len + len > buf->m_allocated)
+	{
+		size_t allocated = buf->m_allocated ? buf->m_allocated : 256;
+		while (allocated < buf->m_len + len)
+			allocated *= 2;
+		uint8_t *d = (uint8_t *)realloc(buf->m_data, allocated);
+		if (d == NULL)
+		{
+			buf->m_error = TRUE;
+			return;
+		}
+		buf->m_data = d;
+		buf->m_allocated = allocated;
+	}
+
+	memcpy(&buf->m_data[buf->m_len], data, len);
+	buf->m_len += len;
+} /* End of 'jrn_put' function */
+
+/* Append 32-bit number */
+static void jrn_put_int32( jrn_buf_t *buf, int32_t val )
+{
+	jrn_put(buf, &val, sizeof(val));
+} /* End of 'jrn_put_int32' function */
+
+/* Append 64-bit number */
+static void jrn_put_int64( jrn_buf_t *buf, int64_t val )
+{
+	jrn_put(buf, &val, sizeof(val));
+} /* End of 'jrn_put_int64' function */
+
+/* Append floating point number */
+static void jrn_put_double( jrn_buf_t *buf, double val )
+{
+	jrn_put(buf, &val, sizeof(val));
+} /* End of 'jrn_put_double' function */
+
+/* Append string */
+static void jrn_put_string( jrn_buf_t *buf, const char *str )
+{
+	uint32_t len = (str == NULL) ? JRN_NO_STRING : strlen(str) + 1;
+
+	jrn_put(buf, &len, sizeof(len));
+	if (str != NULL)
+		jrn_put(buf, str, len);
+} /* End of 'jrn_put_string' function */
+
+/* Append song info (song must be locked) */
+static void jrn_put_info( jrn_buf_t *buf, song_t *s )
+{
+	song_info_t *si = s->m_info;
+	uint32_t flags = 0;
+
+	if (si != NULL && (si->m_flags & SI_INITIALIZED))
+	{
+		flags |= SNAPSHOT_SONG_HAS_INFO;
+		if (s->m_flags & SONG_STATIC_INFO)
+			flags |= SNAPSHOT_SONG_STATIC_INFO;
+	}
+	jrn_put_int32(buf, flags);
+	if (!(flags & SNAPSHOT_SONG_HAS_INFO))
+		return;
+
+	/* Fields go in order of SNAPSHOT_INFO_* indices */
+	jrn_put_string(buf, si->m_artist);
+	jrn_put_string(buf, si->m_name);
+	jrn_put_string(buf, si->m_album);
+	jrn_put_string(buf, si->m_year);
+	jrn_put_string(buf, si->m_genre);
+	jrn_put_string(buf, si->m_comments);
+	jrn_put_string(buf, si->m_track);
+	jrn_put_string(buf, si->m_own_data);
+} /* End of 'jrn_put_info' function */
+
+/* Get data from payload */
+static void jrn_get( jrn_reader_t *r, void *data, size_t len )
+{
+	if (r->m_error || (size_t)(r->m_end - r->m_ptr) < len)
+	{
+		r->m_error = TRUE;
+		return;
+	}
+	memcpy(data, r->m_ptr, len);
+	r->m_ptr += len;
+} /* End of 'jrn_get' function */
+
+/* Get 32-bit number */
+static int32_t jrn_get_int32( jrn_reader_t *r )
+{
+	int32_t val = 0;
+	jrn_get(r, &val, sizeof(val));
+	return val;
+} /* End of 'jrn_get_int32' function */
+
+/* Get 64-bit number */
+static int64_t jrn_get_int64( jrn_reader_t *r )
+{
+	int64_t val = 0;
+	jrn_get(r, &val, sizeof(val));
+	return val;
+} /* End of 'jrn_get_int64' function */
+
+/* Get floating point number */
+static double jrn_get_double( jrn_reader_t *r )
+{
+	double val = 0;
+	jrn_get(r, &val, sizeof(val));
+	return val;
+} /* End of 'jrn_get_double' function */
+
+/* Get string. It points right to the payload */
+static const char *jrn_get_string( jrn_reader_t *r )
+{
+	uint32_t len = JRN_NO_STRING;
+
+	jrn_get(r, &len, sizeof(len));
+	if (r->m_error || len == JRN_NO_STRING)
+		return NULL;
+	if (!len || (size_t)(r->m_end - r->m_ptr) < len || r->m_ptr[len - 1])
+	{
+		r->m_error = TRUE;
+		return NULL;
+	}
+
+	const char *str = (const char *)r->m_ptr;
+	r->m_ptr += len;
+	return str;
+} /* End of 'jrn_get_string' function */
+
+/* Get song info */
+static song_info_t *jrn_get_info( jrn_reader_t *r, bool_t *is_static )
+{
+	const char *f[SNAPSHOT_NUM_INFO];
+
+	uint32_t flags = jrn_get_int32(r);
+	*is_static = ((flags & SNAPSHOT_SONG_STATIC_INFO) != 0);
+	if (!(flags & SNAPSHOT_SONG_HAS_INFO))
+		return NULL;
+	for ( int i = 0; i < SNAPSHOT_NUM_INFO; i ++ )
+		f[i] = jrn_get_string(r);
+	if (r->m_error)
+		return NULL;
+	return snapshot_info_new(f);
+} /* End of 'jrn_get_info' function */
+
+/* Calculate hash of data (FNV-1a) */
+static uint32_t jrn_hash( uint32_t hash, const void *data, size_t len )
+{
+	const uint8_t *p = (const uint8_t *)data;
+
+	for ( size_t i = 0; i < len; i ++ )
+	{
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+	return hash;
+} /* End of 'jrn_hash' function */
+
+/* Calculate record checksum */
+static uint32_t jrn_checksum( const jrn_record_t *r, const uint8_t *payload )
+{
+	uint32_t hash = 2166136261U;
+
+	hash = jrn_hash(hash, &r->m_type, sizeof(r->m_type));
+	hash = jrn_hash(hash, &r->m_size, sizeof(r->m_size));
+	hash = jrn_hash(hash, &r->m_seq, sizeof(r->m_seq));
+	return jrn_hash(hash, payload, r->m_size);
+} /* End of 'jrn_checksum' function */
+
+/* A change can't be logged. Pending records are dropped then (the flush
+ * reports it) and the snapshot is rewritten, so that journal on disk is 
+ * never missing a change in the middle */
+static void jrn_lose_record( void )
+{
+	pthread_mutex_lock(&jrn_mutex);
+	jrn_pending.m_error = TRUE;
+	pthread_cond_signal(&jrn_cond);
+	pthread_mutex_unlock(&jrn_mutex);
+} /* End of 'jrn_lose_record' function */
+
+/* Add record to the pending ones */
+static void jrn_commit( uint32_t type, jrn_buf_t *payload )
+{
+	jrn_record_t r;
+
+	if (payload->m_error)
+	{
+		free(payload->m_data);
+		jrn_lose_record();
+		return;
+	}
+
+	pthread_mutex_lock(&jrn_mutex);
+	memset(&r, 0, sizeof(r));
+	r.m_type = type;
+	r.m_size = payload->m_len;
+	r.m_seq = ++jrn_seq;
+	r.m_checksum = jrn_checksum(&r, payload->m_data);
+	jrn_put(&jrn_pending, &r, sizeof(r));
+	jrn_put(&jrn_pending, payload->m_data, payload->m_len);
+	pthread_mutex_unlock(&jrn_mutex);
+
+	free(payload->m_data);
+} /* End of 'jrn_commit' function */
+
+/*****
+ *
+ * Logging functions
+ *
+ *****/
+
+/* Log song addition (play list must be locked) */
+void jrn_log_add( song_t *s, int where )
+{
+	jrn_buf_t buf;
+
+	if (!jrn_active)
+		return;
+
+	memset(&buf, 0, sizeof(buf));
+	jrn_put_int32(&buf, where);
+	jrn_put_string(&buf, s->m_fullname);
+	jrn_put_string(&buf, s->m_filename);
+	jrn_put_string(&buf, s->m_default_title);
+	jrn_put_int64(&buf, s->m_full_len);
+	jrn_put_int64(&buf, s->m_start_time);
+	jrn_put_int64(&buf, s->m_end_time);
+	song_lock(s);
+	jrn_put_info(&buf, s);
+	song_unlock(s);
+	jrn_commit(JRN_ADD, &buf);
+} /* End of 'jrn_log_add' function */
+
+/* Log songs removal (play list must be locked) */
+void jrn_log_rem( int start, int end )
+{
+	jrn_buf_t buf;
+
+	if (!jrn_active)
+		return;
+
+	memset(&buf, 0, sizeof(buf));
+	jrn_put_int32(&buf, start);
+	jrn_put_int32(&buf, end);
+	jrn_commit(JRN_REM, &buf);
+} /* End of 'jrn_log_rem' function */
+
+/* Log songs moving (play list must be locked) */
+void jrn_log_move( int start, int end, int to )
+{
+	jrn_buf_t buf;
+
+	if (!jrn_active)
+		return;
+
+	memset(&buf, 0, sizeof(buf));
+	jrn_put_int32(&buf, start);
+	jrn_put_int32(&buf, end);
+	jrn_put_int32(&buf, to);
+	jrn_commit(JRN_MOVE, &buf);
+} /* End of 'jrn_log_move' function */
+
+/* Log play list permutation (play list must be locked) */
+void jrn_log_sort( int len, int *transform )
+{
+	jrn_buf_t buf;
+
+	if (!jrn_active)
+		return;
+
+	/* Permutation couldn't be built */
+	if (transform == NULL)
+	{
+		jrn_lose_record();
+		return;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	jrn_put_int32(&buf, len);
+	for ( int i = 0; i < len; i ++ )
+		jrn_put_int32(&buf, transform[i]);
+	jrn_commit(JRN_SORT, &buf);
+} /* End of 'jrn_log_sort' function */
+
+/* Log song info change */
+void jrn_log_info( plist_t *pl, song_t *s )
+{
+	jrn_buf_t buf;
+
+	if (!jrn_active)
+		return;
+
+	/* Keep play list locked so that song index is valid when the record
+	 * is replayed */
+	plist_lock(pl);
+	for ( int i = 0; i < pl->m_len; i ++ )
+	{
+		if (pl->m_list[i] != s)
+			continue;
+
+		memset(&buf, 0, sizeof(buf));
+		jrn_put_int32(&buf, i);
+		song_lock(s);
+		jrn_put_info(&buf, s);
+		song_unlock(s);
+		jrn_commit(JRN_INFO, &buf);
+		break;
+	}
+	plist_unlock(pl);
+} /* End of 'jrn_log_info' function */
+
+/* Log player state if it has changed */
+static void jrn_log_state( void )
+{
+	snapshot_state_t state;
+	jrn_buf_t buf;
+
+	/* Current song index must be in accordance with the play list
+	 * records order */
+	plist_lock(jrn_plist);
+	player_get_state(&state);
+	if (jrn_state_logged && state.m_cur_song == jrn_last_state.m_cur_song &&
+			state.m_cur_time == jrn_last_state.m_cur_time &&
+			state.m_status == jrn_last_state.m_status &&
+			state.m_start == jrn_last_state.m_start &&
+			state.m_end == jrn_last_state.m_end &&
+			state.m_volume == jrn_last_state.m_volume)
+	{
+		plist_unlock(jrn_plist);
+		return;
+	}
+
+	memset(&buf, 0, sizeof(buf));
+	jrn_put_int32(&buf, state.m_cur_song);
+	jrn_put_int64(&buf, state.m_cur_time);
+	jrn_put_int32(&buf, state.m_status);
+	jrn_put_int32(&buf, state.m_start);
+	jrn_put_int32(&buf, state.m_end);
+	jrn_put_double(&buf, state.m_volume);
+	jrn_commit(JRN_STATE, &buf);
+	plist_unlock(jrn_plist);
+
+	jrn_last_state = state;
+	jrn_state_logged = TRUE;
+} /* End of 'jrn_log_state' function */
+
+/*****
+ *
+ * Journal file functions
+ *
+ *****/
+
+/* Write all data to file */
+static bool_t jrn_write( int fd, const void *data, size_t len )
+{
+	const uint8_t *p = (const uint8_t *)data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		p += n;
+		len -= n;
+	}
+	return TRUE;
+} /* End of 'jrn_write' function */
+
+/* Create an empty journal file */
+static int jrn_create( const char *filename )
+{
+	jrn_header_t header;
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0)
+		return -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, JRN_MAGIC, sizeof(JRN_MAGIC));
+	header.m_version = JRN_VERSION;
+	if (!jrn_write(fd, &header, sizeof(header)) || fdatasync(fd))
+	{
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+} /* End of 'jrn_create' function */
+
+/* Write pending records to the file */
+static void jrn_flush( void )
+{
+	jrn_buf_t buf;
+
+	pthread_mutex_lock(&jrn_mutex);
+	buf = jrn_pending;
+	memset(&jrn_pending, 0, sizeof(jrn_pending));
+	pthread_mutex_unlock(&jrn_mutex);
+
+	/* Some records are lost; the only way to get consistent state on disk
+	 * is to rewrite the snapshot */
+	if (buf.m_error)
+	{
+		logger_error(player_log, 0, 
+				_("Not enough memory for journal records"));
+		pthread_mutex_lock(&jrn_mutex);
+		jrn_compact_request = TRUE;
+		pthread_mutex_unlock(&jrn_mutex);
+	}
+	else if (buf.m_len)
+	{
+		/* All the records are synced at once */
+		if (jrn_write(jrn_fd, buf.m_data, buf.m_len) && !fdatasync(jrn_fd))
+			jrn_size += buf.m_len;
+		else
+		{
+			logger_error(player_log, 0, _("Unable to write journal %s: %s"),
+					jrn_filename, strerror(errno));
+			pthread_mutex_lock(&jrn_mutex);
+			jrn_compact_request = TRUE;
+			pthread_mutex_unlock(&jrn_mutex);
+		}
+	}
+	if (buf.m_data != NULL)
+		free(buf.m_data);
+} /* End of 'jrn_flush' function */
+
+/* Rewrite snapshot and start an empty journal */
+static void jrn_compact( void )
+{
+	snapshot_state_t state;
+
+	logger_debug(player_log, "Compacting journal");
+	player_get_state(&state);
+	if (!snapshot_save(jrn_snapshot_name, jrn_plist, &state))
+		return;
+
+	/* Everything in the old journal is reflected by the snapshot now. 
+	 * If we fail here old journal is still fine */
+	char *tmp_name = util_strcat(jrn_filename, ".tmp", NULL);
+	int fd = jrn_create(tmp_name);
+	if (fd < 0 || rename(tmp_name, jrn_filename))
+	{
+		logger_error(player_log, 0, _("Unable to create journal %s: %s"),
+				jrn_filename, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		unlink(tmp_name);
+	}
+	else
+	{
+		close(jrn_fd);
+		jrn_fd = fd;
+		jrn_size = sizeof(jrn_header_t);
+	}
+	free(tmp_name);
+} /* End of 'jrn_compact' function */
+
+/* Journal thread function */
+static void *jrn_thread( void *arg )
+{
+	int interval = cfg_get_var_int(cfg_list, "journal-flush-interval");
+	int compact_size = cfg_get_var_int(cfg_list, "journal-compact-size");
+	if (interval <= 0)
+		interval = 1000;
+
+	for ( ;; )
+	{
+		struct timeval now;
+		struct timespec timeout;
+		bool_t end, compact;
+
+		/* Wait for the next flush time */
+		gettimeofday(&now, NULL);
+		timeout.tv_sec = now.tv_sec + interval / 1000;
+		timeout.tv_nsec = now.tv_usec * 1000 + (interval % 1000) * 1000000;
+		if (timeout.tv_nsec >= 1000000000)
+		{
+			timeout.tv_sec ++;
+			timeout.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&jrn_mutex);
+		if (!jrn_end_thread && !jrn_compact_request)
+			pthread_cond_timedwait(&jrn_cond, &jrn_mutex, &timeout);
+		end = jrn_end_thread;
+		compact = jrn_compact_request;
+		jrn_compact_request = FALSE;
+		pthread_mutex_unlock(&jrn_mutex);
+
+		/* Pending records go to the new journal then. Those already 
+		 * reflected by snapshot are skipped during replay */
+		if (compact)
+			jrn_compact();
+
+		/* Write down changes */
+		jrn_log_state();
+		jrn_flush();
+		if (compact_size > 0 && jrn_size > compact_size)
+			jrn_compact();
+
+		/* Failed last flush leaves no chance for a later one to fix
+		 * journal, so rewrite snapshot right now */
+		if (end)
+		{
+			pthread_mutex_lock(&jrn_mutex);
+			compact = jrn_compact_request;
+			jrn_compact_request = FALSE;
+			pthread_mutex_unlock(&jrn_mutex);
+			if (compact)
+				jrn_compact();
+			break;
+		}
+	}
+	return NULL;
+} /* End of 'jrn_thread' function */
+
+/* Start journaling */
+bool_t jrn_start( const char *filename, const char *snapshot_name, 
+		plist_t *pl, bool_t compact )
+{
+	struct stat st;
+
+	if (jrn_active)
+		return TRUE;
+
+	/* Open journal. Existing one is continued unless snapshot is going 
+	 * to be rewritten */
+	if (compact || stat(filename, &st) || 
+			st.st_size < (off_t)sizeof(jrn_header_t))
+	{
+		jrn_fd = jrn_create(filename);
+		jrn_size = sizeof(jrn_header_t);
+	}
+	else
+	{
+		jrn_fd = open(filename, O_WRONLY | O_APPEND);
+		jrn_size = st.st_size;
+	}
+	if (jrn_fd < 0)
+	{
+		logger_error(player_log, 0, _("Unable to open journal %s: %s"),
+				filename, strerror(errno));
+		return FALSE;
+	}
+
+	jrn_filename = strdup(filename);
+	jrn_snapshot_name = strdup(snapshot_name);
+	jrn_plist = pl;
+	jrn_end_thread = FALSE;
+	jrn_compact_request = compact;
+	jrn_state_logged = FALSE;
+	jrn_active = TRUE;
+	if (pthread_create(&jrn_tid, NULL, jrn_thread, NULL))
+	{
+		logger_error(player_log, 0, _("Unable to create journal thread"));
+		jrn_active = FALSE;
+		close(jrn_fd);
+		jrn_fd = -1;
+		free(jrn_filename);
+		free(jrn_snapshot_name);
+		jrn_filename = jrn_snapshot_name = NULL;
+		return FALSE;
+	}
+	return TRUE;
+} /* End of 'jrn_start' function */
+
+/* Write down pending records and stop journaling */
+void jrn_stop( void )
+{
+	if (!jrn_active)
+		return;
+
+	/* Thread does the last flush before exit */
+	jrn_active = FALSE;
+	pthread_mutex_lock(&jrn_mutex);
+	jrn_end_thread = TRUE;
+	pthread_cond_signal(&jrn_cond);
+	pthread_mutex_unlock(&jrn_mutex);
+	pthread_join(jrn_tid, NULL);
+
+	close(jrn_fd);
+	jrn_fd = -1;
+	free(jrn_filename);
+	free(jrn_snapshot_name);
+	jrn_filename = jrn_snapshot_name = NULL;
+	if (jrn_pending.m_data != NULL)
+		free(jrn_pending.m_data);
+	memset(&jrn_pending, 0, sizeof(jrn_pending));
+} /* End of 'jrn_stop' function */
+
+/* Check if journaling is active */
+bool_t jrn_is_active( void )
+{
+	return jrn_active;
+} /* End of 'jrn_is_active' function */
+
+/* Get last used record sequence number */
+uint64_t jrn_get_seq( void )
+{
+	pthread_mutex_lock(&jrn_mutex);
+	uint64_t seq = jrn_seq;
+	pthread_mutex_unlock(&jrn_mutex);
+	return seq;
+} /* End of 'jrn_get_seq' function */
+
+/*****
+ *
+ * Replaying
+ *
+ *****/
+
+/* Set selection to songs from the record */
+static bool_t jrn_select( plist_t *pl, int start, int end )
+{
+	if (start < 0 || start > end || end >= pl->m_len)
+		return FALSE;
+	pl->m_sel_start = start;
+	pl->m_sel_end = end;
+	return TRUE;
+} /* End of 'jrn_select' function */
+
+/* Apply play list permutation */
+static bool_t jrn_apply_sort( plist_t *pl, jrn_reader_t *r )
+{
+	bool_t ret = FALSE;
+	int len = jrn_get_int32(r);
+	int *transform = NULL;
+	song_t **list = NULL;
+
+	if (r->m_error || len != pl->m_len || len <= 0)
+		return FALSE;
+	transform = (int *)malloc(sizeof(int) * len);
+	list = (song_t **)calloc(len, sizeof(song_t *));
+	if (transform == NULL || list == NULL)
+		goto finally;
+
+	/* Check that this is a permutation */
+	for ( int i = 0; i < len; i ++ )
+	{
+		transform[i] = jrn_get_int32(r);
+		if (r->m_error || transform[i] < 0 || transform[i] >= len ||
+				list[transform[i]] != NULL)
+			goto finally;
+		list[transform[i]] = pl->m_list[i];
+	}
+
+	plist_lock(pl);
+	memcpy(pl->m_list, list, sizeof(song_t *) * len);
+	if (pl->m_cur_song >= 0)
+		pl->m_cur_song = transform[pl->m_cur_song];
+	plist_changed(pl, CHLOG_SORT, 0, len, 0, transform);
+	plist_unlock(pl);
+	ret = TRUE;
+
+finally:
+	if (transform != NULL)
+		free(transform);
+	if (list != NULL)
+		free(list);
+	return ret;
+} /* End of 'jrn_apply_sort' function */
+
+/* Apply a record */
+static bool_t jrn_apply( plist_t *pl, snapshot_state_t *state, 
+		uint32_t type, jrn_reader_t *r )
+{
+	/* Add song */
+	if (type == JRN_ADD)
+	{
+		song_metadata_t metadata = SONG_METADATA_EMPTY;
+		bool_t is_static_info;
+
+		int where = jrn_get_int32(r);
+		const char *fullname = jrn_get_string(r);
+		const char *filename = jrn_get_string(r);
+		metadata.m_title = jrn_get_string(r);
+		metadata.m_len = jrn_get_int64(r);
+		metadata.m_start_time = jrn_get_int64(r);
+		metadata.m_end_time = jrn_get_int64(r);
+		song_info_t *si = jrn_get_info(r, &is_static_info);
+		if (r->m_error || fullname == NULL)
+		{
+			if (si)
+				si_free(si);
+			return FALSE;
+		}
+
+		if (is_static_info)
+			metadata.m_song_info = si;
+		song_t *s = song_new_from_names(fullname, filename, &metadata);
+		if (s == NULL)
+		{
+			if (si)
+				si_free(si);
+			return FALSE;
+		}
+		if (!is_static_info && si)
+			song_set_info(s, si);
+		plist_add_song(pl, s, where);
+	}
+	/* Remove songs */
+	else if (type == JRN_REM)
+	{
+		int start = jrn_get_int32(r);
+		int end = jrn_get_int32(r);
+		if (r->m_error || !jrn_select(pl, start, end))
+			return FALSE;
+		plist_rem(pl);
+	}
+	/* Move songs */
+	else if (type == JRN_MOVE)
+	{
+		int start = jrn_get_int32(r);
+		int end = jrn_get_int32(r);
+		int to = jrn_get_int32(r);
+		if (r->m_error || !jrn_select(pl, start, end))
+			return FALSE;
+		plist_move_sel(pl, to, FALSE);
+	}
+	/* Sort */
+	else if (type == JRN_SORT)
+		return jrn_apply_sort(pl, r);
+	/* Change song info */
+	else if (type == JRN_INFO)
+	{
+		bool_t is_static_info;
+		int index = jrn_get_int32(r);
+		song_info_t *si = jrn_get_info(r, &is_static_info);
+		if (r->m_error || si == NULL || index < 0 || index >= pl->m_len)
+		{
+			if (si)
+				si_free(si);
+			return FALSE;
+		}
+		song_set_info(pl->m_list[index], si);
+		plist_info_changed(pl, pl->m_list[index]);
+	}
+	/* Player state */
+	else if (type == JRN_STATE)
+	{
+		int cur_song = jrn_get_int32(r);
+		state->m_cur_time = jrn_get_int64(r);
+		state->m_status = jrn_get_int32(r);
+		state->m_start = jrn_get_int32(r);
+		state->m_end = jrn_get_int32(r);
+		state->m_volume = jrn_get_double(r);
+		if (r->m_error)
+			return FALSE;
+		pl->m_cur_song = (cur_song < pl->m_len) ? cur_song : -1;
+	}
+	else
+		return FALSE;
+	return TRUE;
+} /* End of 'jrn_apply' function */
+
+/* Apply journal to the play list and state loaded from snapshot */
+bool_t jrn_replay( const char *filename, plist_t *pl, snapshot_state_t *state )
+{
+	bool_t ret = FALSE;
+	uint8_t *data = NULL;
+	struct stat st;
+	size_t size = 0, pos;
+	int num_applied = 0, num_failed = 0;
+	bool_t was_store = player_store_undo;
+
+	jrn_seq = state->m_journal_seq;
+
+	int fd = open(filename, O_RDWR);
+	if (fd < 0)
+		return (errno == ENOENT);
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(jrn_header_t))
+		goto finally;
+	size = st.st_size;
+
+	/* Read the journal */
+	data = (uint8_t *)malloc(size);
+	if (data == NULL)
+		goto finally;
+	for ( pos = 0; pos < size; )
+	{
+		ssize_t n = read(fd, &data[pos], size - pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			goto finally;
+		pos += n;
+	}
+	const jrn_header_t *header = (const jrn_header_t *)data;
+	if (memcmp(header->m_magic, JRN_MAGIC, sizeof(JRN_MAGIC)) ||
+			header->m_version != JRN_VERSION)
+	{
+		logger_error(player_log, 0, _("Journal %s has unsupported format"),
+				filename);
+		goto finally;
+	}
+
+	/* Current song index is tracked through the play list changes */
+	player_store_undo = FALSE;
+	pl->m_cur_song = (state->m_cur_song < pl->m_len) ? state->m_cur_song : -1;
+
+	/* Apply records that are newer than the snapshot */
+	for ( pos = sizeof(jrn_header_t); pos + sizeof(jrn_record_t) <= size; )
+	{
+		jrn_record_t rec;
+		jrn_reader_t r;
+
+		memcpy(&rec, &data[pos], sizeof(rec));
+		if (rec.m_size > size - pos - sizeof(rec))
+			break;
+		const uint8_t *payload = &data[pos + sizeof(rec)];
+		if (rec.m_checksum != jrn_checksum(&rec, payload))
+			break;
+		pos += sizeof(rec) + rec.m_size;
+
+		if (rec.m_seq <= state->m_journal_seq)
+			continue;
+		r.m_ptr = payload;
+		r.m_end = payload + rec.m_size;
+		r.m_error = FALSE;
+		if (jrn_apply(pl, state, rec.m_type, &r))
+			num_applied ++;
+		else
+			num_failed ++;
+		if (rec.m_seq > jrn_seq)
+			jrn_seq = rec.m_seq;
+	}
+	state->m_cur_song = pl->m_cur_song;
+	pl->m_cur_song = -1;
+	player_store_undo = was_store;
+
+	/* Cut off partially written record so that new ones follow the
+	 * valid records */
+	if (pos < size)
+	{
+		logger_debug(player_log, "Journal %s is cut off at %lu", 
+				filename, (unsigned long)pos);
+		if (ftruncate(fd, pos))
+			logger_error(player_log, 0, _("Unable to truncate journal %s: %s"),
+					filename, strerror(errno));
+	}
+	logger_debug(player_log, "Applied %d journal records (%d failed)",
+			num_applied, num_failed);
+	ret = TRUE;
+
+finally:
+	if (data != NULL)
+		free(data);
+	close(fd);
+	return ret;
+} /* End of 'jrn_replay' function */
+
+/* End of 'journal.c' file */
@@ -0,0 +1,111 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Interface for play list changes journal functions.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#ifndef __SG_MPFC_JOURNAL_H__
+#define __SG_MPFC_JOURNAL_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "main_types.h"
+#include "plist.h"
+#include "snapshot.h"
+
+/* Journal file format:
+ *  - header (jrn_header_t)
+ *  - records: jrn_record_t followed by m_size bytes of payload
+ * Payload consists of 32 and 64-bit numbers and strings (32-bit length
+ * including the terminating NUL followed by the characters; length
+ * JRN_NO_STRING stands for a missing string). Record with a wrong
+ * checksum is a partially written one and ends the journal. 
+ * Journal holds changes made after the snapshot was saved: records with
+ * sequence numbers not greater than one stored in the snapshot are
+ * already reflected by it */
+#define JRN_MAGIC	"MPFCJRN"
+#define JRN_VERSION	1
+
+/* Length of a missing string */
+#define JRN_NO_STRING	0xFFFFFFFF
+
+/* Record types */
+#define JRN_ADD		1
+#define JRN_REM		2
+#define JRN_MOVE	3
+#define JRN_SORT	4
+#define JRN_INFO	5
+#define JRN_STATE	6
+
+/* File header */
+typedef struct
+{
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_reserved;
+} jrn_header_t;
+
+/* Record header */
+typedef struct
+{
+	uint32_t m_type;
+	uint32_t m_size;
+	uint64_t m_seq;
+	uint32_t m_checksum;
+	uint32_t m_reserved;
+} jrn_record_t;
+
+/* Apply journal to the play list and state loaded from snapshot. 
+ * Returns FALSE if journal is unusable and must be started anew */
+bool_t jrn_replay( const char *filename, plist_t *pl, snapshot_state_t *state );
+
+/* Start journaling. If 'compact' is set snapshot is rewritten at once
+ * and journal is started from scratch */
+bool_t jrn_start( const char *filename, const char *snapshot_name, 
+		plist_t *pl, bool_t compact );
+
+/* Write down pending records and stop journaling */
+void jrn_stop( void );
+
+/* Check if journaling is active */
+bool_t jrn_is_active( void );
+
+/* Get last used record sequence number */
+uint64_t jrn_get_seq( void );
+
+/* Log song addition (play list must be locked) */
+void jrn_log_add( song_t *s, int where );
+
+/* Log songs removal (play list must be locked) */
+void jrn_log_rem( int start, int end );
+
+/* Log songs moving (play list must be locked) */
+void jrn_log_move( int start, int end, int to );
+
+/* Log play list permutation: song with index i is moved to 
+ * transform[i] (play list must be locked). NULL 'transform' means that
+ * it couldn't be built and journal has to be rewritten */
+void jrn_log_sort( int len, int *transform );
+
+/* Log song info change */
+void jrn_log_info( plist_t *pl, song_t *s );
+
+#endif
+
+/* End of 'journal.h' file */
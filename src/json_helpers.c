@@ -20,6 +20,8 @@
  * MA 02111-1307, USA.
  */
 
+#include <stdio.h>
+#include <string.h>
 #include "json_helpers.h"
 
 const char *js_get_string( JsonObject *obj, char *key, char *def )
@@ -98,5 +100,245 @@ char *js_to_string( JsonNode *node, size_t *len )
 	return res;
 }
 
+void js_writer_init( js_writer_t *w, js_write_func_t f, void *ctx )
+{
+	w->m_write = f;
+	w->m_ctx = ctx;
+	w->m_len = 0;
+	w->m_total = 0;
+	w->m_depth = 0;
+	w->m_has_items[0] = FALSE;
+	w->m_after_key = FALSE;
+}
+
+void js_writer_flush( js_writer_t *w )
+{
+	if (w->m_len)
+		w->m_write(w->m_ctx, w->m_buf, w->m_len);
+	w->m_len = 0;
+}
+
+static void js_writer_put( js_writer_t *w, const char *data, size_t len )
+{
+	w->m_total += len;
+	while (len)
+	{
+		size_t n = JS_WRITER_BUF_SIZE - w->m_len;
+		if (n > len)
+			n = len;
+		memcpy(&w->m_buf[w->m_len], data, n);
+		w->m_len += n;
+		data += n;
+		len -= n;
+		if (w->m_len == JS_WRITER_BUF_SIZE)
+			js_writer_flush(w);
+	}
+}
+
+static void js_writer_putc( js_writer_t *w, char c )
+{
+	if (w->m_len == JS_WRITER_BUF_SIZE)
+		js_writer_flush(w);
+	w->m_buf[w->m_len++] = c;
+	w->m_total++;
+}
+
+/* Put separator before a value */
+static void js_writer_value( js_writer_t *w )
+{
+	if (w->m_after_key)
+	{
+		w->m_after_key = FALSE;
+		return;
+	}
+	if (w->m_has_items[w->m_depth])
+		js_writer_putc(w, ',');
+	w->m_has_items[w->m_depth] = TRUE;
+}
+
+static void js_writer_begin( js_writer_t *w, char c )
+{
+	js_writer_value(w);
+	js_writer_putc(w, c);
+	if (w->m_depth < JS_WRITER_MAX_DEPTH - 1)
+		w->m_depth++;
+	w->m_has_items[w->m_depth] = FALSE;
+}
+
+static void js_writer_end( js_writer_t *w, char c )
+{
+	js_writer_putc(w, c);
+	if (w->m_depth > 0)
+		w->m_depth--;
+}
+
+void js_writer_begin_object( js_writer_t *w )
+{
+	js_writer_begin(w, '{');
+}
+
+void js_writer_end_object( js_writer_t *w )
+{
+	js_writer_end(w, '}');
+}
+
+void js_writer_begin_array( js_writer_t *w )
+{
+	js_writer_begin(w, '[');
+}
+
+void js_writer_end_array( js_writer_t *w )
+{
+	js_writer_end(w, ']');
+}
+
+static void js_writer_quoted( js_writer_t *w, const char *str )
+{
+	const char *p;
+
+	js_writer_putc(w, '"');
+	for ( p = str; *p; p++ )
+	{
+		unsigned char c = (unsigned char)(*p);
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		/* Write unescaped run and escape this character */
+		js_writer_put(w, str, p - str);
+		str = p + 1;
+		if (c == '"' || c == '\\')
+		{
+			js_writer_putc(w, '\\');
+			js_writer_putc(w, c);
+		}
+		else if (c == '\n')
+			js_writer_put(w, "\\n", 2);
+		else if (c == '\t')
+			js_writer_put(w, "\\t", 2);
+		else
+		{
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			js_writer_put(w, esc, 6);
+		}
+	}
+	js_writer_put(w, str, p - str);
+	js_writer_putc(w, '"');
+}
+
+void js_writer_key( js_writer_t *w, const char *key )
+{
+	js_writer_value(w);
+	js_writer_quoted(w, key);
+	js_writer_putc(w, ':');
+	w->m_after_key = TRUE;
+}
+
+void js_writer_string( js_writer_t *w, const char *str )
+{
+	js_writer_value(w);
+	js_writer_quoted(w, str ? str : "");
+}
+
+void js_writer_int( js_writer_t *w, int64_t val )
+{
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%" G_GINT64_FORMAT, (gint64)val);
+	js_writer_value(w);
+	js_writer_put(w, buf, len);
+}
+
+void js_writer_double( js_writer_t *w, double val )
+{
+	/* Not affected by locale */
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_dtostr(buf, sizeof(buf), val);
+	js_writer_value(w);
+	js_writer_put(w, buf, strlen(buf));
+}
+
+void js_writer_boolean( js_writer_t *w, gboolean val )
+{
+	js_writer_value(w);
+	if (val)
+		js_writer_put(w, "true", 4);
+	else
+		js_writer_put(w, "false", 5);
+}
+
+void js_writer_null( js_writer_t *w )
+{
+	js_writer_value(w);
+	js_writer_put(w, "null", 4);
+}
+
+static void js_writer_member( JsonObject *obj, const gchar *name,
+		JsonNode *node, gpointer data )
+{
+	js_writer_t *w = (js_writer_t *)data;
+	js_writer_key(w, name);
+	js_writer_node(w, node);
+}
+
+static void js_writer_element( JsonArray *array, guint index,
+		JsonNode *node, gpointer data )
+{
+	js_writer_node((js_writer_t *)data, node);
+}
+
+void js_writer_node( js_writer_t *w, JsonNode *node )
+{
+	if (!node || JSON_NODE_HOLDS_NULL(node))
+	{
+		js_writer_null(w);
+	}
+	else if (JSON_NODE_HOLDS_OBJECT(node))
+	{
+		js_writer_begin_object(w);
+		json_object_foreach_member(json_node_get_object(node), 
+				js_writer_member, w);
+		js_writer_end_object(w);
+	}
+	else if (JSON_NODE_HOLDS_ARRAY(node))
+	{
+		js_writer_begin_array(w);
+		json_array_foreach_element(json_node_get_array(node),
+				js_writer_element, w);
+		js_writer_end_array(w);
+	}
+	else
+	{
+		GType type = json_node_get_value_type(node);
+		if (type == G_TYPE_STRING)
+			js_writer_string(w, json_node_get_string(node));
+		else if (type == G_TYPE_BOOLEAN)
+			js_writer_boolean(w, json_node_get_boolean(node));
+		else if (type == G_TYPE_DOUBLE)
+			js_writer_double(w, json_node_get_double(node));
+		else
+			js_writer_int(w, json_node_get_int(node));
+	}
+}
+
+void js_writer_string_member( js_writer_t *w, const char *key, 
+		const char *str )
+{
+	js_writer_key(w, key);
+	js_writer_string(w, str);
+}
+
+void js_writer_int_member( js_writer_t *w, const char *key, int64_t val )
+{
+	js_writer_key(w, key);
+	js_writer_int(w, val);
+}
+
+void js_writer_boolean_member( js_writer_t *w, const char *key, 
+		gboolean val )
+{
+	js_writer_key(w, key);
+	js_writer_boolean(w, val);
+}
+
 /* End of 'json_helpers.c' file */
 
@@ -23,6 +23,7 @@
 #ifndef __SG_MPFC_JSON_HELPERS_H__
 #define __SG_MPFC_JSON_HELPERS_H__
 
+#include <stdint.h>
 #include <json-glib/json-glib.h>
 
 /* Object member accessors */
@@ -37,6 +38,58 @@ JsonNode *js_make_array_node( JsonArray *array );
 
 char *js_to_string( JsonNode *node, size_t *len );
 
+/* Streaming JSON writer. Output is collected in a small buffer and 
+ * passed to the write function in chunks, so large documents are never
+ * built in memory */
+typedef void (*js_write_func_t)( void *ctx, const char *data, size_t len );
+
+#define JS_WRITER_BUF_SIZE 4096
+#define JS_WRITER_MAX_DEPTH 32
+
+typedef struct
+{
+	js_write_func_t m_write;
+	void *m_ctx;
+
+	char m_buf[JS_WRITER_BUF_SIZE];
+	size_t m_len;
+
+	/* Total number of bytes written */
+	size_t m_total;
+
+	/* Nesting depth and whether a value was written at each level */
+	int m_depth;
+	gboolean m_has_items[JS_WRITER_MAX_DEPTH];
+
+	/* Member name has been just written */
+	gboolean m_after_key;
+} js_writer_t;
+
+void js_writer_init( js_writer_t *w, js_write_func_t f, void *ctx );
+void js_writer_flush( js_writer_t *w );
+
+void js_writer_begin_object( js_writer_t *w );
+void js_writer_end_object( js_writer_t *w );
+void js_writer_begin_array( js_writer_t *w );
+void js_writer_end_array( js_writer_t *w );
+void js_writer_key( js_writer_t *w, const char *key );
+
+void js_writer_string( js_writer_t *w, const char *str );
+void js_writer_int( js_writer_t *w, int64_t val );
+void js_writer_double( js_writer_t *w, double val );
+void js_writer_boolean( js_writer_t *w, gboolean val );
+void js_writer_null( js_writer_t *w );
+
+/* Write a DOM node */
+void js_writer_node( js_writer_t *w, JsonNode *node );
+
+/* Object member shortcuts */
+void js_writer_string_member( js_writer_t *w, const char *key, 
+		const char *str );
+void js_writer_int_member( js_writer_t *w, const char *key, int64_t val );
+void js_writer_boolean_member( js_writer_t *w, const char *key, 
+		gboolean val );
+
 #endif
 
 /* End of 'json_helpers.h' file */
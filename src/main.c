@@ -27,12 +27,16 @@
 #include <gst/gst.h>
 #include "error.h"
 #include "player.h"
+#include "profiler.h"
 #include "wnd.h"
 #include "util.h"
 
 /* Main function */
 int main( int argc, char *argv[] )
 {
+	int span;
+	bool_t profile_startup;
+
 	/* Initialize random numbers generator */
 	srand(time(NULL));
 	
@@ -41,12 +45,18 @@ int main( int argc, char *argv[] )
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
 
+	span = prof_begin("gst_init");
 	gst_init(&argc, &argv);
+	prof_end(span);
 	
 	/* Initialize player */
-	if (!player_init(argc, argv))
+	span = prof_begin("player_init");
+	bool_t initialized = player_init(argc, argv);
+	prof_end(span);
+	if (!initialized)
 	{
-		wnd_deinit(wnd_root);
+		if (wnd_root != NULL)
+			wnd_deinit(wnd_root);
 		player_deinit();
 		fprintf(stderr, _("A fatal error occured during player initialization."
 					" See log for details\n"));
@@ -54,10 +64,16 @@ int main( int argc, char *argv[] )
 	}
 
 	/* Run player */
+	profile_startup = cfg_get_var_bool(cfg_list, "profile-startup");
 	player_run();
 
 	/* Unitialize player and exit */
 	player_deinit();
+
+	/* Print startup profile (it's done here since screen is 
+	 * occupied by user interface while running) */
+	if (profile_startup)
+		prof_print(stderr);
 	return 0;
 } /* End of 'main' function */
 
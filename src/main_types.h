@@ -73,6 +73,13 @@ typedef struct tag_song_t
 	/* Default title (used when no info is found) */
 	char *m_default_title;
 
+	/* Position ticket in the play queue (0 if song is not queued) */
+	int m_queue_pos;
+
+	/* Case folded text used by remote search (built on demand, dropped
+	 * whenever title or info change) */
+	char *m_search_key;
+
 	/* Song mutex */
 	pthread_mutex_t m_mutex;
 } song_t;
@@ -119,6 +126,23 @@ typedef struct
 
 	/* Mutex for synchronization play list operations */
 	pthread_mutex_t m_mutex;
+
+	/* Play list is held by a thread doing a number of operations which
+	 * must look as one; songs appended by other threads wait for it */
+	bool_t m_held;
+	pthread_t m_holder;
+	pthread_cond_t m_hold_cond;
+
+	/* Play list version. Incremented on every change of songs list or
+	 * songs info */
+	uint64_t m_version;
+
+	/* Log of the latest changes */
+	struct tag_chlog_t *m_changes;
+
+	/* Songs added to a list used for background scan are collected
+	 * here instead */
+	struct tag_plist_batch_t *m_batch;
 } plist_t;
 
 /* Player statuses */
@@ -0,0 +1,922 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Remote control server load generator.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "types.h"
+
+/* Commands replayed by the benchmark */
+enum
+{
+	BENCH_GET_CUR_SONG = 0,
+	BENCH_GET_PLAYLIST,
+	BENCH_QUEUE,
+	BENCH_SEEK,
+	BENCH_ADD,
+	BENCH_NUM_CMDS
+};
+
+/* Command description */
+typedef struct
+{
+	const char *m_name;
+
+	/* Share in the mix */
+	int m_weight;
+
+	/* Command is answered. Completion of the rest is detected with
+	 * a following 'get_volume' */
+	bool_t m_has_response;
+} bench_cmd_t;
+
+static bench_cmd_t bench_cmds[BENCH_NUM_CMDS] = 
+{
+	{ "get_cur_song", 50, TRUE },
+	{ "get_playlist", 20, TRUE },
+	{ "queue", 15, FALSE },
+	{ "seek", 14, FALSE },
+	{ "add", 1, TRUE }
+};
+
+/* Pause between notification probes (in microseconds) and the time to
+ * wait for a probe change to be notified (in seconds) */
+#define BENCH_PROBE_INTERVAL 10000
+#define BENCH_PROBE_TIMEOUT 2
+
+/* Number of notification kinds (see server_client.h). Notifications for
+ * a client that doesn't read are merged, so it can't have more pending */
+#define BENCH_NUM_NOTIFY_KINDS 7
+
+/* Requests a stalled client sends to fill its socket with responses */
+#define BENCH_STALL_REQUESTS 16
+
+/* Commands of driving clients must complete within this time (in
+ * microseconds) while some clients are stalled */
+#define BENCH_STALL_MAX_LATENCY 1000000
+
+/* Maximal number of clients in server statistics */
+#define BENCH_MAX_CLIENTS 1024
+
+/* Client state in server statistics */
+typedef struct
+{
+	int m_socket;
+	long m_output;
+	int m_pending;
+} bench_client_stat_t;
+
+/* Collected times in microseconds */
+typedef struct
+{
+	uint32_t *m_times;
+	size_t m_num, m_size;
+} bench_samples_t;
+
+/* Client connection */
+typedef struct
+{
+	int m_socket;
+	unsigned m_seed;
+
+	/* Received data; first 'm_pos' bytes are already handled */
+	char *m_buf;
+	size_t m_len, m_pos, m_size;
+
+	bench_samples_t m_cmd_times[BENCH_NUM_CMDS];
+
+	pthread_t m_tid;
+	bool_t m_failed;
+} bench_conn_t;
+
+/* Options */
+static char *bench_host = "127.0.0.1";
+static int bench_port = 0x4D50;
+static char *bench_socket_path = NULL;
+static int bench_num_conns = 8;
+static double bench_duration = 5.;
+static int bench_page_size = 100;
+static char *bench_add_path = NULL;
+static char *bench_root = NULL;
+static int bench_num_songs = 0;
+static int bench_num_stalled = 0;
+
+/* Play list length used to pick positions */
+static int bench_plist_len = 0;
+
+/* Run end time */
+static int64_t bench_deadline;
+
+/* Delays from a probe change sent to it notified to another client and
+ * the number of probes whose change was not seen */
+static bench_samples_t bench_notify_times = { NULL, 0, 0 };
+static int bench_num_probes_lost = 0;
+
+/* Get monotonic time in microseconds */
+static int64_t bench_now( void )
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* End of 'bench_now' function */
+
+/* Add a sample */
+static void bench_samples_add( bench_samples_t *s, int64_t us )
+{
+	if (s->m_num == s->m_size)
+	{
+		size_t size = s->m_size ? s->m_size * 2 : 1024;
+		uint32_t *times = (uint32_t *)realloc(s->m_times, 
+				size * sizeof(*times));
+		if (!times)
+			return;
+		s->m_times = times;
+		s->m_size = size;
+	}
+	s->m_times[s->m_num++] = (us < 0 ? 0 : us);
+} /* End of 'bench_samples_add' function */
+
+/* Move samples from one set to another */
+static void bench_samples_merge( bench_samples_t *dest, bench_samples_t *src )
+{
+	for ( size_t i = 0; i < src->m_num; i++ )
+		bench_samples_add(dest, src->m_times[i]);
+	free(src->m_times);
+	memset(src, 0, sizeof(*src));
+} /* End of 'bench_samples_merge' function */
+
+/* Compare samples for sorting */
+static int bench_samples_cmp( const void *a, const void *b )
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+} /* End of 'bench_samples_cmp' function */
+
+/* Get percentile of sorted samples */
+static uint32_t bench_percentile( bench_samples_t *s, int p )
+{
+	if (s->m_num == 0)
+		return 0;
+	size_t i = (s->m_num * p + 99) / 100;
+	return s->m_times[i ? i - 1 : 0];
+} /* End of 'bench_percentile' function */
+
+/* Connect to the server */
+static bool_t bench_connect( bench_conn_t *c )
+{
+	if (bench_socket_path)
+	{
+		struct sockaddr_un addr;
+
+		c->m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (c->m_socket < 0)
+			return FALSE;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", 
+				bench_socket_path);
+		return !connect(c->m_socket, (struct sockaddr *)&addr, sizeof(addr));
+	}
+
+	struct addrinfo hints, *res;
+	char port[16];
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%d", bench_port);
+	if (getaddrinfo(bench_host, port, &hints, &res))
+		return FALSE;
+	c->m_socket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	bool_t ok = (c->m_socket >= 0 && 
+			!connect(c->m_socket, res->ai_addr, res->ai_addrlen));
+	freeaddrinfo(res);
+	if (ok)
+	{
+		int one = 1;
+		setsockopt(c->m_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return ok;
+} /* End of 'bench_connect' function */
+
+/* Send a string */
+static bool_t bench_send( bench_conn_t *c, const char *str )
+{
+	size_t len = strlen(str);
+
+	while (len > 0)
+	{
+		ssize_t sent = send(c->m_socket, str, len, MSG_NOSIGNAL);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		str += sent;
+		len -= sent;
+	}
+	return TRUE;
+} /* End of 'bench_send' function */
+
+/* Make sure that at least 'need' unhandled bytes are received */
+static bool_t bench_fill( bench_conn_t *c, size_t need )
+{
+	while (c->m_len - c->m_pos < need)
+	{
+		/* Make room */
+		if (c->m_pos)
+		{
+			memmove(c->m_buf, &c->m_buf[c->m_pos], c->m_len - c->m_pos);
+			c->m_len -= c->m_pos;
+			c->m_pos = 0;
+		}
+		if (c->m_size - c->m_len < 4096 || c->m_size < need)
+		{
+			size_t size = c->m_size ? c->m_size * 2 : 65536;
+			while (size < need)
+				size *= 2;
+			char *buf = (char *)realloc(c->m_buf, size);
+			if (!buf)
+				return FALSE;
+			c->m_buf = buf;
+			c->m_size = size;
+		}
+
+		ssize_t sz = recv(c->m_socket, &c->m_buf[c->m_len], 
+				c->m_size - c->m_len, 0);
+		if (sz < 0 && errno == EINTR)
+			continue;
+		if (sz <= 0)
+			return FALSE;
+		c->m_len += sz;
+	}
+	return TRUE;
+} /* End of 'bench_fill' function */
+
+/* Read a header line. Returns pointer to its value */
+static char *bench_read_header( bench_conn_t *c, const char *name )
+{
+	char *line, *end;
+
+	for ( size_t need = 1; ; need = c->m_len - c->m_pos + 1 )
+	{
+		if (!bench_fill(c, need))
+			return NULL;
+		line = &c->m_buf[c->m_pos];
+		end = memchr(line, '\n', c->m_len - c->m_pos);
+		if (end)
+			break;
+	}
+	*end = 0;
+	c->m_pos += end - line + 1;
+
+	size_t len = strlen(name);
+	if (strncmp(line, name, len) || line[len] != ':')
+		return NULL;
+	return &line[len + 1];
+} /* End of 'bench_read_header' function */
+
+/* Read a message. Type and body are returned; body is valid until the
+ * next read */
+static bool_t bench_read_msg( bench_conn_t *c, char *type, char **body,
+		size_t *len )
+{
+	char *val;
+
+	val = bench_read_header(c, "Msg-Length");
+	if (!val)
+		return FALSE;
+	*len = strtoul(val, NULL, 10);
+	val = bench_read_header(c, "Msg-Type");
+	if (!val)
+		return FALSE;
+	*type = val[strspn(val, " ")];
+
+	if (!bench_fill(c, *len))
+		return FALSE;
+	*body = &c->m_buf[c->m_pos];
+	c->m_pos += *len;
+	return TRUE;
+} /* End of 'bench_read_msg' function */
+
+/* Wait for response. Notifications received meanwhile are skipped */
+static bool_t bench_wait_response( bench_conn_t *c, char **body, size_t *len )
+{
+	for ( ;; )
+	{
+		char type;
+
+		if (!bench_read_msg(c, &type, body, len))
+			return FALSE;
+		if (type == 'r')
+			return TRUE;
+	}
+} /* End of 'bench_wait_response' function */
+
+/* Wait for play list changes notification with current song set to the
+ * given position. If client is asked to reload the list instead, the 
+ * change can't be told and 'found' is FALSE */
+static bool_t bench_wait_cur_song( bench_conn_t *c, int pos, bool_t *found )
+{
+	char *body, *p, *end;
+	size_t len;
+	char type;
+
+	for ( ;; )
+	{
+		if (!bench_read_msg(c, &type, &body, &len))
+			return FALSE;
+		if (type != 'n' || len == 0)
+			continue;
+		body[len - 1] = 0;
+		if (!strstr(body, "\"type\":\"changes\""))
+			continue;
+		if (strstr(body, "\"resync\":"))
+		{
+			*found = FALSE;
+			return TRUE;
+		}
+
+		/* Look through the changes objects */
+		for ( p = strchr(body, '{'); p; p = strchr(end, '{') )
+		{
+			end = strchr(p + 1, '}');
+			if (!end)
+				break;
+			*end = 0;
+			char *val = strstr(p, "\"pos\":");
+			bool_t match = (strstr(p, "\"type\":\"cur_song\"") && val &&
+					atoi(val + 6) == pos);
+			*end = '}';
+			if (match)
+			{
+				*found = TRUE;
+				return TRUE;
+			}
+		}
+	}
+} /* End of 'bench_wait_cur_song' function */
+
+/* Get current song position */
+static int bench_get_cur_song( bench_conn_t *c )
+{
+	char *body, *pos;
+	size_t len;
+
+	if (!bench_send(c, "get_cur_song\n") || 
+			!bench_wait_response(c, &body, &len))
+		return -2;
+	body[len - 1] = 0;
+	pos = strstr(body, "\"position\":");
+	return (pos ? atoi(&pos[11]) : -2);
+} /* End of 'bench_get_cur_song' function */
+
+/* Get play list length */
+static int bench_get_plist_len( bench_conn_t *c )
+{
+	char *body, *total;
+	size_t len;
+
+	if (!bench_send(c, "get_playlist 0 0\n") || 
+			!bench_wait_response(c, &body, &len))
+		return -1;
+	body[len - 1] = 0;
+	total = strstr(body, "\"total\":");
+	return (total ? atoi(&total[8]) : -1);
+} /* End of 'bench_get_plist_len' function */
+
+/* Get clients state from server statistics. Returns the number of 
+ * clients or -1 on error */
+static int bench_get_clients( bench_conn_t *c, bench_client_stat_t *clients,
+		int max )
+{
+	char *body, *p;
+	size_t len;
+	int num = 0;
+
+	if (!bench_send(c, "get_stats\n") || !bench_wait_response(c, &body, &len))
+		return -1;
+	body[len - 1] = 0;
+	p = strstr(body, "\"clients\":");
+	if (!p)
+		return -1;
+
+	/* Members go in this order */
+	while (num < max && (p = strstr(p, "\"socket\":")) != NULL)
+	{
+		bench_client_stat_t *cl = &clients[num++];
+		cl->m_socket = atoi(p + 9);
+		p = strstr(p, "\"output\":");
+		if (!p)
+			return -1;
+		cl->m_output = atol(p + 9);
+		p = strstr(p, "\"pending\":");
+		if (!p)
+			return -1;
+		cl->m_pending = atoi(p + 10);
+	}
+	return num;
+} /* End of 'bench_get_clients' function */
+
+/* Open a client that never reads. Its socket is filled with responses
+ * first, so that the server has to hold notifications for it */
+static bool_t bench_open_stalled( bench_conn_t *c )
+{
+	if (!bench_connect(c) || !bench_send(c, "subscribe_time 100\n"))
+		return FALSE;
+	for ( int i = 0; i < BENCH_STALL_REQUESTS; i++ )
+	{
+		if (!bench_send(c, "get_playlist 0 1000000\n"))
+			return FALSE;
+	}
+	return TRUE;
+} /* End of 'bench_open_stalled' function */
+
+/* Check that server keeps stalled clients' backlog bounded. Clients with
+ * unsent output in both samples must not have it grown */
+static bool_t bench_check_stalled( bench_client_stat_t *mid, int num_mid,
+		bench_client_stat_t *end, int num_end )
+{
+	bool_t ok = TRUE;
+	int num_stalled = 0;
+
+	printf("%-14s %10s %10s %10s\n", "stalled", "output", "then", 
+			"pending");
+	for ( int i = 0; i < num_end; i++ )
+	{
+		long was = -1;
+
+		if (end[i].m_output == 0)
+			continue;
+		for ( int j = 0; j < num_mid; j++ )
+		{
+			if (mid[j].m_socket == end[i].m_socket)
+				was = mid[j].m_output;
+		}
+		num_stalled++;
+		printf("socket %-7d %10ld %10ld %10d\n", end[i].m_socket, 
+				end[i].m_output, was, end[i].m_pending);
+		if (end[i].m_pending > BENCH_NUM_NOTIFY_KINDS || 
+				(was > 0 && end[i].m_output > was))
+			ok = FALSE;
+	}
+	if (num_stalled == 0)
+	{
+		printf("No client output is backed up; use a longer play list "
+				"(-n)\n");
+		ok = FALSE;
+	}
+	return ok;
+} /* End of 'bench_check_stalled' function */
+
+/* Choose next command */
+static int bench_choose_cmd( bench_conn_t *c )
+{
+	int total = 0, r;
+
+	for ( int i = 0; i < BENCH_NUM_CMDS; i++ )
+		total += bench_cmds[i].m_weight;
+	r = rand_r(&c->m_seed) % total;
+	for ( int i = 0; i < BENCH_NUM_CMDS; i++ )
+	{
+		if (r < bench_cmds[i].m_weight)
+			return i;
+		r -= bench_cmds[i].m_weight;
+	}
+	return BENCH_GET_CUR_SONG;
+} /* End of 'bench_choose_cmd' function */
+
+/* Connection thread */
+static void *bench_thread( void *arg )
+{
+	bench_conn_t *c = (bench_conn_t *)arg;
+	char cmd[MAX_FILE_NAME + 64];
+
+	while (bench_now() < bench_deadline)
+	{
+		int kind = bench_choose_cmd(c);
+		int pos = bench_plist_len ? rand_r(&c->m_seed) % bench_plist_len : 0;
+		char *body;
+		size_t len;
+
+		switch (kind)
+		{
+		case BENCH_GET_PLAYLIST:
+			snprintf(cmd, sizeof(cmd), "get_playlist %d %d\n", pos, 
+					bench_page_size);
+			break;
+		case BENCH_QUEUE:
+			snprintf(cmd, sizeof(cmd), "queue %d\n", pos);
+			break;
+		case BENCH_SEEK:
+			snprintf(cmd, sizeof(cmd), "seek %d\n", 
+					rand_r(&c->m_seed) % 60);
+			break;
+		case BENCH_ADD:
+			snprintf(cmd, sizeof(cmd), "add %s\n", bench_add_path);
+			break;
+		default:
+			snprintf(cmd, sizeof(cmd), "%s\n", bench_cmds[kind].m_name);
+			break;
+		}
+		if (!bench_cmds[kind].m_has_response)
+			strcat(cmd, "get_volume\n");
+
+		int64_t start = bench_now();
+		if (!bench_send(c, cmd) || !bench_wait_response(c, &body, &len))
+		{
+			c->m_failed = TRUE;
+			break;
+		}
+		bench_samples_add(&c->m_cmd_times[kind], bench_now() - start);
+	}
+	return NULL;
+} /* End of 'bench_thread' function */
+
+/* Notification probe thread. Parameter is two connections: the first 
+ * one changes current song and the second one is subscribed to play 
+ * list changes. Delay is from sending a change to getting it notified */
+static void *bench_probe_thread( void *arg )
+{
+	bench_conn_t *c = (bench_conn_t *)arg, *listener = &c[1];
+	struct timeval tv = { BENCH_PROBE_TIMEOUT, 0 };
+	char cmd[64];
+	char *body;
+	size_t len;
+
+	/* Every probe sets a song different from the current one. It is 
+	 * stopped right away, so that nothing is played */
+	int pos = bench_get_cur_song(c);
+	if (pos < -1 || !bench_send(listener, "subscribe_changes\n") ||
+			!bench_wait_response(listener, &body, &len) ||
+			setsockopt(listener->m_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, 
+				sizeof(tv)))
+	{
+		c->m_failed = TRUE;
+		return NULL;
+	}
+	while (bench_now() < bench_deadline)
+	{
+		bool_t found;
+
+		pos = (pos + 1) % bench_plist_len;
+		snprintf(cmd, sizeof(cmd), "batch [[\"play\",%d],[\"stop\"]]\n", 
+				pos);
+		int64_t start = bench_now();
+		if (!bench_send(c, cmd) || 
+				!bench_wait_cur_song(listener, pos, &found))
+		{
+			fprintf(stderr, "Probe change is not notified\n");
+			c->m_failed = TRUE;
+			break;
+		}
+		if (found)
+			bench_samples_add(&bench_notify_times, bench_now() - start);
+		else
+			bench_num_probes_lost++;
+		if (!bench_wait_response(c, &body, &len))
+		{
+			c->m_failed = TRUE;
+			break;
+		}
+		usleep(BENCH_PROBE_INTERVAL);
+	}
+	return NULL;
+} /* End of 'bench_probe_thread' function */
+
+/* Write a synthetic play list and add it. Songs don't exist so that no
+ * audio is ever played */
+static bool_t bench_make_plist( bench_conn_t *c )
+{
+	char name[MAX_FILE_NAME];
+	char *body;
+	size_t len;
+
+	snprintf(name, sizeof(name), "%s/mpfc-bench.m3u", bench_root);
+	FILE *fd = fopen(name, "w");
+	if (!fd)
+	{
+		fprintf(stderr, "Unable to create %s: %s\n", name, strerror(errno));
+		return FALSE;
+	}
+	fprintf(fd, "#EXTM3U\n");
+	for ( int i = 0; i < bench_num_songs; i++ )
+	{
+		fprintf(fd, "#EXTINF:%d,Artist %d - Song %d\n", 120 + i % 300, 
+				i % 1000, i);
+		fprintf(fd, "%s/mpfc-bench/Artist %d/Album %d/%d.mp3\n", bench_root, 
+				i % 1000, i % 10000, i);
+	}
+	fclose(fd);
+
+	int start_len = bench_get_plist_len(c);
+	if (!bench_send(c, "add /mpfc-bench.m3u\n") || 
+			!bench_wait_response(c, &body, &len) || 
+			memmem(body, len, "\"job\":-1", 8))
+	{
+		fprintf(stderr, "Unable to add the play list. Is remote-dir-root "
+				"set to %s?\n", bench_root);
+		return FALSE;
+	}
+
+	/* Wait until everything is added */
+	int64_t give_up = bench_now() + 120 * 1000000LL;
+	while (bench_get_plist_len(c) < start_len + bench_num_songs)
+	{
+		if (bench_now() > give_up)
+		{
+			fprintf(stderr, "Play list is not added in time\n");
+			return FALSE;
+		}
+		usleep(50000);
+	}
+	return TRUE;
+} /* End of 'bench_make_plist' function */
+
+/* Parse commands mix */
+static bool_t bench_parse_mix( char *mix )
+{
+	for ( int i = 0; i < BENCH_NUM_CMDS; i++ )
+		bench_cmds[i].m_weight = 0;
+
+	for ( char *p = strtok(mix, ","); p; p = strtok(NULL, ",") )
+	{
+		char *eq = strchr(p, '=');
+		int i;
+
+		if (eq)
+			*eq = 0;
+		for ( i = 0; i < BENCH_NUM_CMDS; i++ )
+		{
+			if (!strcmp(bench_cmds[i].m_name, p))
+				break;
+		}
+		if (i == BENCH_NUM_CMDS)
+		{
+			fprintf(stderr, "Unknown command %s in mix\n", p);
+			return FALSE;
+		}
+		bench_cmds[i].m_weight = (eq ? atoi(eq + 1) : 1);
+	}
+	return TRUE;
+} /* End of 'bench_parse_mix' function */
+
+/* Print usage */
+static void bench_usage( void )
+{
+	printf("Usage: mpfc-bench [options]\n"
+			"  -H HOST     server host (127.0.0.1)\n"
+			"  -p PORT     server port (19792)\n"
+			"  -s PATH     use Unix domain socket instead\n"
+			"  -c NUM      number of connections (8)\n"
+			"  -d SECONDS  run duration (5)\n"
+			"  -m MIX      commands mix, e.g. "
+			"get_cur_song=50,get_playlist=20,queue=15,seek=14,add=1\n"
+			"  -P NUM      get_playlist page size (100)\n"
+			"  -a PATH     path for 'add' (relative to remote-dir-root)\n"
+			"  -r DIR      remote-dir-root of the server\n"
+			"  -n NUM      add a synthetic play list of NUM songs first "
+			"(requires -r)\n"
+			"  -S NUM      also open NUM clients that never read and check "
+			"that\n"
+			"              the server keeps serving the rest\n"
+			"\n"
+			"Run the server with fake audio output, e.g.\n"
+			"  mpfc --daemon --gstreamer.audio-sink=fakesink --remote-dir-root=DIR\n");
+} /* End of 'bench_usage' function */
+
+/* Main function */
+int main( int argc, char *argv[] )
+{
+	bench_conn_t *conns, *stalled = NULL, monitor, probe[2];
+	bench_samples_t all = { NULL, 0, 0 };
+	bench_client_stat_t *mid_clients = NULL, *end_clients = NULL;
+	int num_mid = 0, num_end = 0;
+	int opt, num_failed = 0;
+	uint32_t max_latency = 0;
+
+	while ((opt = getopt(argc, argv, "H:p:s:c:d:m:P:a:r:n:S:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'H': bench_host = optarg; break;
+		case 'p': bench_port = atoi(optarg); break;
+		case 's': bench_socket_path = optarg; break;
+		case 'c': bench_num_conns = atoi(optarg); break;
+		case 'd': bench_duration = atof(optarg); break;
+		case 'P': bench_page_size = atoi(optarg); break;
+		case 'a': bench_add_path = optarg; break;
+		case 'r': bench_root = optarg; break;
+		case 'n': bench_num_songs = atoi(optarg); break;
+		case 'S': bench_num_stalled = atoi(optarg); break;
+		case 'm':
+			if (!bench_parse_mix(optarg))
+				return 1;
+			break;
+		default:
+			bench_usage();
+			return (opt == 'h' ? 0 : 1);
+		}
+	}
+	if (bench_num_conns <= 0 || (bench_num_songs > 0 && !bench_root))
+	{
+		bench_usage();
+		return 1;
+	}
+	if (!bench_add_path)
+		bench_cmds[BENCH_ADD].m_weight = 0;
+
+	conns = (bench_conn_t *)calloc(bench_num_conns, sizeof(*conns));
+	if (!conns)
+		return 1;
+	for ( int i = 0; i < bench_num_conns; i++ )
+	{
+		conns[i].m_seed = i + 1;
+		if (!bench_connect(&conns[i]))
+		{
+			fprintf(stderr, "Unable to connect: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	/* Prepare play list */
+	if (bench_num_songs > 0 && !bench_make_plist(&conns[0]))
+		return 1;
+	bench_plist_len = bench_get_plist_len(&conns[0]);
+	if (bench_plist_len < 0)
+	{
+		fprintf(stderr, "Unable to get play list\n");
+		return 1;
+	}
+
+	/* Probe needs two songs to switch between */
+	memset(probe, 0, sizeof(probe));
+	if (bench_plist_len >= 2 && 
+			(!bench_connect(&probe[0]) || !bench_connect(&probe[1])))
+	{
+		fprintf(stderr, "Unable to connect: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* Open clients that never read and one for getting statistics */
+	if (bench_num_stalled > 0)
+	{
+		stalled = (bench_conn_t *)calloc(bench_num_stalled, sizeof(*stalled));
+		mid_clients = (bench_client_stat_t *)calloc(BENCH_MAX_CLIENTS,
+				sizeof(*mid_clients));
+		end_clients = (bench_client_stat_t *)calloc(BENCH_MAX_CLIENTS,
+				sizeof(*end_clients));
+		memset(&monitor, 0, sizeof(monitor));
+		if (!stalled || !mid_clients || !end_clients || 
+				!bench_connect(&monitor))
+		{
+			fprintf(stderr, "Unable to connect: %s\n", strerror(errno));
+			return 1;
+		}
+		for ( int i = 0; i < bench_num_stalled; i++ )
+		{
+			if (!bench_open_stalled(&stalled[i]))
+			{
+				fprintf(stderr, "Unable to connect: %s\n", strerror(errno));
+				return 1;
+			}
+		}
+	}
+
+	/* Run */
+	int64_t start = bench_now();
+	bench_deadline = start + (int64_t)(bench_duration * 1000000);
+	for ( int i = 0; i < bench_num_conns; i++ )
+		pthread_create(&conns[i].m_tid, NULL, bench_thread, &conns[i]);
+	if (bench_plist_len >= 2)
+		pthread_create(&probe[0].m_tid, NULL, bench_probe_thread, probe);
+	if (bench_num_stalled > 0)
+	{
+		usleep((useconds_t)(bench_duration * 500000));
+		num_mid = bench_get_clients(&monitor, mid_clients, BENCH_MAX_CLIENTS);
+	}
+	for ( int i = 0; i < bench_num_conns; i++ )
+	{
+		pthread_join(conns[i].m_tid, NULL);
+		if (conns[i].m_failed)
+			num_failed++;
+	}
+	if (bench_plist_len >= 2)
+	{
+		pthread_join(probe[0].m_tid, NULL);
+		if (probe[0].m_failed)
+			num_failed++;
+	}
+	double elapsed = (bench_now() - start) / 1000000.;
+
+	/* Report */
+	printf("%d connections, %d songs, %.1f s%s\n", bench_num_conns, 
+			bench_plist_len, elapsed, num_failed ? " (some failed)" : "");
+	printf("%-14s %10s %10s %10s %10s\n", "command", "count", "per sec", 
+			"p50 us", "p99 us");
+	for ( int k = 0; k < BENCH_NUM_CMDS; k++ )
+	{
+		bench_samples_t s = { NULL, 0, 0 };
+		for ( int i = 0; i < bench_num_conns; i++ )
+			bench_samples_merge(&s, &conns[i].m_cmd_times[k]);
+		if (s.m_num == 0)
+			continue;
+		qsort(s.m_times, s.m_num, sizeof(uint32_t), bench_samples_cmp);
+		printf("%-14s %10zu %10.0f %10u %10u\n", bench_cmds[k].m_name, 
+				s.m_num, s.m_num / elapsed, bench_percentile(&s, 50),
+				bench_percentile(&s, 99));
+		if (bench_percentile(&s, 100) > max_latency)
+			max_latency = bench_percentile(&s, 100);
+		bench_samples_merge(&all, &s);
+	}
+	qsort(all.m_times, all.m_num, sizeof(uint32_t), bench_samples_cmp);
+	printf("%-14s %10zu %10.0f %10u %10u\n", "all", all.m_num, 
+			all.m_num / elapsed, bench_percentile(&all, 50), 
+			bench_percentile(&all, 99));
+
+	/* Notification delay is counted for the probe changes only */
+	bench_samples_t *notify = &bench_notify_times;
+	qsort(notify->m_times, notify->m_num, sizeof(uint32_t), bench_samples_cmp);
+	printf("%-14s %10zu %10.0f %10u %10u\n", "notifications", notify->m_num,
+			notify->m_num / elapsed, bench_percentile(notify, 50),
+			bench_percentile(notify, 99));
+	if (bench_num_probes_lost)
+		printf("%d probe changes came within play list reload\n", 
+				bench_num_probes_lost);
+
+	/* Hooks fired by the driving clients must not wait for the stalled 
+	 * ones, so all commands complete in time */
+	if (bench_num_stalled > 0)
+	{
+		num_end = bench_get_clients(&monitor, end_clients, BENCH_MAX_CLIENTS);
+		bool_t ok = (num_mid >= 0 && num_end >= 0 && all.m_num > 0 &&
+				bench_check_stalled(mid_clients, num_mid, end_clients, 
+					num_end));
+		printf("max latency %u us\n", max_latency);
+		if (max_latency > BENCH_STALL_MAX_LATENCY)
+			ok = FALSE;
+		printf("stalled clients test %s\n", ok ? "passed" : "FAILED");
+		if (!ok)
+			num_failed++;
+
+		for ( int i = 0; i < bench_num_stalled; i++ )
+			close(stalled[i].m_socket);
+		bench_send(&monitor, "bye\n");
+		close(monitor.m_socket);
+		free(monitor.m_buf);
+		free(stalled);
+		free(mid_clients);
+		free(end_clients);
+	}
+
+	for ( int i = 0; i < bench_num_conns; i++ )
+	{
+		bench_send(&conns[i], "bye\n");
+		close(conns[i].m_socket);
+		free(conns[i].m_buf);
+	}
+	for ( int i = 0; i < 2 && bench_plist_len >= 2; i++ )
+	{
+		bench_send(&probe[i], "bye\n");
+		close(probe[i].m_socket);
+		free(probe[i].m_buf);
+	}
+	free(conns);
+	free(all.m_times);
+	free(bench_notify_times.m_times);
+	return (num_failed ? 1 : 0);
+} /* End of 'main' function */
+
+/* End of 'mpfc_bench.c' file */
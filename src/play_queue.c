@@ -0,0 +1,271 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Play queue functions implementation.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "play_queue.h"
+#include "song.h"
+
+/* Initial queue buffer size */
+#define PQ_INITIAL_SIZE 16
+
+/* Get buffer index of the song at the given position */
+#define PQ_INDEX(pq, pos) (((pq)->m_head + (pos)) % (pq)->m_size)
+
+/* Create a new queue */
+pq_t *pq_new( void )
+{
+	pq_t *pq = (pq_t *)malloc(sizeof(pq_t));
+	if (pq == NULL)
+		return NULL;
+	memset(pq, 0, sizeof(*pq));
+	pq->m_base = 1;
+	pthread_mutex_init(&pq->m_mutex, NULL);
+	return pq;
+} /* End of 'pq_new' function */
+
+/* Free queue */
+void pq_free( pq_t *pq )
+{
+	if (pq == NULL)
+		return;
+
+	pq_clear(pq);
+	if (pq->m_songs != NULL)
+		free(pq->m_songs);
+	pthread_mutex_destroy(&pq->m_mutex);
+	free(pq);
+} /* End of 'pq_free' function */
+
+/* Update position tickets starting from the given position */
+static void pq_renumber( pq_t *pq, int from )
+{
+	for ( int i = from; i < pq->m_len; i ++ )
+		pq->m_songs[PQ_INDEX(pq, i)]->m_queue_pos = pq->m_base + i;
+} /* End of 'pq_renumber' function */
+
+/* Make the buffer large enough for one more song */
+static bool_t pq_grow( pq_t *pq )
+{
+	int new_size, i;
+	song_t **songs;
+
+	if (pq->m_len < pq->m_size)
+		return TRUE;
+
+	new_size = (pq->m_size == 0) ? PQ_INITIAL_SIZE : pq->m_size * 2;
+	songs = (song_t **)malloc(new_size * sizeof(*songs));
+	if (songs == NULL)
+		return FALSE;
+
+	/* Unroll the ring */
+	for ( i = 0; i < pq->m_len; i ++ )
+		songs[i] = pq->m_songs[PQ_INDEX(pq, i)];
+	if (pq->m_songs != NULL)
+		free(pq->m_songs);
+	pq->m_songs = songs;
+	pq->m_size = new_size;
+	pq->m_head = 0;
+	return TRUE;
+} /* End of 'pq_grow' function */
+
+/* Append a song to the queue. Fails if the song is already queued */
+bool_t pq_push( pq_t *pq, song_t *song )
+{
+	bool_t ret = FALSE;
+
+	assert(pq);
+	assert(song);
+
+	pq_lock(pq);
+	if (song->m_queue_pos != 0 || !pq_grow(pq))
+		goto finally;
+
+	pq->m_songs[PQ_INDEX(pq, pq->m_len)] = song_add_ref(song);
+	song->m_queue_pos = pq->m_base + pq->m_len;
+	pq->m_len ++;
+	ret = TRUE;
+
+finally:
+	pq_unlock(pq);
+	return ret;
+} /* End of 'pq_push' function */
+
+/* Extract the first song. Caller owns the returned reference */
+song_t *pq_pop( pq_t *pq )
+{
+	song_t *song = NULL;
+
+	assert(pq);
+
+	pq_lock(pq);
+	if (pq->m_len > 0)
+	{
+		song = pq->m_songs[pq->m_head];
+		song->m_queue_pos = 0;
+		pq->m_head = (pq->m_head + 1) % pq->m_size;
+		pq->m_len --;
+
+		/* Tickets of the rest songs remain valid since the base moves too */
+		pq->m_base ++;
+		if (pq->m_len == 0)
+		{
+			pq->m_head = 0;
+			pq->m_base = 1;
+		}
+	}
+	pq_unlock(pq);
+	return song;
+} /* End of 'pq_pop' function */
+
+/* Remove song at the given position (queue is locked) */
+static void pq_remove_at( pq_t *pq, int pos )
+{
+	song_t *song = pq->m_songs[PQ_INDEX(pq, pos)];
+
+	for ( int i = pos; i < pq->m_len - 1; i ++ )
+		pq->m_songs[PQ_INDEX(pq, i)] = pq->m_songs[PQ_INDEX(pq, i + 1)];
+	pq->m_len --;
+	pq_renumber(pq, pos);
+
+	song->m_queue_pos = 0;
+	song_free(song);
+} /* End of 'pq_remove_at' function */
+
+/* Remove song at the given position */
+bool_t pq_remove( pq_t *pq, int pos )
+{
+	bool_t ret = FALSE;
+
+	assert(pq);
+
+	pq_lock(pq);
+	if (pos >= 0 && pos < pq->m_len)
+	{
+		pq_remove_at(pq, pos);
+		ret = TRUE;
+	}
+	pq_unlock(pq);
+	return ret;
+} /* End of 'pq_remove' function */
+
+/* Remove a song (if it is queued) */
+void pq_remove_song( pq_t *pq, song_t *song )
+{
+	assert(pq);
+	assert(song);
+
+	pq_lock(pq);
+	if (song->m_queue_pos != 0)
+		pq_remove_at(pq, song->m_queue_pos - pq->m_base);
+	pq_unlock(pq);
+} /* End of 'pq_remove_song' function */
+
+/* Move a song from one position to another */
+bool_t pq_move( pq_t *pq, int from, int to )
+{
+	song_t *song;
+	int i;
+
+	assert(pq);
+
+	pq_lock(pq);
+	if (from < 0 || from >= pq->m_len || to < 0 || to >= pq->m_len)
+	{
+		pq_unlock(pq);
+		return FALSE;
+	}
+
+	song = pq->m_songs[PQ_INDEX(pq, from)];
+	if (from < to)
+	{
+		for ( i = from; i < to; i ++ )
+			pq->m_songs[PQ_INDEX(pq, i)] = pq->m_songs[PQ_INDEX(pq, i + 1)];
+	}
+	else
+	{
+		for ( i = from; i > to; i -- )
+			pq->m_songs[PQ_INDEX(pq, i)] = pq->m_songs[PQ_INDEX(pq, i - 1)];
+	}
+	pq->m_songs[PQ_INDEX(pq, to)] = song;
+	pq_renumber(pq, (from < to) ? from : to);
+	pq_unlock(pq);
+	return TRUE;
+} /* End of 'pq_move' function */
+
+/* Remove all songs */
+void pq_clear( pq_t *pq )
+{
+	assert(pq);
+
+	pq_lock(pq);
+	for ( int i = 0; i < pq->m_len; i ++ )
+	{
+		song_t *song = pq->m_songs[PQ_INDEX(pq, i)];
+		song->m_queue_pos = 0;
+		song_free(song);
+	}
+	pq->m_len = 0;
+	pq->m_head = 0;
+	pq->m_base = 1;
+	pq_unlock(pq);
+} /* End of 'pq_clear' function */
+
+/* Get song position in the queue (-1 if it is not queued) */
+int pq_get_pos( pq_t *pq, song_t *song )
+{
+	int pos;
+
+	assert(pq);
+	assert(song);
+
+	pq_lock(pq);
+	pos = (song->m_queue_pos == 0) ? -1 : song->m_queue_pos - pq->m_base;
+	pq_unlock(pq);
+	return pos;
+} /* End of 'pq_get_pos' function */
+
+/* Get song at the given position. Queue must be locked */
+song_t *pq_get( pq_t *pq, int pos )
+{
+	assert(pq);
+
+	if (pos < 0 || pos >= pq->m_len)
+		return NULL;
+	return pq->m_songs[PQ_INDEX(pq, pos)];
+} /* End of 'pq_get' function */
+
+/* Lock queue */
+void pq_lock( pq_t *pq )
+{
+	pthread_mutex_lock(&pq->m_mutex);
+} /* End of 'pq_lock' function */
+
+/* Unlock queue */
+void pq_unlock( pq_t *pq )
+{
+	pthread_mutex_unlock(&pq->m_mutex);
+} /* End of 'pq_unlock' function */
+
+/* End of 'play_queue.c' file */
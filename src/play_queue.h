@@ -0,0 +1,86 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Interface for play queue functions.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#ifndef __SG_MPFC_PLAY_QUEUE_H__
+#define __SG_MPFC_PLAY_QUEUE_H__
+
+#include <pthread.h>
+#include "types.h"
+#include "main_types.h"
+
+/* Play queue type. This is a ring buffer of song references; every queued
+ * song keeps a position ticket (m_queue_pos) so its position in the queue
+ * may be found without scanning */
+typedef struct
+{
+	/* Songs buffer */
+	song_t **m_songs;
+
+	/* Buffer size, index of the first song and number of queued songs */
+	int m_size, m_head, m_len;
+
+	/* Ticket of the first song in the queue */
+	int m_base;
+
+	/* Queue mutex */
+	pthread_mutex_t m_mutex;
+} pq_t;
+
+/* Create a new queue */
+pq_t *pq_new( void );
+
+/* Free queue */
+void pq_free( pq_t *pq );
+
+/* Append a song to the queue. Fails if the song is already queued */
+bool_t pq_push( pq_t *pq, song_t *song );
+
+/* Extract the first song. Caller owns the returned reference */
+song_t *pq_pop( pq_t *pq );
+
+/* Remove song at the given position */
+bool_t pq_remove( pq_t *pq, int pos );
+
+/* Remove a song (if it is queued) */
+void pq_remove_song( pq_t *pq, song_t *song );
+
+/* Move a song from one position to another */
+bool_t pq_move( pq_t *pq, int from, int to );
+
+/* Remove all songs */
+void pq_clear( pq_t *pq );
+
+/* Get song position in the queue (-1 if it is not queued) */
+int pq_get_pos( pq_t *pq, song_t *song );
+
+/* Get song at the given position. Queue must be locked */
+song_t *pq_get( pq_t *pq, int pos );
+
+/* Lock queue */
+void pq_lock( pq_t *pq );
+
+/* Unlock queue */
+void pq_unlock( pq_t *pq );
+
+#endif
+
+/* End of 'play_queue.h' file */
@@ -20,7 +20,9 @@
  * MA 02111-1307, USA.
  */
 
+#include <errno.h>
 #include <getopt.h>
+#include <poll.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/soundcard.h>
@@ -37,6 +39,7 @@
 #include "cfg.h"
 #include "command.h"
 #include "help_screen.h"
+#include "journal.h"
 #include "json_helpers.h"
 #include "logger.h"
 #include "logger_view.h"
@@ -44,7 +47,9 @@
 #include "player.h"
 #include "plist.h"
 #include "pmng.h"
+#include "profiler.h"
 #include "server.h"
+#include "snapshot.h"
 #include "test.h"
 #include "undo.h"
 #include "util.h"
@@ -102,6 +107,21 @@ player_context_t *player_context = NULL;
 bool_t player_end_of_stream = FALSE;
 GstElement *player_pipeline = NULL;
 
+/* Pending seek and volume requests. These are coalesced and applied by
+ * the player thread at most once per seek interval */
+pthread_mutex_t player_pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+bool_t player_seek_pending = FALSE;
+bool_t player_vol_pending = FALSE;
+song_time_t player_seek_target = 0;
+
+/* Seek scrubbing state: we are scrubbing if seek requests come faster
+ * than 'seek-scrub-timeout'. Key-unit seeks used while scrubbing must be
+ * followed by an accurate one */
+bool_t player_seek_scrubbing = FALSE;
+bool_t player_seek_need_accurate = FALSE;
+gint64 player_seek_last_request = 0;
+gint64 player_seek_last_applied = 0;
+
 /* Edit boxes history lists */
 editbox_history_t *player_hist_lists[PLAYER_NUM_HIST_LISTS];
 
@@ -143,6 +163,25 @@ wnd_t *wnd_root = NULL;
 /* Play list window */
 wnd_t *player_wnd = NULL;
 
+/* Daemon mode: there is no user interface and main thread only handles
+ * messages from other threads */
+bool_t player_daemon = FALSE;
+
+/* Message to the main thread in daemon mode */
+typedef struct tag_player_daemon_msg_t
+{
+	int m_id;
+	void *m_data;
+	struct tag_player_daemon_msg_t *m_next;
+} player_daemon_msg_t;
+
+/* Daemon mode messages queue. Main thread is woken up through the pipe:
+ * 'm' is written for a new message and 'q' for exit */
+player_daemon_msg_t *player_daemon_msgs = NULL, *player_daemon_msgs_tail = NULL;
+bool_t player_daemon_running = FALSE;
+pthread_mutex_t player_daemon_mutex = PTHREAD_MUTEX_INITIALIZER;
+int player_daemon_pipe[2] = { -1, -1 };
+
 /* Configuration list */
 cfg_node_t *cfg_list = NULL;
 
@@ -153,13 +192,21 @@ logger_view_t *player_logview = NULL;
 /* Standard value for edit boxes width */
 #define PLAYER_EB_WIDTH	(2 * WND_WIDTH(player_wnd) / 3)
 
-/* enqueued songs */
-int queued_songs[PLAYER_MAX_ENQUEUED];
-int num_queued_songs = 0;
+/* Play queue */
+pq_t *player_queue = NULL;
 
 /* Main thread ID */
 pthread_t player_main_tid = 0; 
 
+/* Fast start mode thread (loads play list asynchronously) */
+pthread_t player_startup_tid = 0;
+bool_t player_startup_async = FALSE;
+
+/* Player state loaded by fast start thread. Main thread applies it */
+static snapshot_state_t player_startup_state;
+static bool_t player_startup_state_ready = FALSE;
+static pthread_mutex_t player_startup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 #define VOLUME_SLIDER_RANGE (VOLUME_DEF * 2)
 
 /* Forward decls */
@@ -177,16 +224,90 @@ static void player_utf8_dialog( void );
  *
  *****/
 
-/* Load player state */
-static void player_load_state( void )
+/* Get current player state */
+void player_get_state( snapshot_state_t *state )
+{
+	state->m_cur_song = player_plist->m_cur_song;
+	state->m_cur_time = player_context->m_cur_time;
+	state->m_status = player_context->m_status;
+	state->m_start = player_start;
+	state->m_end = player_end;
+	state->m_volume = player_context->m_volume;
+	state->m_journal_seq = 0;
+} /* End of 'player_get_state' function */
+
+/* Apply restored player state. If 'play' is not set, state is only
+ * remembered (to be saved back) */
+static void player_restore_state( snapshot_state_t *state, bool_t play )
+{
+	/* Start playing from last stop */
+	if (cfg_get_var_int(cfg_list, "play-from-stop"))
+	{
+		logger_debug(player_log, "Playing from stop");
+		player_context->m_status = state->m_status;
+		player_start = state->m_start;
+		player_end = state->m_end;
+		if (player_context->m_status != PLAYER_STATUS_STOPPED)
+		{
+			if (play)
+				player_play(state->m_cur_song, state->m_cur_time);
+			else
+			{
+				player_plist->m_cur_song = state->m_cur_song;
+				player_context->m_cur_time = state->m_cur_time;
+			}
+		}
+		player_context->m_volume = state->m_volume;
+	}
+} /* End of 'player_restore_state' function */
+
+/* Handle state loaded from disk. Fast start thread leaves it to the main
+ * thread, since the rest of player is already running */
+static void player_state_loaded( snapshot_state_t *state )
+{
+	if (!player_startup_async)
+	{
+		player_restore_state(state, TRUE);
+		return;
+	}
+
+	pthread_mutex_lock(&player_startup_mutex);
+	player_startup_state = *state;
+	player_startup_state_ready = TRUE;
+	pthread_mutex_unlock(&player_startup_mutex);
+	player_send_user_msg(PLAYER_MSG_RESTORE_STATE, NULL);
+} /* End of 'player_state_loaded' function */
+
+/* Apply state loaded by fast start thread (in the main thread) */
+static void player_apply_startup_state( bool_t play )
+{
+	snapshot_state_t state;
+	bool_t ready;
+
+	pthread_mutex_lock(&player_startup_mutex);
+	ready = player_startup_state_ready;
+	if (ready)
+		state = player_startup_state;
+	player_startup_state_ready = FALSE;
+	pthread_mutex_unlock(&player_startup_mutex);
+
+	if (ready)
+		player_restore_state(&state, play);
+} /* End of 'player_apply_startup_state' function */
+
+/* Load player state from JSON file */
+static void player_load_json_state( void )
 {
 	char *fname = util_strcat(getenv("HOME"), "/.mpfc/state", NULL);
 	if (!fname)
 		goto finally_fname;
 
 	/* Parse */
+	int span = prof_begin("parse state");
 	JsonParser *parser = json_parser_new();
-	if (!json_parser_load_from_file(parser, fname, NULL))
+	bool_t parsed = json_parser_load_from_file(parser, fname, NULL);
+	prof_end(span);
+	if (!parsed)
 	{
 		logger_error(player_log, 1, _("unable to parse player state"));
 		goto finally_fname;
@@ -200,21 +321,21 @@ static void player_load_state( void )
 	/* Load playlist */
 	JsonArray *js_plist = js_get_array(js_root, "plist");
 	if (js_plist)
-		plist_import_from_json(player_plist, js_plist);
-
-	/* Start playing from last stop */
-	if (cfg_get_var_int(cfg_list, "play-from-stop"))
 	{
-		logger_debug(player_log, "Playing from stop");
-		player_context->m_status = js_get_int(js_root, "player-status", PLAYER_STATUS_STOPPED);
-		player_start = js_get_int(js_root, "player-start", 0) - 1;
-		player_end = js_get_int(js_root, "player-end", 0) - 1;
-		if (player_context->m_status != PLAYER_STATUS_STOPPED)
-			player_play(js_get_int(js_root, "cur-song", -1),
-					js_get_int(js_root, "cur-time", 0));
-		player_context->m_volume = js_get_double(js_root, "volume", VOLUME_DEF);
+		span = prof_begin("import play list");
+		plist_import_from_json(player_plist, js_plist);
+		prof_end(span);
 	}
 
+	snapshot_state_t state;
+	state.m_status = js_get_int(js_root, "player-status", PLAYER_STATUS_STOPPED);
+	state.m_start = js_get_int(js_root, "player-start", 0) - 1;
+	state.m_end = js_get_int(js_root, "player-end", 0) - 1;
+	state.m_cur_song = js_get_int(js_root, "cur-song", -1);
+	state.m_cur_time = js_get_int(js_root, "cur-time", 0);
+	state.m_volume = js_get_double(js_root, "volume", VOLUME_DEF);
+	player_state_loaded(&state);
+
 finally_js:
 	g_object_unref(parser);
 
@@ -222,8 +343,55 @@ finally_fname:
 	free(fname);
 }
 
-/* Save player state */
-static void player_save_state( void )
+/* Load player state. Returns TRUE if state is loaded from snapshot and
+ * journal and these may be continued */
+static bool_t player_load_state( void )
+{
+	snapshot_state_t state;
+
+	/* Binary snapshot is preferred; JSON state is a fallback (e.g. it is
+	 * left from an older version) */
+	char *fname = util_strcat(getenv("HOME"), "/.mpfc/state.bin", NULL);
+	int span = prof_begin("load state snapshot");
+	bool_t loaded = snapshot_load(fname, player_plist, &state);
+	prof_end(span);
+	free(fname);
+
+	if (!loaded)
+	{
+		player_load_json_state();
+		return FALSE;
+	}
+
+	/* Apply changes made after the snapshot was saved */
+	fname = util_strcat(getenv("HOME"), "/.mpfc/state.journal", NULL);
+	span = prof_begin("replay journal");
+	bool_t replayed = jrn_replay(fname, player_plist, &state);
+	prof_end(span);
+	free(fname);
+
+	player_state_loaded(&state);
+	return replayed;
+}
+
+/* Start play list journal */
+static void player_start_journal( bool_t compact )
+{
+	if (!cfg_get_var_int(cfg_list, "save-playlist-on-exit") ||
+			!cfg_get_var_bool(cfg_list, "state-journal"))
+		return;
+
+	logger_debug(player_log, "Starting journal");
+	char *fname = util_strcat(getenv("HOME"), "/.mpfc/state.journal", NULL);
+	char *snapshot_name = util_strcat(getenv("HOME"), "/.mpfc/state.bin", 
+			NULL);
+	jrn_start(fname, snapshot_name, player_plist, compact);
+	free(snapshot_name);
+	free(fname);
+} /* End of 'player_start_journal' function */
+
+/* Save player state to JSON file */
+static void player_save_json_state( void )
 {
 	JsonObject *js_root = json_object_new();
 
@@ -246,16 +414,228 @@ static void player_save_state( void )
 	json_generator_set_root(gen, js_make_node(js_root));
 	char *fname = util_strcat(getenv("HOME"), "/.mpfc/state", NULL);
 	json_generator_to_file(gen, fname, NULL);
+}
+
+/* Save player state */
+static void player_save_state( void )
+{
+	snapshot_state_t state;
+
+	/* Journal has all the changes; just write down the rest of it */
+	if (jrn_is_active())
+	{
+		jrn_stop();
+		player_save_cfg();
+		return;
+	}
+
+	/* Save binary snapshot falling back to JSON if it fails */
+	player_get_state(&state);
+	char *fname = util_strcat(getenv("HOME"), "/.mpfc/state.bin", NULL);
+	if (snapshot_save(fname, cfg_get_var_int(cfg_list, "save-playlist-on-exit") ?
+				player_plist : NULL, &state))
+	{
+		/* JSON state and journal are obsolete now */
+		char *json_name = util_strcat(getenv("HOME"), "/.mpfc/state", NULL);
+		unlink(json_name);
+		free(json_name);
+		char *jrn_name = util_strcat(getenv("HOME"), "/.mpfc/state.journal",
+				NULL);
+		unlink(jrn_name);
+		free(jrn_name);
+	}
+	else
+		player_save_json_state();
+	free(fname);
 
 	/* Save some stuff through the cfg system */
 	player_save_cfg();
 }
 
+/* Fill play list with files from command line or saved state */
+static void player_load_plist( void )
+{
+	int span = prof_begin("load play list");
+
+	/* Make a set of files to add */
+	logger_debug(player_log, "Initializing play list set");
+	plist_set_t *set = plist_set_new(FALSE);
+	if (set == NULL)
+	{
+		logger_error(player_log, 0,
+				_("Unable to initialize set of files for play list"));
+		goto finally;
+	}
+	for ( int i = 0; i < player_num_files; i ++ )
+		plist_set_add(set, player_files[i]);
+	plist_add_set(player_plist, set);
+	plist_set_free(set);
+
+	/* Load saved play list if files list is empty */
+	logger_debug(player_log, "Loading player state");
+	bool_t continue_journal = FALSE;
+	if (!player_num_files)
+		continue_journal = player_load_state();
+
+	/* Journal changes from now on. If state is not loaded from snapshot
+	 * it has to be rewritten first */
+	player_start_journal(!continue_journal);
+
+finally:
+	prof_end(span);
+} /* End of 'player_load_plist' function */
+
+/* Fast start mode thread function: does the slow initialization parts
+ * while user interface is already running */
+static void *player_startup_thread( void *arg )
+{
+	pmng_fill_media_file_exts(player_pmng);
+	player_load_plist();
+
+	wnd_invalidate(player_wnd);
+	pmng_hook(player_pmng, "playlist");
+	return NULL;
+} /* End of 'player_startup_thread' function */
+
+/* Wait for fast start thread to finish */
+static void player_wait_startup( void )
+{
+	if (player_startup_tid)
+	{
+		logger_debug(player_log, "Waiting for startup thread");
+		pthread_join(player_startup_tid, NULL);
+		player_startup_tid = 0;
+	}
+} /* End of 'player_wait_startup' function */
+
+/* Wake daemon main loop up. Safe to be called from signal handlers */
+static void player_daemon_wakeup( char c )
+{
+	if (player_daemon_pipe[1] >= 0 && write(player_daemon_pipe[1], &c, 1) < 0)
+	{
+		/* Pipe is full; main loop is going to wake up anyway */
+	}
+} /* End of 'player_daemon_wakeup' function */
+
+/* Initialize daemon mode main loop */
+static bool_t player_daemon_init( void )
+{
+	if (pipe(player_daemon_pipe))
+	{
+		player_daemon_pipe[0] = player_daemon_pipe[1] = -1;
+		return FALSE;
+	}
+	for ( int i = 0; i < 2; i ++ )
+	{
+		fcntl(player_daemon_pipe[i], F_SETFL, 
+				fcntl(player_daemon_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(player_daemon_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	/* Messages are accepted right away (e.g. from server) and handled
+	 * once main loop starts */
+	player_daemon_running = TRUE;
+	return TRUE;
+} /* End of 'player_daemon_init' function */
+
+/* Free daemon mode stuff */
+static void player_daemon_free( void )
+{
+	for ( int i = 0; i < 2; i ++ )
+	{
+		if (player_daemon_pipe[i] >= 0)
+			close(player_daemon_pipe[i]);
+		player_daemon_pipe[i] = -1;
+	}
+} /* End of 'player_daemon_free' function */
+
+/* Daemon mode main loop. Sleeps until there are messages to handle */
+static void player_daemon_loop( void )
+{
+	logger_message(player_log, 0, _("Running in daemon mode"));
+
+	for ( bool_t quit = FALSE; !quit; )
+	{
+		struct pollfd pfd;
+		char buf[64];
+		ssize_t sz;
+
+		pfd.fd = player_daemon_pipe[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+		{
+			logger_error(player_log, 0, _("Daemon main loop failed: %s"),
+					strerror(errno));
+			quit = TRUE;
+		}
+		while ((sz = read(player_daemon_pipe[0], buf, sizeof(buf))) > 0)
+		{
+			if (memchr(buf, 'q', sz))
+				quit = TRUE;
+		}
+
+		/* No more messages are accepted after exit request. Those 
+		 * already queued are handled */
+		pthread_mutex_lock(&player_daemon_mutex);
+		player_daemon_msg_t *msg = player_daemon_msgs;
+		player_daemon_msgs = player_daemon_msgs_tail = NULL;
+		if (quit)
+			player_daemon_running = FALSE;
+		pthread_mutex_unlock(&player_daemon_mutex);
+
+		while (msg)
+		{
+			player_daemon_msg_t *next = msg->m_next;
+			player_on_user(NULL, msg->m_id, msg->m_data);
+			free(msg);
+			msg = next;
+		}
+	}
+	logger_debug(player_log, "Daemon main loop finished");
+} /* End of 'player_daemon_loop' function */
+
+/* Send a user message to the main thread. Returns FALSE if it doesn't
+ * handle messages now (in the very beginning and end) */
+bool_t player_send_user_msg( int id, void *data )
+{
+	if (!player_daemon)
+	{
+		if (!player_wnd)
+			return FALSE;
+		wnd_msg_send(player_wnd, "user", wnd_msg_user_new(id, data));
+		return TRUE;
+	}
+
+	player_daemon_msg_t *msg = 
+		(player_daemon_msg_t *)malloc(sizeof(player_daemon_msg_t));
+	if (!msg)
+		return FALSE;
+	msg->m_id = id;
+	msg->m_data = data;
+	msg->m_next = NULL;
+
+	pthread_mutex_lock(&player_daemon_mutex);
+	if (!player_daemon_running)
+	{
+		pthread_mutex_unlock(&player_daemon_mutex);
+		free(msg);
+		return FALSE;
+	}
+	if (player_daemon_msgs_tail)
+		player_daemon_msgs_tail->m_next = msg;
+	else
+		player_daemon_msgs = msg;
+	player_daemon_msgs_tail = msg;
+	pthread_mutex_unlock(&player_daemon_mutex);
+
+	player_daemon_wakeup('m');
+	return TRUE;
+} /* End of 'player_send_user_msg' function */
+
 /* Initialize player */
 bool_t player_init( int argc, char *argv[] )
 {
-	int i;
-	plist_set_t *set;
+	int i, span;
 	time_t t;
 	char *str_time;
 	bool_t is_utf8 = TRUE;
@@ -273,7 +653,10 @@ bool_t player_init( int argc, char *argv[] )
 			"%s/mpfcrc", player_cfg_dir);
 	snprintf(player_cfg_autosave_file, sizeof(player_cfg_autosave_file), 
 			"%s/autosave", player_cfg_dir);
-	if (!player_init_cfg())
+	span = prof_begin("player_init_cfg");
+	bool_t cfg_ok = player_init_cfg();
+	prof_end(span);
+	if (!cfg_ok)
 	{
 		fprintf(stderr, _("Unable to initialize configuration"));
 		return FALSE;
@@ -312,15 +695,32 @@ bool_t player_init( int argc, char *argv[] )
 	if (!player_parse_cmd_line(argc, argv))
 		return FALSE;
 
-	/* Initialize window system */
-	logger_debug(player_log, "Initializing window system");
-	wnd_root = wnd_init(cfg_list, player_log);
-	if (wnd_root == NULL)
+	/* Daemon doesn't touch terminal at all */
+	player_daemon = cfg_get_var_bool(cfg_list, "daemon");
+	if (player_daemon)
 	{
-		logger_fatal(player_log, 0, _("Window system initialization failed"));
-		return FALSE;
+		logger_debug(player_log, "Initializing daemon mode");
+		if (!player_daemon_init())
+		{
+			logger_fatal(player_log, 0, _("Daemon mode initialization failed"));
+			return FALSE;
+		}
+	}
+	else
+	{
+		/* Initialize window system */
+		logger_debug(player_log, "Initializing window system");
+		span = prof_begin("wnd_init");
+		wnd_root = wnd_init(cfg_list, player_log);
+		prof_end(span);
+		if (wnd_root == NULL)
+		{
+			logger_fatal(player_log, 0, 
+					_("Window system initialization failed"));
+			return FALSE;
+		}
+		wnd_msg_add_handler(wnd_root, "destructor", player_root_destructor);
 	}
-	wnd_msg_add_handler(wnd_root, "destructor", player_root_destructor);
 
 	/* Check that we have an utf8 locale */
 	if (!util_check_utf8_mode())
@@ -330,14 +730,18 @@ bool_t player_init( int argc, char *argv[] )
 	}
 
 	/* Initialize play list window */
-	logger_debug(player_log, "Initializing play list window");
-	player_wnd = WND_OBJ(player_wnd_new(wnd_root));
-	if (player_wnd == NULL)
+	if (!player_daemon)
 	{
-		logger_fatal(player_log, 0, _("Unable to initialize play list window"));
-		return FALSE;
+		logger_debug(player_log, "Initializing play list window");
+		player_wnd = WND_OBJ(player_wnd_new(wnd_root));
+		if (player_wnd == NULL)
+		{
+			logger_fatal(player_log, 0, 
+					_("Unable to initialize play list window"));
+			return FALSE;
+		}
+		logger_attach_handler(player_log, player_on_log_msg, NULL);
 	}
-	logger_attach_handler(player_log, player_on_log_msg, NULL);
 
 	/* Initialize file browser directory */
 	if (getcwd(player_fb_dir, sizeof(player_fb_dir)) == NULL)
@@ -347,7 +751,9 @@ bool_t player_init( int argc, char *argv[] )
 	
 	/* Initialize plugin manager */
 	logger_debug(player_log, "Initializing plugin manager");
+	span = prof_begin("pmng_init");
 	player_pmng = pmng_init(cfg_list, player_log, wnd_root);
+	prof_end(span);
 	if (player_pmng == NULL)
 	{
 		logger_fatal(player_log, 0, _("Unable to initialize plugin manager"));
@@ -383,24 +789,32 @@ bool_t player_init( int argc, char *argv[] )
 	}
 	player_pmng->m_playlist = player_plist;
 
-	/* Make a set of files to add */
-	logger_debug(player_log, "Initializing play list set");
-	set = plist_set_new(FALSE);
-	if (set == NULL)
+	/* Create play queue */
+	player_queue = pq_new();
+	if (player_queue == NULL)
 	{
-		logger_fatal(player_log, 0,
-				_("Unable to initialize set of files for play list"));
+		logger_fatal(player_log, 0, _("Play queue initialization failed"));
 		return FALSE;
 	}
-	for ( i = 0; i < player_num_files; i ++ )
-		plist_set_add(set, player_files[i]);
-	plist_add_set(player_plist, set);
-	plist_set_free(set);
 
-	/* Load saved play list if files list is empty */
-	logger_debug(player_log, "Adding list.m3u");
-	if (!player_num_files)
-		player_load_state();
+	/* Fill play list. In fast start mode this (along with building media
+	 * file extensions list) is done in background */
+	if (cfg_get_var_bool(cfg_list, "fast-start"))
+	{
+		logger_debug(player_log, "Starting startup thread");
+		player_startup_async = TRUE;
+		if (pthread_create(&player_startup_tid, NULL, 
+					player_startup_thread, NULL))
+		{
+			player_startup_tid = 0;
+			player_startup_async = FALSE;
+			logger_error(player_log, 0, _("Unable to create startup thread"));
+			pmng_fill_media_file_exts(player_pmng);
+			player_load_plist();
+		}
+	}
+	else
+		player_load_plist();
 
 	/* Initialize history lists */
 	logger_debug(player_log, "Initializing history");
@@ -420,15 +834,20 @@ bool_t player_init( int argc, char *argv[] )
 		player_marks[i] = -1;
 
 	/* Start server */
+	span = prof_begin("server_start");
 	server_start();
+	prof_end(span);
 
 	/* Exit */
 	logger_message(player_log, 0, _("Player initialized"));
 
 	/* Show startup dialogs */
-	if (!is_utf8)
-		player_utf8_dialog();
-	player_welcome_dialog();
+	if (!player_daemon)
+	{
+		if (!is_utf8)
+			player_utf8_dialog();
+		player_welcome_dialog();
+	}
 
 	return TRUE;
 } /* End of 'player_init' function */
@@ -470,10 +889,16 @@ player_wnd_t *player_wnd_new( wnd_t *parent )
 	return pwnd;
 } /* End of 'player_wnd_new' function */
 
-/* Root window destructor */
-void player_root_destructor( wnd_t *wnd )
+/* Save state and stop threads when main loop is over */
+static void player_finish( void )
 {
-	logger_debug(player_log, "In player_root_destructor");
+	/* Play list must be completely loaded before saving. Main loop might
+	 * have finished before state was restored */
+	player_wait_startup();
+	player_apply_startup_state(FALSE);
+
+	/* Remote clients' adding jobs too. They also need info reader */
+	server_stop_jobs();
 
 	/* Save player state */
 	player_save_state();
@@ -496,6 +921,13 @@ void player_root_destructor( wnd_t *wnd )
 	
 	/* Stop general plugins */
 	pmng_stop_general_plugins(player_pmng);
+} /* End of 'player_finish' function */
+
+/* Root window destructor */
+void player_root_destructor( wnd_t *wnd )
+{
+	logger_debug(player_log, "In player_root_destructor");
+	player_finish();
 
 	player_wnd = NULL;
 	wnd_root = NULL;
@@ -509,8 +941,13 @@ void player_deinit( void )
 
 	logger_debug(player_log, "In player_deinit");
 
+	/* Wait for startup thread (if initialization has failed) */
+	player_wait_startup();
+	jrn_stop();
+
 	/* Stop server */
 	server_stop();
+	player_daemon_free();
 
 	/* Uninitialize plugin manager */
 	logger_debug(player_log, "Doing pmng_free");
@@ -534,6 +971,12 @@ void player_deinit( void )
 	}
 	
 	/* Destroy all objects */
+	if (player_queue != NULL)
+	{
+		logger_debug(player_log, "Destroying play queue");
+		pq_free(player_queue);
+		player_queue = NULL;
+	}
 	if (player_plist != NULL)
 	{
 		logger_debug(player_log, "Destroying play list");
@@ -565,6 +1008,13 @@ void player_deinit( void )
 /* Run player */
 bool_t player_run( void )
 {
+	if (player_daemon)
+	{
+		player_daemon_loop();
+		player_finish();
+		return TRUE;
+	}
+
 	/* Run window message loop */
 	wnd_main(wnd_root);
 	wnd_root = NULL;
@@ -688,6 +1138,13 @@ bool_t player_init_cfg( void )
 	cfg_set_var_bool(cfg_list, "autosave-plugins-params", TRUE);
 	cfg_set_var_bool(cfg_list, "search-nocase", TRUE);
 	cfg_set_var_bool(cfg_list, "view-follows-cur-song", TRUE);
+	cfg_set_var_int(cfg_list, "seek-interval", 100);
+	cfg_set_var_int(cfg_list, "seek-scrub-timeout", 300);
+	cfg_set_var_bool(cfg_list, "seek-scrub-key-unit", TRUE);
+	cfg_set_var_bool(cfg_list, "state-journal", TRUE);
+	cfg_set_var_bool(cfg_list, "server-unix-socket", TRUE);
+	cfg_set_var_int(cfg_list, "journal-flush-interval", 1000);
+	cfg_set_var_int(cfg_list, "journal-compact-size", 1024 * 1024);
 
 	/* Read configuration files */
 	cfg_rcfile_read(cfg_list, player_cfg_autosave_file);
@@ -731,6 +1188,14 @@ void player_save_cfg( void )
 /* Signal handler */
 void player_handle_signal( int signum )
 {
+	/* Daemon main loop is woken up from any thread */
+	if (player_daemon)
+	{
+		if (signum == SIGINT || signum == SIGTERM)
+			player_daemon_wakeup('q');
+		return;
+	}
+
 	if (pthread_self() != player_main_tid)
 		return;
 	if (signum == SIGINT || signum == SIGTERM)
@@ -1215,6 +1680,13 @@ wnd_msg_retcode_t player_on_user( wnd_t *wnd, int id, void *data )
 	case PLAYER_MSG_NEXT_FOCUS:
 		wnd_next_focus(wnd_root);
 		break;
+	case PLAYER_MSG_SERVER_CALL:
+		server_call_run((server_call_t *)data);
+		break;
+	case PLAYER_MSG_RESTORE_STATE:
+		player_apply_startup_state(TRUE);
+		wnd_invalidate(wnd);
+		break;
 	}
 	return WND_MSG_RETCODE_OK;
 } /* End of 'player_on_user' function */
@@ -1225,6 +1697,13 @@ wnd_msg_retcode_t player_on_display( wnd_t *wnd )
 	int i;
 	song_t *s = NULL;
 	char aparams[256], *aparams_ptr;
+	static bool_t first_display = TRUE;
+
+	if (first_display)
+	{
+		prof_mark("first display");
+		first_display = FALSE;
+	}
 
 	/* Display head */
 	wnd_move(wnd, 0, 0, 0);
@@ -1401,7 +1880,7 @@ void player_on_log_msg( logger_t *log, void *data,
  *
  *****/
 
-/* Seek song */
+/* Seek song. Actual seeking is done by player thread */
 void player_seek( song_time_t val, bool_t rel )
 {
 	if (player_plist->m_cur_song == -1)
@@ -1416,20 +1895,101 @@ void player_seek( song_time_t val, bool_t rel )
 		new_time = s->m_len;
 
 	player_save_time();
-	guint64 tm = player_translate_time(s, new_time, TRUE);
-	logger_debug(player_log, "gstreamer: seeking to time %lld", tm);
-	if (!gst_element_seek(player_pipeline, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
-			GST_SEEK_TYPE_SET, tm, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE))
-	{
-		logger_error(player_log, 1, _("gstreamer: gst_element_seek returned FALSE"));
-	}
+
+	/* Replace any request not applied yet */
+	pthread_mutex_lock(&player_pending_mutex);
+	gint64 now = g_get_monotonic_time();
+	player_seek_scrubbing = (now - player_seek_last_request < 
+			(gint64)cfg_get_var_int(cfg_list, "seek-scrub-timeout") * 1000);
+	player_seek_last_request = now;
+	player_seek_target = new_time;
+	player_seek_pending = TRUE;
 	player_context->m_cur_time = new_time;
+	pthread_mutex_unlock(&player_pending_mutex);
+
 	wnd_invalidate(player_wnd);
 	logger_debug(player_log, "after player_seek timer is %lld", player_context->m_cur_time);
 
 	pmng_hook(player_pmng, "player-status");
 } /* End of 'player_seek' function */
 
+/* Do seek in the pipeline */
+static void player_do_seek( song_t *s, song_time_t t, GstSeekFlags flags )
+{
+	guint64 tm = player_translate_time(s, t, TRUE);
+	logger_debug(player_log, "gstreamer: seeking to time %lld", tm);
+	if (!gst_element_seek(player_pipeline, 1.0, GST_FORMAT_TIME, flags,
+			GST_SEEK_TYPE_SET, tm, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE))
+	{
+		logger_error(player_log, 1, _("gstreamer: gst_element_seek returned FALSE"));
+	}
+} /* End of 'player_do_seek' function */
+
+/* Apply pending seek and volume requests (called from player thread).
+ * Returns TRUE if a seek is still in progress */
+static bool_t player_apply_pending( song_t *s )
+{
+	bool_t vol = FALSE, seek = FALSE, in_progress;
+	GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+	song_time_t t;
+
+	pthread_mutex_lock(&player_pending_mutex);
+	gint64 now = g_get_monotonic_time();
+	gint64 interval = (gint64)cfg_get_var_int(cfg_list, "seek-interval") * 1000;
+	gint64 scrub_timeout = 
+		(gint64)cfg_get_var_int(cfg_list, "seek-scrub-timeout") * 1000;
+
+	/* Volume */
+	if (player_vol_pending)
+	{
+		player_vol_pending = FALSE;
+		vol = TRUE;
+	}
+
+	/* Seek to the latest requested target */
+	t = player_seek_target;
+	if (player_seek_pending && now - player_seek_last_applied >= interval)
+	{
+		seek = TRUE;
+		player_seek_pending = FALSE;
+		player_seek_last_applied = now;
+		if (player_seek_scrubbing && 
+				cfg_get_var_bool(cfg_list, "seek-scrub-key-unit"))
+		{
+			flags |= GST_SEEK_FLAG_KEY_UNIT;
+			player_seek_need_accurate = TRUE;
+		}
+		else
+			player_seek_need_accurate = FALSE;
+	}
+	/* Scrubbing finished: do an accurate seek to the final position */
+	else if (!player_seek_pending && player_seek_need_accurate &&
+			now - player_seek_last_request >= scrub_timeout)
+	{
+		seek = TRUE;
+		flags |= GST_SEEK_FLAG_ACCURATE;
+		player_seek_need_accurate = FALSE;
+	}
+	in_progress = (player_seek_pending || player_seek_need_accurate);
+	pthread_mutex_unlock(&player_pending_mutex);
+
+	if (vol)
+		player_update_vol();
+	if (seek)
+		player_do_seek(s, t, flags);
+	return in_progress;
+} /* End of 'player_apply_pending' function */
+
+/* Drop pending requests */
+static void player_reset_pending( void )
+{
+	pthread_mutex_lock(&player_pending_mutex);
+	player_seek_pending = FALSE;
+	player_seek_need_accurate = FALSE;
+	player_vol_pending = FALSE;
+	pthread_mutex_unlock(&player_pending_mutex);
+} /* End of 'player_reset_pending' function */
+
 /* Play song */
 void player_play( int song, song_time_t start_time )
 {
@@ -1442,14 +2002,14 @@ void player_play( int song, song_time_t start_time )
 	if (song < 0 || song >= player_plist->m_len ||
 			(s = player_plist->m_list[song]) == NULL)
 	{
-		player_plist->m_cur_song = -1;
+		plist_set_cur_song(player_plist, -1);
 		return;
 	}
 
 	/* Start new playing thread */
 	cfg_set_var(cfg_list, "cur-song-name", song_get_short_name(s));
 	cfg_set_var(cfg_list, "cur-song-title", STR_TO_CPTR(s->m_title));
-	player_plist->m_cur_song = song;
+	plist_set_cur_song(player_plist, song);
 	player_context->m_cur_time = start_time;
 //	player_context->m_status = PLAYER_STATUS_PLAYING;
 
@@ -1468,14 +2028,11 @@ void player_play( int song, song_time_t start_time )
 /* End playing song */
 void player_end_play( bool_t rem_cur_song )
 {
-	int was_song = player_plist->m_cur_song;
-	
 	player_save_time();
-	player_plist->m_cur_song = -1;
+	if (rem_cur_song)
+		plist_set_cur_song(player_plist, -1);
 	player_end_track = TRUE;
 //	player_context->m_status = PLAYER_STATUS_STOPPED;
-	if (!rem_cur_song)
-		player_plist->m_cur_song = was_song;
 	cfg_set_var(cfg_list, "cur-song-name", "");
 	cfg_set_var(cfg_list, "cur-song-title", "");
 } /* End of 'player_end_play' function */
@@ -1507,7 +2064,11 @@ void player_set_vol( double vol, bool_t rel )
 		player_context->m_volume = VOLUME_MIN;
 	else if (player_context->m_volume > VOLUME_MAX)
 		player_context->m_volume = VOLUME_MAX;
-	player_update_vol();
+
+	/* Volume will be updated by player thread */
+	pthread_mutex_lock(&player_pending_mutex);
+	player_vol_pending = TRUE;
+	pthread_mutex_unlock(&player_pending_mutex);
 
 	pmng_hook(player_pmng, "volume");
 } /* End of 'player_set_vol' function */
@@ -1566,15 +2127,21 @@ int player_skip_songs( int num, bool_t play )
 		else
 			song = s + base;
 	}
-	if(num_queued_songs != 0)
+
+	/* Queued songs take precedence */
+	for ( ;; )
 	{
-		int queue_loop;
-		song = queued_songs[0];
-		for(queue_loop = 0;queue_loop < num_queued_songs-1;queue_loop++)
+		song_t *s = pq_pop(player_queue);
+		if (s == NULL)
+			break;
+
+		int pos = plist_find_song(player_plist, s);
+		song_free(s);
+		if (pos >= 0)
 		{
-			queued_songs[queue_loop] = queued_songs[queue_loop+1];
+			song = pos;
+			break;
 		}
-		num_queued_songs--;
 	}
 
 	/* Start or end play */
@@ -1772,6 +2339,7 @@ void *player_thread( void *arg )
 		/* Get song length and information */
 		logger_debug(player_log, "Updating song info");
 		song_update_info(s);
+		plist_info_changed(player_plist, s);
 
 		/* Create gstreamer stuff */
 		player_end_of_stream = FALSE;
@@ -1802,6 +2370,7 @@ void *player_thread( void *arg )
 		g_object_set(G_OBJECT(player_pipeline), "video-sink", videosink, NULL);
 
 		/* Set volume */
+		player_reset_pending();
 		player_update_vol();
 
 		/* Set bus message handler */
@@ -1825,13 +2394,8 @@ void *player_thread( void *arg )
 		logger_debug(player_log, "cur_time is %lld", player_context->m_cur_time);
 		if (player_context->m_cur_time > 0 || song_played->m_start_time > -1)
 		{
-			guint64 tm = player_translate_time(song_played, player_context->m_cur_time, TRUE);
-			logger_debug(player_log, "gstreamer: seeking to time %lld", tm);
-			if (!gst_element_seek(player_pipeline, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
-					GST_SEEK_TYPE_SET, tm, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE))
-			{
-				logger_error(player_log, 1, _("gstreamer: gst_element_seek returned FALSE"));
-			}
+			player_do_seek(song_played, player_context->m_cur_time, 
+					GST_SEEK_FLAG_FLUSH);
 		}
 
 		/* Play */
@@ -1840,7 +2404,10 @@ void *player_thread( void *arg )
 		was_status = PLAYER_STATUS_PLAYING;
 		while (!player_end_track)
 		{
+			bool_t seeking;
+
 			g_main_context_iteration(NULL, FALSE);
+			seeking = player_apply_pending(song_played);
 
 			if (player_context->m_status != was_status)
 			{
@@ -1862,8 +2429,9 @@ void *player_thread( void *arg )
 			{
 				guint64 tm;
 
-				/* Update time */
-				if (gst_element_query_position(player_pipeline, GST_FORMAT_TIME, &tm))
+				/* Update time (unless a seek is in progress: time is already
+				 * set to the seek target) */
+				if (!seeking && gst_element_query_position(player_pipeline, GST_FORMAT_TIME, &tm))
 				{
 					tm = player_translate_time(song_played, tm, FALSE);
 					if (tm != player_context->m_cur_time)
@@ -2466,6 +3034,8 @@ void player_test_dialog( void )
 	vbox = vbox_new(WND_OBJ(dlg->m_vbox), _("Tests"), 0);
 	radio_new(WND_OBJ(vbox), _("Test &1. Window library perfomance"), "1", '1', 
 			TRUE);
+	radio_new(WND_OBJ(vbox), _("Test &2. Key press latency"), "2", '2', 
+			FALSE);
 	btn = button_new(WND_OBJ(dlg->m_hbox), _("&Stop job"), "stop", 's');
 	wnd_msg_add_handler(WND_OBJ(btn), "clicked", player_on_test_stop);
 	wnd_msg_add_handler(WND_OBJ(dlg), "ok_clicked", player_on_test);
@@ -2777,6 +3347,9 @@ void player_save_info_dialog( dialog_t *dlg )
 		song_update_title(songs_list[i]);
 		wnd_invalidate(player_wnd);
 
+		jrn_log_info(player_plist, songs_list[i]);
+		plist_info_changed(player_plist, songs_list[i]);
+
 		/* Save info */
 		irw_push(songs_list[i], SONG_INFO_WRITE);
 	}
@@ -3009,6 +3582,10 @@ wnd_msg_retcode_t player_on_test( wnd_t *wnd )
 	assert(r);
 	if (r->m_checked)
 		sel = TEST_WNDLIB_PERFOMANCE;
+	r = RADIO_OBJ(dialog_find_item(DIALOG_OBJ(wnd), "2"));
+	assert(r);
+	if (r->m_checked)
+		sel = TEST_KEY_LATENCY;
 	if (sel < 0)
 		return WND_MSG_RETCODE_OK;
 
@@ -3387,8 +3964,11 @@ void player_stop( void )
 /* Queue the selected song */
 void player_queue_song( void )
 {
-	if(num_queued_songs < PLAYER_MAX_ENQUEUED)
-		queued_songs[num_queued_songs++] = player_plist->m_sel_end;
+	plist_lock(player_plist);
+	if (player_plist->m_sel_end >= 0 && 
+			player_plist->m_sel_end < player_plist->m_len)
+		pq_push(player_queue, player_plist->m_list[player_plist->m_sel_end]);
+	plist_unlock(player_plist);
 } /* End of 'player_queue_song' function */
 
 /* End of 'player.c' file */
@@ -29,8 +29,10 @@
 #include "logger.h"
 #include "logger_view.h"
 #include "main_types.h"
+#include "play_queue.h"
 #include "plist.h"
 #include "pmng.h"
+#include "snapshot.h"
 #include "undo.h"
 #include "wnd.h"
 #include "wnd_dialog.h"
@@ -59,9 +61,8 @@
 /* Player window user messages IDs */
 #define PLAYER_MSG_INFO			0
 #define PLAYER_MSG_NEXT_FOCUS	1
-
-/* Max number of enqueued songs */
-#define PLAYER_MAX_ENQUEUED 	20
+#define PLAYER_MSG_SERVER_CALL	2
+#define PLAYER_MSG_RESTORE_STATE	3
 
 /* Player window type */
 typedef struct
@@ -115,9 +116,8 @@ extern cfg_node_t *cfg_list;
 extern logger_t *player_log;
 extern logger_view_t *player_logview;
 
-/* enqueued songs - max of PLAYER_MAX_ENQUEUED */
-extern int queued_songs[PLAYER_MAX_ENQUEUED];
-extern int num_queued_songs;
+/* Play queue */
+extern pq_t *player_queue;
 
 /***
  * Initialization/deinitialization functions
@@ -138,6 +138,10 @@ player_wnd_t *player_wnd_new( wnd_t *parent );
 /* Run player */
 bool_t player_run( void );
 
+/* Send a user message to the main thread. Returns FALSE if it doesn't
+ * handle messages now (in the very beginning and end) */
+bool_t player_send_user_msg( int id, void *data );
+
 /* Initialize configuration */
 bool_t player_init_cfg( void );
 
@@ -147,6 +151,9 @@ bool_t player_parse_cmd_line( int argc, char *argv[] );
 /* Save configuration */
 void player_save_cfg( void );
 
+/* Get current player state */
+void player_get_state( snapshot_state_t *state );
+
 /***
  * Message handlers
  ***/
@@ -33,7 +33,9 @@
 #include <unistd.h>
 #include <json-glib/json-glib.h>
 #include "types.h"
+#include "change_log.h"
 #include "file_utils.h"
+#include "journal.h"
 #include "json_helpers.h"
 #include "player.h"
 #include "plist.h"
@@ -62,7 +64,12 @@ plist_t *plist_new( int start_pos )
 	pl->m_visual = FALSE;
 	pl->m_len = 0;
 	pl->m_list = NULL;
+	pl->m_version = 0;
+	pl->m_changes = chlog_new(CHLOG_DEF_SIZE);
+	pl->m_batch = NULL;
+	pl->m_held = FALSE;
 	pthread_mutex_init(&pl->m_mutex, NULL);
+	pthread_cond_init(&pl->m_hold_cond, NULL);
 	return pl;
 } /* End of 'plist_new' function */
 
@@ -82,6 +89,8 @@ void plist_free( plist_t *pl )
 			plist_unlock(pl);
 		}
 		
+		chlog_free(pl->m_changes);
+		pthread_cond_destroy(&pl->m_hold_cond);
 		pthread_mutex_destroy(&pl->m_mutex);
 		free(pl);
 	}
@@ -209,9 +218,9 @@ int plist_song_cmp( song_t *s1, song_t *s2, int criteria )
 /* Sort play list with specified bounds */
 void plist_sort_bounds( plist_t *pl, int start, int end, int criteria )
 {
-	int i, j, was_song;
+	int i, was_song;
 	song_t *cur_song;
-	song_t **was_list = NULL;
+	int *order = NULL, *transform = NULL;
 	bool_t finished = FALSE;
 
 	assert(pl);
@@ -241,9 +250,12 @@ void plist_sort_bounds( plist_t *pl, int start, int end, int criteria )
 	/* Lock play list */
 	plist_lock(pl);
 
-	/* Save play list */
-	was_list = (song_t **)malloc(sizeof(song_t *) * pl->m_len);
-	memcpy(was_list, pl->m_list, sizeof(song_t *) * pl->m_len);
+	/* Original indices of songs are tracked along with sorting to 
+	 * build the permutation */
+	order = (int *)malloc(sizeof(int) * pl->m_len);
+	if (order != NULL)
+		for ( i = 0; i < pl->m_len; i ++ )
+			order[i] = i;
 	
 	/* Save current song */
 	was_song = pl->m_cur_song;
@@ -270,6 +282,12 @@ void plist_sort_bounds( plist_t *pl, int start, int end, int criteria )
 			memmove(&pl->m_list[k + 1], &pl->m_list[k],
 					(i - k + 1) * sizeof(*pl->m_list));
 			pl->m_list[k] = s;
+			if (order != NULL)
+			{
+				int o = order[i + 1];
+				memmove(&order[k + 1], &order[k], (i - k + 1) * sizeof(*order));
+				order[k] = o;
+			}
 		}
 	}
 
@@ -286,28 +304,35 @@ void plist_sort_bounds( plist_t *pl, int start, int end, int criteria )
 			}
 	}
 
-	/* Store undo information */
-	if (player_store_undo)
+	/* Build permutation: song with index i is moved to transform[i] */
+	if (order != NULL)
 	{
-		struct tag_undo_list_item_t *undo;
-		undo = (struct tag_undo_list_item_t *)malloc(sizeof(*undo));
-		undo->m_type = UNDO_SORT;
-		undo->m_next = undo->m_prev = NULL;
-		undo->m_data.m_sort.m_was_song = was_song;
-		undo->m_data.m_sort.m_transform = (int *)malloc(
-				sizeof(int) * pl->m_len);
-		for ( i = 0; i < pl->m_len; i ++ )
+		transform = (int *)malloc(sizeof(int) * pl->m_len);
+		if (transform != NULL)
+			for ( i = 0; i < pl->m_len; i ++ )
+				transform[order[i]] = i;
+		free(order);
+	}
+
+	/* Without permutation change log is just truncated */
+	plist_changed(pl, CHLOG_SORT, 0, pl->m_len, 0, transform);
+	jrn_log_sort(pl->m_len, transform);
+	if (transform != NULL)
+	{
+		/* Store undo information */
+		if (player_store_undo)
 		{
-			for ( j = 0; j < pl->m_len; j ++ )
-				if (was_list[i] == pl->m_list[j])
-				{
-					undo->m_data.m_sort.m_transform[i] = j;
-					break;
-				}
+			struct tag_undo_list_item_t *undo;
+			undo = (struct tag_undo_list_item_t *)malloc(sizeof(*undo));
+			undo->m_type = UNDO_SORT;
+			undo->m_next = undo->m_prev = NULL;
+			undo->m_data.m_sort.m_was_song = was_song;
+			undo->m_data.m_sort.m_transform = transform;
+			undo_add(player_ul, undo);
 		}
-		undo_add(player_ul, undo);
+		else
+			free(transform);
 	}
-	free(was_list);
 
 	/* Unlock play list */
 	plist_unlock(pl);
@@ -400,10 +425,15 @@ void plist_rem( plist_t *pl )
 
 	/* Unlock play list */
 	plist_lock(pl);
+	jrn_log_rem(start, end);
+	plist_changed(pl, CHLOG_REMOVE, start, end, 0, NULL);
 
 	/* Free memory */
 	for ( i = start; i <= end; i ++ )
+	{
+		pq_remove_song(player_queue, pl->m_list[i]);
 		song_free(pl->m_list[i]);
+	}
 
 	/* Shift songs list and reallocate memory */
 	memmove(&pl->m_list[start], &pl->m_list[end + 1],
@@ -430,6 +460,78 @@ void plist_rem( plist_t *pl )
 	pmng_hook(player_pmng, "playlist");
 } /* End of 'plist_rem' function */
 
+/* Notify play list about a song info change */
+void plist_info_changed( plist_t *pl, song_t *song )
+{
+	static int hint = 0;
+	int i, index = -1;
+
+	plist_lock(pl);
+
+	/* Info is usually read in the list order, so start searching near
+	 * the previous found song */
+	if (hint >= pl->m_len)
+		hint = 0;
+	for ( i = 0; i < pl->m_len; i ++ )
+	{
+		int j = (hint + i) % pl->m_len;
+		if (pl->m_list[j] == song)
+		{
+			index = j;
+			break;
+		}
+	}
+	if (index >= 0)
+	{
+		hint = index;
+		plist_changed(pl, CHLOG_INFO, index, index, 0, NULL);
+	}
+	plist_unlock(pl);
+
+	if (index >= 0)
+		pmng_hook(player_pmng, "playlist-info");
+} /* End of 'plist_info_changed' function */
+
+/* Register a play list change. Play list must be locked */
+void plist_changed( plist_t *pl, chlog_type_t type, int start, int end,
+		int to, int *transform )
+{
+	pl->m_version++;
+	chlog_add(pl->m_changes, pl->m_version, type, start, end, to, transform);
+} /* End of 'plist_changed' function */
+
+/* Set current song */
+void plist_set_cur_song( plist_t *pl, int song )
+{
+	plist_lock(pl);
+	if (pl->m_cur_song != song)
+	{
+		pl->m_cur_song = song;
+		plist_changed(pl, CHLOG_CUR_SONG, song, song, 0, NULL);
+	}
+	plist_unlock(pl);
+} /* End of 'plist_set_cur_song' function */
+
+/* Find song index in the play list */
+int plist_find_song( plist_t *pl, song_t *song )
+{
+	int i, pos = -1;
+
+	assert(pl);
+
+	plist_lock(pl);
+	for ( i = 0; i < pl->m_len; i ++ )
+	{
+		if (pl->m_list[i] == song)
+		{
+			pos = i;
+			break;
+		}
+	}
+	plist_unlock(pl);
+	return pos;
+} /* End of 'plist_find_song' function */
+
 /* Search for string */
 bool_t plist_search( plist_t *pl, char *pstr, int dir, int criteria )
 {
@@ -596,16 +698,13 @@ void plist_display( plist_t *pl, wnd_t *wnd )
 			song_t *s = pl->m_list[j];
 			char len[10];
 			int x;
-			int queueList;
+			int queue_pos = pq_get_pos(player_queue, s);
 			
 			wnd_move(wnd, 0, 0, pl->m_start_pos + i);
 			wnd_printf(wnd, WND_PRINT_ELLIPSES, WND_WIDTH(wnd) - 8, 
 					"%i. %s", j + 1, STR_TO_CPTR(s->m_title));
-			for(queueList=0;queueList<num_queued_songs;queueList++)
-			{
-				if(queued_songs[queueList] == j)
-					wnd_printf(wnd, 0, 0, "    #%i in queue...", queueList+1);
-			}
+			if (queue_pos >= 0)
+				wnd_printf(wnd, 0, 0, "    #%i in queue...", queue_pos + 1);
 			int l = TIME_TO_SECONDS(s->m_len);
 			sprintf(len, "%i:%02i", l / 60, l % 60);
 			wnd_move(wnd, WND_MOVE_ADVANCE, WND_WIDTH(wnd) - strlen(len) - 1, 
@@ -650,6 +749,25 @@ void plist_unlock( plist_t *pl )
 	pthread_mutex_unlock(&pl->m_mutex);
 } /* End of 'plist_unlock' function */
 
+/* Hold play list. Songs appended by other threads wait until it is
+ * released */
+void plist_hold( plist_t *pl )
+{
+	plist_lock(pl);
+	pl->m_held = TRUE;
+	pl->m_holder = pthread_self();
+	plist_unlock(pl);
+} /* End of 'plist_hold' function */
+
+/* Release held play list */
+void plist_release( plist_t *pl )
+{
+	plist_lock(pl);
+	pl->m_held = FALSE;
+	pthread_cond_broadcast(&pl->m_hold_cond);
+	plist_unlock(pl);
+} /* End of 'plist_release' function */
+
 /* Move selection in play list */
 void plist_move_sel( plist_t *pl, int y, bool_t relative )
 {
@@ -691,6 +809,8 @@ void plist_move_sel( plist_t *pl, int y, bool_t relative )
 		undo->m_data.m_move_plist.m_to = y;
 		undo_add(player_ul, undo);
 	}
+	jrn_log_move(start, end, y);
+	plist_changed(pl, CHLOG_MOVE, start, end, y, NULL);
 
 	/* Move */
 	if (y - start < 0)
@@ -874,6 +994,9 @@ static plp_status_t plist_add_playlist_item( void *ctxv, char *name, song_metada
 		return PLP_STATUS_OK;
 	}
 
+	/* Extension probing below relies on the extensions list */
+	pmng_wait_media_exts(player_pmng);
+
 	/* Get full path relative to the play list if it is not absolute */
 	char *full_name = name;
 	if ((*name) != '/')
@@ -921,8 +1044,17 @@ finish:
 	return ret;
 } /* End of 'plist_add_playlist_item' function */
 
+static void plist_batch_push( plist_batch_t *batch, song_t *song );
+
 void plist_add_song( plist_t *pl, song_t *song, int where )
 {
+	/* Background scan */
+	if (pl->m_batch)
+	{
+		plist_batch_push(pl->m_batch, song);
+		return;
+	}
+
 	/* Lock play list */
 	plist_lock(pl);
 
@@ -943,6 +1075,8 @@ void plist_add_song( plist_t *pl, song_t *song, int where )
 			sizeof(song_t *) * (pl->m_len - where));
 	pl->m_list[where] = song;
 	pl->m_len ++;
+	plist_changed(pl, CHLOG_INSERT, where, 1, 0, NULL);
+	jrn_log_add(song, where);
 
 	/* Update current song index */
 	if (pl->m_cur_song >= where)
@@ -959,6 +1093,88 @@ void plist_add_song( plist_t *pl, song_t *song, int where )
 	plist_unlock(pl);
 }
 
+/* Append a number of songs to the end of play list */
+void plist_append_songs( plist_t *pl, song_t **songs, int num )
+{
+	if (num <= 0)
+		return;
+
+	plist_lock(pl);
+	while (pl->m_held && !pthread_equal(pl->m_holder, pthread_self()))
+		pthread_cond_wait(&pl->m_hold_cond, &pl->m_mutex);
+	song_t **list = (song_t **)realloc(pl->m_list, 
+			sizeof(song_t *) * (pl->m_len + num));
+	if (list == NULL)
+	{
+		plist_unlock(pl);
+		for ( int i = 0; i < num; i ++ )
+			song_free(songs[i]);
+		return;
+	}
+	pl->m_list = list;
+	memcpy(&pl->m_list[pl->m_len], songs, sizeof(song_t *) * num);
+	for ( int i = 0; i < num; i ++ )
+		jrn_log_add(songs[i], pl->m_len + i);
+
+	/* If list was empty - put cursor to the first song */
+	if (!pl->m_len)
+	{
+		pl->m_sel_start = pl->m_sel_end = 0;
+		pl->m_visual = FALSE;
+	}
+	plist_changed(pl, CHLOG_INSERT, pl->m_len, num, 0, NULL);
+	pl->m_len += num;
+	plist_unlock(pl);
+} /* End of 'plist_append_songs' function */
+
+/* Append collected songs to the target play list */
+static void plist_batch_flush( plist_batch_t *batch )
+{
+	if (!batch->m_num)
+		return;
+
+	/* Info reader holds its own references, so songs may be pushed
+	 * before they get to the list */
+	for ( int i = 0; i < batch->m_num; i ++ )
+	{
+		song_t *s = batch->m_songs[i];
+		if (s->m_flags & SONG_SCHEDULE)
+		{
+			irw_push(s, SONG_INFO_READ);
+			s->m_flags &= (~SONG_SCHEDULE);
+		}
+	}
+	plist_append_songs(batch->m_target, batch->m_songs, batch->m_num);
+	batch->m_added += batch->m_num;
+	batch->m_num = 0;
+
+	pmng_hook(player_pmng, "playlist");
+	if (batch->m_progress)
+		batch->m_progress(batch, batch->m_ctx);
+} /* End of 'plist_batch_flush' function */
+
+/* Put song to batch */
+static void plist_batch_push( plist_batch_t *batch, song_t *song )
+{
+	if (batch->m_num >= batch->m_size)
+	{
+		int size = batch->m_size ? batch->m_size * 2 : PLIST_BATCH_SIZE;
+		song_t **songs = (song_t **)realloc(batch->m_songs, 
+				sizeof(song_t *) * size);
+		if (songs == NULL)
+		{
+			song_free(song);
+			return;
+		}
+		batch->m_songs = songs;
+		batch->m_size = size;
+	}
+	batch->m_songs[batch->m_num++] = song;
+
+	if (batch->m_num >= PLIST_BATCH_SIZE)
+		plist_batch_flush(batch);
+} /* End of 'plist_batch_push' function */
+
 static plist_plugin_t *is_playlist(char *file)
 {
 	plist_plugin_t *plp = pmng_is_playlist_prefix(player_pmng, file);
@@ -1099,6 +1315,8 @@ static int plist_add_dir( plist_t *pl, char *dir_path )
 		/* Skip everything except for playlist in the smart-add mode */
 		if (only_idx != -1 && only_idx != i)
 			goto finally;
+		if (PLIST_CANCELLED(pl))
+			goto finally;
 
 		if (fu_is_special_dir(name))
 			goto finally;
@@ -1169,16 +1387,13 @@ static int plist_add_path( plist_t *pl, char *path )
 	return res;
 }
 
-/* Add a set of files to play list */
-bool_t plist_add_set( plist_t *pl, plist_set_t *set )
+/* Add files of a set */
+static int plist_add_set_paths( plist_t *pl, plist_set_t *set )
 {
-	/* Do nothing if set is empty */
-	if (pl == NULL || set == NULL)
-		return FALSE;
-
 	int plist_num = 0;
 
-	for ( struct tag_plist_set_t *node = set->m_head; node; node = node->m_next )
+	for ( struct tag_plist_set_t *node = set->m_head; 
+			node && !PLIST_CANCELLED(pl); node = node->m_next )
 	{
 		/* glob patterns */
 		if (set->m_patterns && !fu_is_prefixed(node->m_name))
@@ -1187,7 +1402,8 @@ bool_t plist_add_set( plist_t *pl, plist_set_t *set )
 			if (glob(node->m_name, GLOB_TILDE, NULL, &gl))
 				continue;
 
-			for ( char **path = gl.gl_pathv; *path; ++path )
+			for ( char **path = gl.gl_pathv; *path && !PLIST_CANCELLED(pl); 
+					++path )
 				plist_num += plist_add_path(pl, *path);
 
 			globfree(&gl);
@@ -1196,6 +1412,17 @@ bool_t plist_add_set( plist_t *pl, plist_set_t *set )
 		else
 			plist_num += plist_add_path(pl, node->m_name);
 	}
+	return plist_num;
+} /* End of 'plist_add_set_paths' function */
+
+/* Add a set of files to play list */
+bool_t plist_add_set( plist_t *pl, plist_set_t *set )
+{
+	/* Do nothing if set is empty */
+	if (pl == NULL || set == NULL)
+		return FALSE;
+
+	int plist_num = plist_add_set_paths(pl, set);
 
 	/* Set info */
 	plist_flush_scheduled(pl);
@@ -1238,6 +1465,28 @@ bool_t plist_add_set( plist_t *pl, plist_set_t *set )
 	return TRUE;
 } /* End of 'plist_add_set' function */
 
+/* Add a set of files to play list by batches. This is meant for 
+ * background threads; no undo information is stored. Returns number
+ * of songs added */
+int plist_add_set_batched( plist_t *pl, plist_set_t *set, 
+		plist_batch_t *batch )
+{
+	/* Songs are found using a list of its own which passes them to 
+	 * batch */
+	plist_t *scan = plist_new(0);
+	if (scan == NULL)
+		return 0;
+	scan->m_batch = batch;
+	batch->m_target = pl;
+	batch->m_added = 0;
+
+	plist_add_set_paths(scan, set);
+	plist_batch_flush(batch);
+
+	plist_free(scan);
+	return batch->m_added;
+} /* End of 'plist_add_set_batched' function */
+
 /* Initialize a set of files for adding */
 plist_set_t *plist_set_new( bool_t patterns )
 {
@@ -26,6 +26,7 @@
 #include <pthread.h>
 #include "types.h"
 #include "main_types.h"
+#include "change_log.h"
 #include "plp.h"
 #include "song.h"
 #include "wnd.h"
@@ -44,6 +45,33 @@ typedef struct
 	} *m_head, *m_tail;
 } plist_set_t;
 
+/* Songs found by a background scan. They are appended to the target 
+ * play list by batches, so that it is locked only for a moment */
+typedef struct tag_plist_batch_t
+{
+	plist_t *m_target;
+
+	/* Songs not appended yet */
+	song_t **m_songs;
+	int m_num, m_size;
+
+	/* Number of songs appended so far */
+	int m_added;
+
+	/* Called after every appended batch */
+	void (*m_progress)( struct tag_plist_batch_t *batch, void *ctx );
+	void *m_ctx;
+
+	/* Scan is stopped when this is set */
+	volatile bool_t m_cancel;
+} plist_batch_t;
+
+/* Number of songs appended at once */
+#define PLIST_BATCH_SIZE 256
+
+/* Check if background scan is cancelled */
+#define PLIST_CANCELLED(pl) ((pl)->m_batch && (pl)->m_batch->m_cancel)
+
 /* Get list height */
 #define PLIST_HEIGHT (WND_HEIGHT(player_wnd) - 5)
 
@@ -87,6 +115,12 @@ bool_t plist_add( plist_t *pl, char *filename );
 /* Add a set of files to play list */
 bool_t plist_add_set( plist_t *pl, plist_set_t *set );
 
+/* Add a set of files to play list by batches. This is meant for 
+ * background threads; no undo information is stored. Returns number
+ * of songs added */
+int plist_add_set_batched( plist_t *pl, plist_set_t *set, 
+		plist_batch_t *batch );
+
 /* Add single file to play list */
 int plist_add_one_file( plist_t *pl, char *file, song_metadata_t *metadata,
 		int where, int recc_level );
@@ -96,6 +130,10 @@ int plist_add_plist( plist_t *pl, plist_plugin_t *plp, char *file, int recc_leve
 
 void plist_add_song( plist_t *pl, song_t *song, int where );
 
+/* Append a number of songs to the end of play list. Waits if play list
+ * is held by another thread */
+void plist_append_songs( plist_t *pl, song_t **songs, int num );
+
 /* Add M3U play list */
 int plist_add_m3u( plist_t *pl, char *filename );
 
@@ -126,6 +164,19 @@ void plist_rem( plist_t *pl );
 /* Clear play list */
 void plist_clear( plist_t *pl );
 
+/* Find song index in the play list */
+int plist_find_song( plist_t *pl, song_t *song );
+
+/* Notify play list about a song info change */
+void plist_info_changed( plist_t *pl, song_t *song );
+
+/* Register a play list change. Play list must be locked */
+void plist_changed( plist_t *pl, chlog_type_t type, int start, int end,
+		int to, int *transform );
+
+/* Set current song */
+void plist_set_cur_song( plist_t *pl, int song );
+
 /* Search for string */
 bool_t plist_search( plist_t *pl, char *str, int dir, int criteria );
 
@@ -147,6 +198,13 @@ void plist_lock( plist_t *pl );
 /* Unlock play list */
 void plist_unlock( plist_t *pl );
 
+/* Hold play list while doing a number of operations. Songs appended by
+ * other threads wait until it is released */
+void plist_hold( plist_t *pl );
+
+/* Release held play list */
+void plist_release( plist_t *pl );
+
 /* Add an object */
 int plist_add_obj( plist_t *pl, char *name, char *title, int where );
 
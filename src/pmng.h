@@ -23,6 +23,7 @@
 #ifndef __SG_MPFC_PMNG_H__
 #define __SG_MPFC_PMNG_H__
 
+#include <pthread.h>
 #include "types.h"
 #include "cfg.h"
 #include "command.h"
@@ -32,6 +33,28 @@
 #include "plugin.h"
 #include "wnd_types.h"
 
+/* Size of alphabet used in media file extensions */
+#define PMNG_EXT_ALPHABET 40
+
+/* Media file extensions trie (case-insensitive) */
+typedef struct
+{
+	struct tag_pmng_ext_trie_node_t
+	{
+		/* Child nodes indices (0 if there is no child) */
+		unsigned short m_next[PMNG_EXT_ALPHABET];
+
+		/* Does an extension end here? */
+		bool_t m_terminal;
+	} *m_nodes;
+	int m_num_nodes, m_allocated;
+
+	/* Extensions list. Those with characters outside of the alphabet
+	 * are not in the trie and are searched here */
+	const char *m_exts;
+	bool_t m_has_others;
+} pmng_ext_trie_t;
+
 /* Plugin manager type */
 typedef struct tag_pmng_t
 {
@@ -64,6 +87,15 @@ typedef struct tag_pmng_t
 	/* The list of supported media file extensions */
 	char *m_media_file_exts;
 	unsigned m_media_ext_max_len;
+
+	/* Extensions lookup structure */
+	pmng_ext_trie_t m_media_exts_trie;
+
+	/* Extensions list may be built asynchronously; these are used
+	 * to wait for it */
+	volatile bool_t m_media_exts_ready;
+	pthread_mutex_t m_media_exts_mutex;
+	pthread_cond_t m_media_exts_cond;
 } pmng_t;
 
 /* Initialize plugins */
@@ -75,6 +107,12 @@ void pmng_free( pmng_t *pmng );
 /* Load plugins */
 bool_t pmng_load_plugins( pmng_t *pmng );
 
+/* Build supported media file extensions list */
+bool_t pmng_fill_media_file_exts( pmng_t *pmng );
+
+/* Wait until media file extensions list is built */
+void pmng_wait_media_exts( pmng_t *pmng );
+
 /* Add a plugin */
 void pmng_add_plugin( pmng_t *pmng, plugin_t *p );
 
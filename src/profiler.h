@@ -0,0 +1,46 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Interface for startup profiler functions.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#ifndef __SG_MPFC_PROFILER_H__
+#define __SG_MPFC_PROFILER_H__
+
+#include <stdio.h>
+#include "types.h"
+
+/* Maximal number of spans collected */
+#define PROF_MAX_SPANS 128
+
+/* Start a timing span. Returns span handle */
+int prof_begin( const char *name );
+
+/* Finish a timing span */
+void prof_end( int span );
+
+/* Add a zero-length span marking a moment */
+void prof_mark( const char *name );
+
+/* Print collected spans */
+void prof_print( FILE *fd );
+
+#endif
+
+/* End of 'profiler.h' file */
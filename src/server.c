@@ -21,38 +21,139 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include "cfg.h"
+#include "info_rw_thread.h"
 #include "pmng.h"
 #include "player.h"
 #include "rd_with_notify.h"
+#include "server.h"
 #include "server_client.h"
+#include "server_stats.h"
+#include "util.h"
+
+/* Maximal number of events handled at once */
+#define SERVER_MAX_EVENTS 64
+
+/* Default connections limit and listen backlog */
+#define SERVER_DEF_MAX_CONNS 64
+#define SERVER_DEF_BACKLOG 16
+
+/* Default maximal command length and initial input buffer size */
+#define SERVER_DEF_MAX_CMD_SIZE (1024 * 1024)
+#define SERVER_INITIAL_IN_SIZE 4096
+
+/* How many maximal commands may be sent ahead while waiting */
+#define SERVER_WAIT_CMD_FACTOR 8
+
+/* Default maximal unsent output of a client */
+#define SERVER_DEF_MAX_OUTPUT (16 * 1024 * 1024)
+
+/* Check if connection commands must wait for the main thread */
+#define SERVER_CONN_WAITS(d) ((d)->m_call || server_num_exclusive_calls)
 
 int server_socket = -1;
+
+/* Local socket and its path */
+int server_unix_socket = -1;
+char *server_unix_path = NULL;
 pthread_t server_tid = -1;
 
+/* Notification pipe; its fd is the listening socket */
 rd_with_notify_t *server_rdwn = NULL;
 
+/* Notifications posted to the server thread (bit per code). Pipe is 
+ * written only to wake the thread up */
+unsigned server_pending = 0;
+
+int server_epoll = -1;
+
+/* Play time notifications timer and its current interval */
+int server_timer = -1;
+int server_timer_interval = 0;
+
 server_conn_desc_t *server_conns = NULL;
+int server_num_conns = 0;
+int server_max_conns = SERVER_DEF_MAX_CONNS;
+int server_max_cmd_size = SERVER_DEF_MAX_CMD_SIZE;
+int server_max_output = SERVER_DEF_MAX_OUTPUT;
 
 int server_hook_id = -1;
 
-pthread_mutex_t server_mutex = PTHREAD_MUTEX_INITIALIZER;
+dcache_t *server_dir_cache = NULL;
 
-static void *server_thread( void * );
-static void *server_conn_thread( void * );
+/* Commands executed by the main thread and waiting for their responses
+ * to be sent */
+server_call_t *server_done_calls = NULL;
+pthread_mutex_t server_calls_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static void server_conn_notify( server_conn_desc_t *conn, char nv );
+/* Number of exclusive calls in progress. Until they are done clients
+ * commands are not executed and notifications are postponed */
+int server_num_exclusive_calls = 0;
+
+/* Background add job */
+typedef struct tag_server_job_t
+{
+	int m_id;
+	char *m_path;
+
+	/* Client which has started the job (NULL if it has gone) */
+	server_conn_desc_t *m_conn;
+
+	/* Songs are added through this */
+	plist_batch_t m_batch;
+
+	/* Job is over */
+	bool_t m_finished;
+
+	/* What client has been told */
+	int m_reported_added;
+	bool_t m_reported_finished;
+
+	struct tag_server_job_t *m_next;
+} server_job_t;
+
+/* Jobs list is shared with the job threads */
+server_job_t *server_jobs = NULL;
+int server_last_job_id = 0;
+int server_num_running_jobs = 0;
+bool_t server_jobs_stopped = FALSE;
+pthread_mutex_t server_jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t server_jobs_cond = PTHREAD_COND_INITIALIZER;
+
+static void *server_thread( void * );
 
 static void server_hook_handler( char *hook );
 
+static void server_unix_close( bool_t remove );
+
+static void server_post_notify( char nv );
+
+static void server_call_free( server_call_t *call );
+
+static void server_job_free( server_job_t *job );
+
+/* Make descriptor non-blocking */
+static bool_t server_set_nonblock( int fd )
+{
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1)
+		return FALSE;
+	return (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+} /* End of 'server_set_nonblock' function */
+
 /* Create a new connection descriptor */
 server_conn_desc_t *server_conn_desc_new( int sock )
 {
@@ -65,44 +166,67 @@ server_conn_desc_t *server_conn_desc_new( int sock )
 	}
 
 	conn_desc->m_socket = sock;
-	conn_desc->m_buf[0] = 0;
-	conn_desc->m_cur_cmd = str_new("");
-	if (!conn_desc->m_cur_cmd)
-	{
-		free(conn_desc);
-		logger_error(player_log, 0, _("No enough memory!"));
-		return NULL;
-	}
-
-	conn_desc->m_rdwn = rd_with_notify_new(sock);
-	if (!conn_desc->m_rdwn)
+	conn_desc->m_in = NULL;
+	conn_desc->m_in_len = conn_desc->m_in_scanned = conn_desc->m_in_size = 0;
+	conn_desc->m_out = NULL;
+	conn_desc->m_out_len = conn_desc->m_out_pos = conn_desc->m_out_size = 0;
+	conn_desc->m_events = EPOLLIN;
+	conn_desc->m_closing = FALSE;
+	conn_desc->m_dead = FALSE;
+	conn_desc->m_notify_pending = 0;
+	conn_desc->m_protocol = 1;
+	conn_desc->m_responding = FALSE;
+	conn_desc->m_changes_subscribed = FALSE;
+	conn_desc->m_changes_version = 0;
+	conn_desc->m_time_interval = 0;
+	conn_desc->m_time_next = 0;
+	conn_desc->m_time_sent = -1;
+	conn_desc->m_time_song = -1;
+	conn_desc->m_call = NULL;
+
+	/* Register in the event loop */
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = conn_desc->m_events;
+	ev.data.ptr = conn_desc;
+	if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, sock, &ev) == -1)
 	{
 		logger_error(player_log, 0,
-				_("Connection notification pipe create failed: %s"),
+				_("Connection registration failed: %s"),
 				strerror(errno));
-		str_free(conn_desc->m_cur_cmd);
 		free(conn_desc);
 		return NULL;
 	}
 
 	/* List management */
-	pthread_mutex_lock(&server_mutex);
 	conn_desc->m_prev = NULL;
 	conn_desc->m_next = server_conns;
 	if (server_conns)
 		server_conns->m_prev = conn_desc;
 	server_conns = conn_desc;
-	pthread_mutex_unlock(&server_mutex);
+	server_num_conns++;
+	server_stats.m_connections++;
 	return conn_desc;
 } /* End of 'server_conn_desc_new' function */
 
 /* Free connection descriptor */
 void server_conn_desc_free( server_conn_desc_t *conn_desc )
 {
-	pthread_mutex_lock(&server_mutex);
+	/* Jobs go on without client */
+	pthread_mutex_lock(&server_jobs_mutex);
+	for ( server_job_t *job = server_jobs; job; job = job->m_next )
+	{
+		if (job->m_conn == conn_desc)
+			job->m_conn = NULL;
+	}
+	pthread_mutex_unlock(&server_jobs_mutex);
+
+	epoll_ctl(server_epoll, EPOLL_CTL_DEL, conn_desc->m_socket, NULL);
 	close(conn_desc->m_socket);
-	str_free(conn_desc->m_cur_cmd);
-	rd_with_notify_free(conn_desc->m_rdwn);
+	if (conn_desc->m_in)
+		free(conn_desc->m_in);
+	if (conn_desc->m_out)
+		free(conn_desc->m_out);
 
 	/* List management */
 	if (conn_desc->m_prev)
@@ -111,15 +235,105 @@ void server_conn_desc_free( server_conn_desc_t *conn_desc )
 		conn_desc->m_next->m_prev = conn_desc->m_prev;
 	if (conn_desc == server_conns)
 		server_conns = conn_desc->m_next;
+	server_num_conns--;
 
 	free(conn_desc);
-	pthread_mutex_unlock(&server_mutex);
 } /* End of 'server_conn_desc_free' function */
 
+/* Create local socket. Failure here is not fatal: network port is still
+ * there */
+static void server_unix_listen( int backlog )
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	struct epoll_event ev;
+	bool_t bound = FALSE;
+
+	char *path = cfg_get_var(cfg_list, "server-socket-path");
+	if (path && *path)
+		server_unix_path = strdup(path);
+	else
+		server_unix_path = util_strcat(getenv("HOME"), "/.mpfc/server.sock", 
+				NULL);
+	if (!server_unix_path)
+		return;
+	if (strlen(server_unix_path) >= sizeof(addr.sun_path))
+	{
+		logger_error(player_log, 0, _("Server socket path %s is too long"),
+				server_unix_path);
+		goto failed;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, server_unix_path);
+
+	server_unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_unix_socket == -1)
+		goto sys_failed;
+
+	/* Socket left by a crashed player is removed; the one of a running 
+	 * player is not */
+	if (lstat(server_unix_path, &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		if (connect(server_unix_socket, (struct sockaddr *)&addr, 
+					sizeof(addr)) == 0)
+		{
+			logger_error(player_log, 0, 
+					_("Server socket %s is used by another player"),
+					server_unix_path);
+			goto failed;
+		}
+		unlink(server_unix_path);
+	}
+
+	if (bind(server_unix_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		goto sys_failed;
+	bound = TRUE;
+	chmod(server_unix_path, S_IRUSR | S_IWUSR);
+	if (listen(server_unix_socket, backlog) == -1 ||
+			!server_set_nonblock(server_unix_socket))
+		goto sys_failed;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &server_unix_socket;
+	if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, server_unix_socket, &ev) == -1)
+		goto sys_failed;
+
+	logger_message(player_log, 0, _("Server listening at %s"), 
+			server_unix_path);
+	return;
+
+sys_failed:
+	logger_error(player_log, 0, _("Server socket %s setup failed: %s"),
+			server_unix_path, strerror(errno));
+failed:
+	server_unix_close(bound);
+} /* End of 'server_unix_listen' function */
+
+/* Close local socket */
+static void server_unix_close( bool_t remove )
+{
+	if (server_unix_socket != -1)
+	{
+		close(server_unix_socket);
+		server_unix_socket = -1;
+		if (remove)
+			unlink(server_unix_path);
+	}
+	if (server_unix_path)
+	{
+		free(server_unix_path);
+		server_unix_path = NULL;
+	}
+} /* End of 'server_unix_close' function */
+
 /* Start the server */
 bool_t server_start( void )
 {
 	struct sockaddr_in addr;
+	struct epoll_event ev;
 	int err, i;
 
 	int server_port = cfg_get_var_int(cfg_list, "server-port");
@@ -130,6 +344,31 @@ bool_t server_start( void )
 	if (!server_port_pool_size)
 		server_port_pool_size = 10;
 
+	int server_backlog = cfg_get_var_int(cfg_list, "server-backlog");
+	if (server_backlog <= 0)
+		server_backlog = SERVER_DEF_BACKLOG;
+
+	server_max_conns = cfg_get_var_int(cfg_list, "server-max-connections");
+	if (server_max_conns <= 0)
+		server_max_conns = SERVER_DEF_MAX_CONNS;
+
+	server_max_cmd_size = cfg_get_var_int(cfg_list, "server-max-command-size");
+	if (server_max_cmd_size <= 0)
+		server_max_cmd_size = SERVER_DEF_MAX_CMD_SIZE;
+
+	server_max_output = cfg_get_var_int(cfg_list, "server-max-output");
+	if (server_max_output <= 0)
+		server_max_output = SERVER_DEF_MAX_OUTPUT;
+
+	server_stats_reset();
+	server_dir_cache = dcache_new(cfg_get_var_int(cfg_list, 
+				"server-dir-cache-size"));
+	if (!server_dir_cache)
+	{
+		logger_error(player_log, 0, _("No enough memory!"));
+		return FALSE;
+	}
+
 	logger_message(player_log, 0, _("Starting the server at port %d"), server_port);
 
 	/* Create socket */
@@ -161,7 +400,8 @@ bind_succeeded:
 	logger_message(player_log, 0, _("Server listening at port %d"), server_port);
 
 	/* Listen */
-	if (listen(server_socket, 5) == -1)
+	if (listen(server_socket, server_backlog) == -1 ||
+			!server_set_nonblock(server_socket))
 	{
 		logger_error(player_log, 0,
 				_("Server socket listen failed: %s"),
@@ -169,9 +409,11 @@ bind_succeeded:
 		goto failed;
 	}
 
-	/* Create rdwn */
+	/* Create rdwn. Pipe is non-blocking on both ends: it is read until
+	 * it is empty and writers never wait */
 	server_rdwn = rd_with_notify_new(server_socket);
-	if (!server_rdwn)
+	if (!server_rdwn || !server_set_nonblock(RDWN_NOTIFY_READ_FD(server_rdwn)) ||
+			!server_set_nonblock(RDWN_NOTIFY_WRITE_FD(server_rdwn)))
 	{
 		logger_error(player_log, 0,
 				_("Server notification pipe create failed: %s"),
@@ -179,6 +421,39 @@ bind_succeeded:
 		goto failed;
 	}
 
+	/* Create event loop. Listening socket and notification pipe are told
+	 * from connections by their data pointers */
+	server_epoll = epoll_create1(0);
+	if (server_epoll == -1)
+	{
+		logger_error(player_log, 0,
+				_("Server event loop create failed: %s"),
+				strerror(errno));
+		goto failed;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &server_socket;
+	if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, server_socket, &ev) == -1)
+		goto epoll_failed;
+	ev.data.ptr = server_rdwn;
+	if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, 
+				RDWN_NOTIFY_READ_FD(server_rdwn), &ev) == -1)
+		goto epoll_failed;
+
+	/* Timer for play time notifications. It is armed only when some 
+	 * client wants them more often than the time hook comes */
+	server_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (server_timer == -1)
+		goto epoll_failed;
+	ev.data.ptr = &server_timer;
+	if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, server_timer, &ev) == -1)
+		goto epoll_failed;
+
+	/* Local socket for clients on the same machine */
+	if (cfg_get_var_bool(cfg_list, "server-unix-socket"))
+		server_unix_listen(server_backlog);
+
 	/* Start the main thread */
 	err = pthread_create(&server_tid, NULL, server_thread, NULL);
 	if (err)
@@ -194,7 +469,22 @@ bind_succeeded:
 
 	return TRUE;
 
+epoll_failed:
+	logger_error(player_log, 0,
+			_("Server event loop setup failed: %s"),
+			strerror(errno));
 failed:
+	server_unix_close(TRUE);
+	if (server_timer != -1)
+	{
+		close(server_timer);
+		server_timer = -1;
+	}
+	if (server_epoll != -1)
+	{
+		close(server_epoll);
+		server_epoll = -1;
+	}
 	if (server_socket != -1)
 	{
 		close(server_socket);
@@ -205,6 +495,8 @@ failed:
 		rd_with_notify_free(server_rdwn);
 		server_rdwn = NULL;
 	}
+	dcache_free(server_dir_cache);
+	server_dir_cache = NULL;
 	return FALSE;
 } /* End of 'server_start' function */
 
@@ -217,218 +509,936 @@ void server_stop( void )
 	/* Uninstall hook handler */
 	pmng_remove_hook_handler(player_pmng, server_hook_id);
 
-	/* Notify the thread about exit */
-	char val = 0;
-	write(RDWN_NOTIFY_WRITE_FD(server_rdwn), &val, 1);
+	/* Jobs post notifications, so they are stopped first */
+	server_stop_jobs();
+
+	/* Notify the thread about exit. It closes the connections */
+	server_post_notify(SERVER_NOTIFY_EXIT);
 	pthread_join(server_tid, NULL);
 
-	/* Close connections */
-	for ( ;; )
-	{
-		pthread_mutex_lock(&server_mutex);
-		if (server_conns)
-		{
-			pthread_t tid = server_conns->m_tid;
-			server_conn_notify(server_conns, SERVER_NOTIFY_EXIT);
-			pthread_mutex_unlock(&server_mutex);
-
-			pthread_join(tid, NULL);
-		}
-		else
-		{
-			pthread_mutex_unlock(&server_mutex);
-			break;
-		}
-	}
+	/* Close event loop */
+	close(server_timer);
+	server_timer = -1;
+	server_timer_interval = 0;
+	close(server_epoll);
+	server_epoll = -1;
 
 	/* Close pipe */
 	rd_with_notify_free(server_rdwn);
 	server_rdwn = NULL;
 
-	/* Close socket */
+	/* Free results nobody waits for */
+	while (server_done_calls)
+	{
+		server_call_t *next = server_done_calls->m_next;
+		server_call_free(server_done_calls);
+		server_done_calls = next;
+	}
+	while (server_jobs)
+	{
+		server_job_t *next = server_jobs->m_next;
+		server_job_free(server_jobs);
+		server_jobs = next;
+	}
+	dcache_free(server_dir_cache);
+	server_dir_cache = NULL;
+
+	/* Close sockets */
 	close(server_socket);
 	server_socket = -1;
-
-	pthread_mutex_destroy(&server_mutex);
+	server_unix_close(TRUE);
 } /* End of 'server_stop' function */
 
-/* The main server thread function
- * It is responsible for accepting connections and launching 
- * per-connection threads */
-static void *server_thread( void *p )
+/* Send progress of the connection jobs */
+static void server_conn_notify_jobs( server_conn_desc_t *conn )
+{
+	pthread_mutex_lock(&server_jobs_mutex);
+	for ( server_job_t *job = server_jobs; job; job = job->m_next )
+	{
+		if (job->m_conn != conn || job->m_reported_finished)
+			continue;
+
+		/* Finished flag is read first, so that the number is final */
+		bool_t finished = __atomic_load_n(&job->m_finished, 
+				__ATOMIC_ACQUIRE);
+		int added = __atomic_load_n(&job->m_batch.m_added, 
+				__ATOMIC_RELAXED);
+		if (!finished && added == job->m_reported_added)
+			continue;
+
+		const char *state = "running";
+		if (finished)
+			state = (job->m_batch.m_cancel ? "cancelled" : "done");
+		server_conn_notify_job(conn, job->m_id, added, state);
+		job->m_reported_added = added;
+		job->m_reported_finished = finished;
+	}
+	pthread_mutex_unlock(&server_jobs_mutex);
+} /* End of 'server_conn_notify_jobs' function */
+
+/* Put notification to connection output */
+static void server_conn_deliver( server_conn_desc_t *conn, int nv )
 {
+	if (nv == SERVER_NOTIFY_TIME)
+		server_conn_notify_time(conn);
+	else if (nv == SERVER_NOTIFY_JOBS)
+		server_conn_notify_jobs(conn);
+	else
+		server_conn_client_notify(conn, nv);
+} /* End of 'server_conn_deliver' function */
+
+/* Send notification to connection. If client doesn't read its output
+ * or waits for a command being executed notification is postponed; 
+ * same notifications are merged then */
+static void server_conn_post( server_conn_desc_t *conn, int nv )
+{
+	if ((conn->m_events & EPOLLOUT) || conn->m_call || 
+			server_num_exclusive_calls)
+		conn->m_notify_pending |= SERVER_NOTIFY_BIT(nv);
+	else
+		server_conn_deliver(conn, nv);
+} /* End of 'server_conn_post' function */
+
+/* Change events connection is waiting for */
+static void server_conn_set_events( server_conn_desc_t *conn, 
+		uint32_t events )
+{
+	struct epoll_event ev;
+
+	if (events == conn->m_events)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = conn;
+	if (epoll_ctl(server_epoll, EPOLL_CTL_MOD, conn->m_socket, &ev) == -1)
+		conn->m_dead = TRUE;
+	else
+		conn->m_events = events;
+} /* End of 'server_conn_set_events' function */
+
+/* Write out as much of connection output as socket accepts */
+void server_conn_flush( server_conn_desc_t *conn )
+{
+	if (conn->m_dead)
+		return;
+
+	/* Connection belongs to the main thread until its command is done.
+	 * Client is not read meanwhile */
+	if (conn->m_call)
+	{
+		server_conn_set_events(conn, 0);
+		return;
+	}
+
 	for ( ;; )
 	{
-		/* Wait for input */
-		int retv = rd_with_notify_wait(server_rdwn);
-		if (!retv)
+		while (conn->m_out_pos < conn->m_out_len)
 		{
-			logger_error(player_log, 0,
-					_("Server select failed: %s"),
-					strerror(errno));
-			return NULL;
+			ssize_t sent = send(conn->m_socket, &conn->m_out[conn->m_out_pos],
+					conn->m_out_len - conn->m_out_pos, MSG_NOSIGNAL);
+			if (sent < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				logger_debug(player_log, "Error sending response");
+				conn->m_dead = TRUE;
+				return;
+			}
+			conn->m_out_pos += sent;
+			server_stats.m_bytes_out += sent;
 		}
+		if (conn->m_out_pos < conn->m_out_len)
+			break;
 
-		/* Exit */
-		if (retv & RDWN_NOTIFY_READY)
+		/* Everything is sent */
+		conn->m_out_pos = conn->m_out_len = 0;
+		if (conn->m_closing)
+		{
+			conn->m_dead = TRUE;
+			return;
+		}
+
+		/* Deliver notifications postponed while client was not reading
+		 * unless they would get inside a response or exclusive call is
+		 * not done yet */
+		if (!conn->m_notify_pending || conn->m_responding ||
+				server_num_exclusive_calls)
+			break;
+		unsigned pending = conn->m_notify_pending;
+		conn->m_notify_pending = 0;
+		for ( int nv = 0; pending; nv++, pending >>= 1 )
+		{
+			if (pending & 1)
+				server_conn_deliver(conn, nv);
+		}
+		if (conn->m_dead)
+			return;
+	}
+
+	/* Wait for socket to become writable only while there is something
+	 * to write */
+	uint32_t events = EPOLLIN;
+	if (conn->m_out_len)
+		events |= EPOLLOUT;
+	server_conn_set_events(conn, events);
+} /* End of 'server_conn_flush' function */
+
+/* Parse and execute input from client. Complete commands are executed
+ * right in the input buffer; incomplete one is kept for the next time.
+ * Parsing stops at command passed to the main thread and doesn't start
+ * until exclusive calls are done */
+bool_t server_conn_parse_input(server_conn_desc_t *d)
+{
+	char *start = d->m_in, *end = d->m_in + d->m_in_len;
+	char *p = d->m_in + d->m_in_scanned;
+	bool_t res = TRUE;
+
+	/* Extract commands */
+	while (res && !SERVER_CONN_WAITS(d))
+	{
+		p = memchr(p, '\n', end - p);
+		if (!p)
 			break;
 
-		/* Try to accept connection */
-		if (retv & RDWN_READ_READY)
+		char *next = p + 1;
+		if (p > start && p[-1] == '\r')
+			p--;
+		(*p) = 0;
+		res = server_conn_exec_command(d, start);
+		start = p = next;
+	}
+	if (!res)
+	{
+		d->m_in_len = d->m_in_scanned = 0;
+		return FALSE;
+	}
+
+	/* Client is not expected to send commands this long. Input left 
+	 * after a command passed to the main thread is not scanned yet,
+	 * but it can't pile up forever too */
+	size_t left = end - start;
+	size_t max_left = (size_t)server_max_cmd_size;
+	if (SERVER_CONN_WAITS(d))
+		max_left *= SERVER_WAIT_CMD_FACTOR;
+	if (left > max_left)
+	{
+		logger_debug(player_log, "Command is too long; dropping client");
+		d->m_in_len = d->m_in_scanned = 0;
+		return FALSE;
+	}
+
+	if (start != d->m_in)
+		memmove(d->m_in, start, left);
+	d->m_in_len = left;
+	d->m_in_scanned = (SERVER_CONN_WAITS(d) ? 0 : left);
+	return TRUE;
+} /* End of 'server_conn_parse_input' function */
+
+/* Receive data from client. Returns FALSE if connection is closed */
+static bool_t server_conn_recv( server_conn_desc_t *conn )
+{
+	/* Make room for the data */
+	if (conn->m_in_size - conn->m_in_len < SERVER_INITIAL_IN_SIZE / 2)
+	{
+		size_t size = conn->m_in_size ? conn->m_in_size * 2 : 
+			SERVER_INITIAL_IN_SIZE;
+		char *in = (char *)realloc(conn->m_in, size);
+		if (!in)
 		{
-			server_conn_desc_t *conn_desc = NULL;
-			int conn_socket = -1;
-			int err;
+			logger_error(player_log, 0, _("No enough memory!"));
+			return FALSE;
+		}
+		conn->m_in = in;
+		conn->m_in_size = size;
+	}
 
-			conn_socket = accept(server_socket, NULL, NULL);
-			if (conn_socket == -1)
-			{
-				logger_error(player_log, 0,
-						_("Server socket accept failed: %s"),
-						strerror(errno));
-				goto failure;
-			}
+	ssize_t sz = recv(conn->m_socket, &conn->m_in[conn->m_in_len],
+			conn->m_in_size - conn->m_in_len, 0);
+	if (sz == 0)
+		return FALSE;
+	else if (sz < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+	/* Input is ignored after 'bye' */
+	if (conn->m_closing)
+		return TRUE;
+
+	server_stats.m_bytes_in += sz;
+	conn->m_in_len += sz;
+	if (!server_conn_parse_input(conn))
+		conn->m_closing = TRUE;
+	return TRUE;
+} /* End of 'server_conn_recv' function */
 
-			logger_message(player_log, 0, _("Received a connection"));
+/* Check that local client is run by the same user (or root) */
+static bool_t server_check_peer( int sock )
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
 
-			/* Start the connection thread */
-			conn_desc = server_conn_desc_new(conn_socket);
-			if (!conn_desc)
-			{
-				close(conn_socket);
-				goto failure;
-			}
-			err = pthread_create(&conn_desc->m_tid, NULL,
-					server_conn_thread, conn_desc);
-			if (err)
-			{
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+	{
+		logger_error(player_log, 0,
+				_("Unable to get local client credentials: %s"),
+				strerror(errno));
+		return FALSE;
+	}
+	if (cred.uid != getuid() && cred.uid != 0)
+	{
+		logger_error(player_log, 0, 
+				_("Rejecting local connection from user %d (process %d)"),
+				(int)cred.uid, (int)cred.pid);
+		return FALSE;
+	}
+	return TRUE;
+} /* End of 'server_check_peer' function */
+
+/* Accept pending connections */
+static void server_accept( int listen_socket )
+{
+	for ( ;; )
+	{
+		int conn_socket = accept(listen_socket, NULL, NULL);
+		if (conn_socket == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
 				logger_error(player_log, 0,
-						_("Server connection thread create failed: %s"),
-						strerror(err));
-				goto failure;
-			}
+						_("Server socket accept failed: %s"),
+						strerror(errno));
+			break;
+		}
 
+		/* Too many clients */
+		if (server_num_conns >= server_max_conns)
+		{
+			logger_error(player_log, 0, 
+					_("Connections limit (%d) reached; rejecting connection"),
+					server_max_conns);
+			close(conn_socket);
 			continue;
-		failure:
-			if (conn_desc)
-				server_conn_desc_free(conn_desc);
+		}
+
+		if (listen_socket == server_unix_socket && 
+				!server_check_peer(conn_socket))
+		{
+			close(conn_socket);
 			continue;
 		}
+
+		logger_message(player_log, 0, _("Received a connection"));
+
+		if (!server_set_nonblock(conn_socket) ||
+				!server_conn_desc_new(conn_socket))
+			close(conn_socket);
 	}
+} /* End of 'server_accept' function */
 
-	return NULL;
-} /* End of 'server_thread' function */
+/* Write server statistics object */
+void server_write_stats( js_writer_t *w )
+{
+	js_writer_begin_object(w);
+	js_writer_int_member(w, "connections", server_num_conns);
+	js_writer_int_member(w, "info_queue", irw_get_len());
+	pthread_mutex_lock(&server_jobs_mutex);
+	js_writer_int_member(w, "jobs", server_num_running_jobs);
+	pthread_mutex_unlock(&server_jobs_mutex);
+	server_stats_write(w);
+
+	/* Window library message queue */
+	if (wnd_root != NULL)
+	{
+		wnd_msg_queue_t *queue = WND_MSG_QUEUE(wnd_root);
+
+		js_writer_key(w, "messages");
+		js_writer_begin_object(w);
+		js_writer_int_member(w, "posted", 
+				__atomic_load_n(&queue->m_num_posted, __ATOMIC_RELAXED));
+		js_writer_int_member(w, "coalesced", 
+				__atomic_load_n(&queue->m_num_coalesced, __ATOMIC_RELAXED));
+		js_writer_int_member(w, "processed", 
+				__atomic_load_n(&queue->m_num_processed, __ATOMIC_RELAXED));
+		js_writer_int_member(w, "syncs", 
+				__atomic_load_n(&WND_GLOBAL(wnd_root)->m_num_syncs, 
+					__ATOMIC_RELAXED));
+		js_writer_end_object(w);
+	}
 
-/* Hook handler to send notifications */
-static void server_hook_handler( char *hook )
+	/* Notification backlog is the data client has not read yet and 
+	 * notifications postponed until it does */
+	js_writer_key(w, "clients");
+	js_writer_begin_array(w);
+	for ( server_conn_desc_t *conn = server_conns; conn; conn = conn->m_next )
+	{
+		if (conn->m_dead)
+			continue;
+		js_writer_begin_object(w);
+		js_writer_int_member(w, "socket", conn->m_socket);
+		js_writer_int_member(w, "protocol", conn->m_protocol);
+		js_writer_int_member(w, "output", conn->m_out_len - conn->m_out_pos);
+		js_writer_int_member(w, "pending", 
+				__builtin_popcount(conn->m_notify_pending));
+		js_writer_boolean_member(w, "busy", conn->m_call != NULL);
+		js_writer_end_object(w);
+	}
+	js_writer_end_array(w);
+	js_writer_end_object(w);
+} /* End of 'server_write_stats' function */
+
+/* Get monotonic time in milliseconds */
+static int64_t server_now( void )
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* End of 'server_now' function */
+
+/* Rearm play time notifications timer after subscriptions change */
+void server_update_time_timer( void )
 {
-	char nv;
 	server_conn_desc_t *conn;
+	int interval = 0;
 
-	/* Determine notification code */
-	if (!strcmp(hook, "playlist"))
-		nv = SERVER_NOTIFY_PLAYLIST;
-	else if (!strcmp(hook, "player-status"))
-		nv = SERVER_NOTIFY_STATUS;
-	else
+	/* Time hook comes once a second, so timer is needed only for
+	 * shorter intervals and only while playing */
+	if (player_context->m_status == PLAYER_STATUS_PLAYING)
+	{
+		for ( conn = server_conns; conn; conn = conn->m_next )
+		{
+			if (conn->m_dead || conn->m_call || !conn->m_time_interval ||
+					conn->m_time_interval >= SERVER_DEF_TIME_INTERVAL)
+				continue;
+			if (!interval || conn->m_time_interval < interval)
+				interval = conn->m_time_interval;
+		}
+	}
+	if (interval == server_timer_interval)
+		return;
+
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(server_timer, 0, &its, NULL) == -1)
+	{
+		logger_error(player_log, 0,
+				_("Server timer setup failed: %s"),
+				strerror(errno));
 		return;
+	}
+	server_timer_interval = interval;
+} /* End of 'server_update_time_timer' function */
+
+/* Send play time to the clients which are waiting for it. If 'force' is
+ * set intervals are ignored */
+static void server_push_time( bool_t force )
+{
+	server_conn_desc_t *conn;
+	int64_t now = server_now();
 
-	/* Notify all clients */
-	pthread_mutex_lock(&server_mutex);
 	for ( conn = server_conns; conn; conn = conn->m_next )
 	{
-		server_conn_notify(conn, nv);
+		if (conn->m_dead || conn->m_call || !conn->m_time_interval)
+			continue;
+		if (!force && now < conn->m_time_next)
+			continue;
+		conn->m_time_next = now + conn->m_time_interval;
+		server_conn_post(conn, SERVER_NOTIFY_TIME);
+		server_conn_flush(conn);
 	}
-	pthread_mutex_unlock(&server_mutex);
-} /* End of 'server_conn_hook_handler' function */
+} /* End of 'server_push_time' function */
 
-/* Send exit notification to a connection */
-static void server_conn_notify( server_conn_desc_t *conn, char nv )
+/* Handle timer expiration */
+static void server_handle_timer( void )
+{
+	uint64_t expirations;
+
+	/* Missed expirations are not caught up */
+	while (read(server_timer, &expirations, sizeof(expirations)) > 0)
+		;
+	server_push_time(FALSE);
+} /* End of 'server_handle_timer' function */
+
+/* Pass command to the main thread. Returns FALSE if it can't be done; 
+ * command is not to be executed then */
+bool_t server_call_post( server_conn_desc_t *conn, char *cmd, 
+		bool_t exclusive )
 {
-	write(RDWN_NOTIFY_WRITE_FD(conn->m_rdwn), &nv, 1);
-} /* End of 'server_conn_notify_exit' function */
+	server_call_t *call;
 
-/* Parse and execute input from client */
-bool_t server_conn_parse_input(server_conn_desc_t *d)
+	call = (server_call_t *)malloc(sizeof(*call));
+	if (!call)
+		return FALSE;
+	call->m_cmd = strdup(cmd);
+	if (!call->m_cmd)
+	{
+		free(call);
+		return FALSE;
+	}
+	call->m_conn = conn;
+	call->m_body = NULL;
+	call->m_body_len = 0;
+	call->m_bye = FALSE;
+	call->m_start = server_stats_now();
+	call->m_exclusive = exclusive;
+	call->m_next = NULL;
+
+	/* Main thread doesn't handle messages in the very beginning and end */
+	conn->m_call = call;
+	if (!player_send_user_msg(PLAYER_MSG_SERVER_CALL, call))
+	{
+		conn->m_call = NULL;
+		server_call_free(call);
+		return FALSE;
+	}
+	if (exclusive)
+		server_num_exclusive_calls++;
+	return TRUE;
+} /* End of 'server_call_post' function */
+
+/* Execute command passed to the main thread and hand the result back
+ * to the server thread */
+void server_call_run( server_call_t *call )
 {
-	int i;
-	char *p;
-	bool_t res = TRUE;
+	server_conn_exec_call(call);
+
+	pthread_mutex_lock(&server_calls_mutex);
+	call->m_next = server_done_calls;
+	server_done_calls = call;
+	pthread_mutex_unlock(&server_calls_mutex);
+	server_post_notify(SERVER_NOTIFY_CALLS);
+} /* End of 'server_call_run' function */
+
+/* Free call */
+static void server_call_free( server_call_t *call )
+{
+	free(call->m_cmd);
+	if (call->m_body)
+		free(call->m_body);
+	free(call);
+} /* End of 'server_call_free' function */
+
+/* Send responses of the commands executed by the main thread and go on
+ * with the clients input */
+static void server_finish_calls( void )
+{
+	server_call_t *calls, *next;
+	server_conn_desc_t *conn;
+	bool_t resume = FALSE;
+
+	pthread_mutex_lock(&server_calls_mutex);
+	calls = server_done_calls;
+	server_done_calls = NULL;
+	pthread_mutex_unlock(&server_calls_mutex);
+
+	for ( ; calls; calls = next )
+	{
+		conn = calls->m_conn;
+		next = calls->m_next;
+		conn->m_call = NULL;
+		if (calls->m_exclusive && !(--server_num_exclusive_calls))
+			resume = TRUE;
+		if (!conn->m_dead)
+		{
+			if (!server_conn_finish_call(calls))
+				conn->m_closing = TRUE;
+			else if (!conn->m_closing && !server_conn_parse_input(conn))
+				conn->m_closing = TRUE;
+			server_conn_flush(conn);
+		}
+		server_call_free(calls);
+	}
+
+	/* Go on with the other clients commands and send them notifications
+	 * postponed by exclusive calls */
+	for ( conn = server_conns; resume && conn; conn = conn->m_next )
+	{
+		if (conn->m_dead || conn->m_call)
+			continue;
+		if (!conn->m_closing && conn->m_in_len && 
+				!server_conn_parse_input(conn))
+			conn->m_closing = TRUE;
+		server_conn_flush(conn);
+	}
+
+	/* Commands might change time subscriptions */
+	server_update_time_timer();
+} /* End of 'server_finish_calls' function */
+
+/* Job progress callback */
+static void server_job_progress( plist_batch_t *batch, void *ctx )
+{
+	server_post_notify(SERVER_NOTIFY_JOBS);
+	wnd_invalidate(player_wnd);
+} /* End of 'server_job_progress' function */
+
+/* Job thread function */
+static void *server_job_thread( void *arg )
+{
+	server_job_t *job = (server_job_t *)arg;
+	plist_set_t *set;
+
+	set = plist_set_new(TRUE);
+	if (set)
+	{
+		plist_set_add(set, job->m_path);
+		plist_add_set_batched(player_plist, set, &job->m_batch);
+		plist_set_free(set);
+	}
+	logger_debug(player_log, "Job %d has added %d songs", job->m_id,
+			job->m_batch.m_added);
+
+	/* Job may be freed as soon as it is marked finished */
+	pthread_mutex_lock(&server_jobs_mutex);
+	__atomic_store_n(&job->m_finished, TRUE, __ATOMIC_RELEASE);
+	server_num_running_jobs--;
+	server_post_notify(SERVER_NOTIFY_JOBS);
+	pthread_cond_broadcast(&server_jobs_cond);
+	pthread_mutex_unlock(&server_jobs_mutex);
+	return NULL;
+} /* End of 'server_job_thread' function */
+
+/* Free job */
+static void server_job_free( server_job_t *job )
+{
+	free(job->m_path);
+	if (job->m_batch.m_songs)
+		free(job->m_batch.m_songs);
+	free(job);
+} /* End of 'server_job_free' function */
+
+/* Start adding files in background. Returns job id or -1 */
+int server_job_start( server_conn_desc_t *conn, char *path )
+{
+	server_job_t *job;
+	pthread_t tid;
+	pthread_attr_t attr;
+	int err;
+
+	job = (server_job_t *)malloc(sizeof(*job));
+	if (!job)
+		return -1;
+	memset(job, 0, sizeof(*job));
+	job->m_path = strdup(path);
+	if (!job->m_path)
+	{
+		free(job);
+		return -1;
+	}
+	job->m_conn = conn;
+	job->m_batch.m_progress = server_job_progress;
+	job->m_batch.m_ctx = job;
+
+	pthread_mutex_lock(&server_jobs_mutex);
+	if (server_jobs_stopped)
+	{
+		pthread_mutex_unlock(&server_jobs_mutex);
+		server_job_free(job);
+		return -1;
+	}
+	job->m_id = ++server_last_job_id;
+
+	/* Threads are not joined: jobs are waited for with the counter */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	err = pthread_create(&tid, &attr, server_job_thread, job);
+	pthread_attr_destroy(&attr);
+	if (err)
+	{
+		pthread_mutex_unlock(&server_jobs_mutex);
+		logger_error(player_log, 0, _("Job thread create failed: %s"),
+				strerror(err));
+		server_job_free(job);
+		return -1;
+	}
+	server_num_running_jobs++;
+	job->m_next = server_jobs;
+	server_jobs = job;
+	pthread_mutex_unlock(&server_jobs_mutex);
+	return job->m_id;
+} /* End of 'server_job_start' function */
+
+/* Cancel job. Returns FALSE if there is no such job running */
+bool_t server_job_cancel( int id )
+{
+	bool_t found = FALSE;
+
+	pthread_mutex_lock(&server_jobs_mutex);
+	for ( server_job_t *job = server_jobs; job; job = job->m_next )
+	{
+		if (job->m_id == id && !job->m_finished)
+		{
+			job->m_batch.m_cancel = TRUE;
+			found = TRUE;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&server_jobs_mutex);
+	return found;
+} /* End of 'server_job_cancel' function */
+
+/* Cancel all jobs and wait for them to finish. No new jobs are started
+ * after this */
+void server_stop_jobs( void )
+{
+	pthread_mutex_lock(&server_jobs_mutex);
+	server_jobs_stopped = TRUE;
+	for ( server_job_t *job = server_jobs; job; job = job->m_next )
+		job->m_batch.m_cancel = TRUE;
+	while (server_num_running_jobs)
+		pthread_cond_wait(&server_jobs_cond, &server_jobs_mutex);
+	pthread_mutex_unlock(&server_jobs_mutex);
+} /* End of 'server_stop_jobs' function */
+
+/* Tell clients about their jobs progress */
+static void server_handle_jobs( void )
+{
+	server_conn_desc_t *conn;
 
-	/* Extract command */
-	for ( i = 0, p = d->m_buf; *p && i < sizeof(d->m_buf); i++, p++ )
+	for ( conn = server_conns; conn; conn = conn->m_next )
 	{
-		if ((*p) == '\r')
+		if (conn->m_dead)
 			continue;
-		if ((*p) == '\n')
+		server_conn_post(conn, SERVER_NOTIFY_JOBS);
+		server_conn_flush(conn);
+	}
+} /* End of 'server_handle_jobs' function */
+
+/* Destroy finished jobs which client knows about */
+static void server_reap_jobs( void )
+{
+	server_job_t *job, **prev;
+
+	pthread_mutex_lock(&server_jobs_mutex);
+	for ( prev = &server_jobs; (job = *prev) != NULL; )
+	{
+		if (job->m_finished && (!job->m_conn || job->m_reported_finished))
 		{
-			res = server_conn_exec_command(d);
-			str_clear(d->m_cur_cmd);
+			*prev = job->m_next;
+			server_job_free(job);
 		}
 		else
-			str_insert_char(d->m_cur_cmd, *p, d->m_cur_cmd->m_len);
+			prev = &job->m_next;
 	}
-	return res;
-} /* End of 'server_conn_parse_input' function */
+	pthread_mutex_unlock(&server_jobs_mutex);
+} /* End of 'server_reap_jobs' function */
 
-/* Connection management thread */
-static void *server_conn_thread( void *p )
+/* Handle notifications. Returns FALSE on exit request */
+static bool_t server_handle_notify( void )
 {
-	server_conn_desc_t *conn_desc = (server_conn_desc_t *)p;
+	char buf[64];
+	unsigned pending;
+	server_conn_desc_t *conn;
 
+	/* Drain wake up bytes before taking notifications, so that the ones
+	 * posted later wake us again */
 	for ( ;; )
 	{
-		/* Wait for some activity */
-		int retv = rd_with_notify_wait(conn_desc->m_rdwn);
-		if (!retv)
-		{
-			logger_error(player_log, 0,
-					_("Connection select failed: %s"),
-					strerror(errno));
+		ssize_t sz = read(RDWN_NOTIFY_READ_FD(server_rdwn), buf, sizeof(buf));
+		if (sz < 0 && errno == EINTR)
+			continue;
+		if (sz <= 0)
 			break;
+	}
+	pending = __atomic_exchange_n(&server_pending, 0, __ATOMIC_ACQ_REL);
+
+	/* Exit */
+	if (pending & SERVER_NOTIFY_BIT(SERVER_NOTIFY_EXIT))
+		return FALSE;
+
+	/* Same notifications posted together are sent once */
+	for ( int nv = 0; pending; nv++, pending >>= 1 )
+	{
+		if (!(pending & 1))
+			continue;
+
+		/* Play time goes only to subscribed clients */
+		if (nv == SERVER_NOTIFY_TIME)
+		{
+			server_push_time(FALSE);
+			continue;
 		}
 
-		/* Notification */
-		if (retv & RDWN_NOTIFY_READY)
+		/* Main thread has executed some commands */
+		if (nv == SERVER_NOTIFY_CALLS)
 		{
-			char nv;
-			if (read(RDWN_NOTIFY_READ_FD(conn_desc->m_rdwn), &nv, 1) <= 0)
-			{
-				/* Some error */
-				break;
-			}
+			server_finish_calls();
+			continue;
+		}
 
-			/* Exit */
-			if (nv == SERVER_NOTIFY_EXIT)
-				break;
+		/* Jobs progress goes only to the clients which started them */
+		if (nv == SERVER_NOTIFY_JOBS)
+		{
+			server_handle_jobs();
+			continue;
+		}
 
-			/* Handle notification */
-			server_conn_client_notify(conn_desc, nv);
+		/* Playing may be paused or resumed, or position changed */
+		if (nv == SERVER_NOTIFY_STATUS)
+		{
+			server_update_time_timer();
+			server_push_time(TRUE);
 		}
 
-		/* Input from client */
-		if (retv & RDWN_READ_READY)
+		for ( conn = server_conns; conn; conn = conn->m_next )
 		{
-			ssize_t sz = recv(conn_desc->m_socket, 
-					&conn_desc->m_buf, sizeof(conn_desc->m_buf) - 1, 0);
-			if (sz == -1)
+			if (conn->m_dead)
 				continue;
-			else if (sz == 0)
-				break;
-			conn_desc->m_buf[sz] = 0;
+			server_conn_post(conn, nv);
+			server_conn_flush(conn);
+		}
+	}
+	return TRUE;
+} /* End of 'server_handle_notify' function */
+
+/* Handle connection events */
+static void server_conn_handle_event( server_conn_desc_t *conn, 
+		uint32_t events )
+{
+	if (conn->m_dead)
+		return;
+
+	/* Connection isn't read while its command is executed. Hangup is 
+	 * reported all the time, so connection is removed from the loop until
+	 * it can be destroyed. Other events may be stale ones reported before
+	 * the command was posted (e.g. by the same events batch) */
+	if (conn->m_call)
+	{
+		if (events & (EPOLLERR | EPOLLHUP))
+		{
+			epoll_ctl(server_epoll, EPOLL_CTL_DEL, conn->m_socket, NULL);
+			conn->m_dead = TRUE;
+		}
+		return;
+	}
 
-			if (!server_conn_parse_input(conn_desc))
-				break;
+	/* Input from client */
+	if (events & EPOLLIN)
+	{
+		if (!server_conn_recv(conn))
+			conn->m_dead = TRUE;
+	}
+	else if (events & (EPOLLERR | EPOLLHUP))
+		conn->m_dead = TRUE;
+
+	server_conn_flush(conn);
+} /* End of 'server_conn_handle_event' function */
+
+/* Destroy connections which are done */
+static void server_reap_conns( void )
+{
+	server_conn_desc_t *conn, *next;
+	bool_t had_time = FALSE;
+
+	for ( conn = server_conns; conn; conn = next )
+	{
+		next = conn->m_next;
+		if (conn->m_dead && !conn->m_call)
+		{
+			logger_message(player_log, 0, _("Closing connection"));
+			if (conn->m_time_interval)
+				had_time = TRUE;
+			server_conn_desc_free(conn);
 		}
 	}
 
-	logger_message(player_log, 0, _("Closing connection"));
+	/* Timer may be not needed anymore */
+	if (had_time)
+		server_update_time_timer();
+} /* End of 'server_reap_conns' function */
+
+/* The main server thread function
+ * It runs the event loop accepting connections, reading commands, 
+ * writing responses and delivering notifications */
+static void *server_thread( void *p )
+{
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	bool_t finish = FALSE;
 
-	/* Destroy the connection */
-	server_conn_desc_free(conn_desc);
+	while (!finish)
+	{
+		/* Wait for some activity */
+		int num = epoll_wait(server_epoll, events, SERVER_MAX_EVENTS, -1);
+		if (num == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			logger_error(player_log, 0,
+					_("Server event wait failed: %s"),
+					strerror(errno));
+			break;
+		}
+
+		/* Connections are only marked dead while handling events since
+		 * they may still be referred to by the following events */
+		for ( int i = 0; i < num && !finish; i++ )
+		{
+			void *ptr = events[i].data.ptr;
+			if (ptr == &server_socket)
+				server_accept(server_socket);
+			else if (ptr == &server_unix_socket)
+				server_accept(server_unix_socket);
+			else if (ptr == &server_timer)
+				server_handle_timer();
+			else if (ptr == server_rdwn)
+				finish = !server_handle_notify();
+			else
+				server_conn_handle_event((server_conn_desc_t *)ptr, 
+						events[i].events);
+		}
+		server_reap_conns();
+		server_reap_jobs();
+	}
 
+	/* Close connections. Commands still queued to the main thread are
+	 * never executed since it has left its loop already */
+	while (server_conns)
+		server_conn_desc_free(server_conns);
 	return NULL;
-} /* End of 'server_conn_thread' function */
+} /* End of 'server_thread' function */
 
-/* End of 'server.c' file */
+/* Hook handler to send notifications */
+static void server_hook_handler( char *hook )
+{
+	char nv;
 
+	/* Determine notification code */
+	if (!strcmp(hook, "playlist"))
+		nv = SERVER_NOTIFY_PLAYLIST;
+	else if (!strcmp(hook, "player-status"))
+		nv = SERVER_NOTIFY_STATUS;
+	else if (!strcmp(hook, "playlist-info"))
+		nv = SERVER_NOTIFY_PLAYLIST_INFO;
+	else if (!strcmp(hook, "player-time"))
+		nv = SERVER_NOTIFY_TIME;
+	else
+		return;
+
+	/* Pass it to the server thread */
+	server_post_notify(nv);
+} /* End of 'server_conn_hook_handler' function */
+
+/* Post a notification to the server thread. This never blocks, so 
+ * it is safe to call from any thread */
+static void server_post_notify( char nv )
+{
+	unsigned was = __atomic_fetch_or(&server_pending, SERVER_NOTIFY_BIT(nv),
+			__ATOMIC_ACQ_REL);
+
+	/* Wake the thread up unless it is already woken. Full pipe means 
+	 * the same */
+	if (!was)
+	{
+		char c = 0;
+		if (write(RDWN_NOTIFY_WRITE_FD(server_rdwn), &c, 1) < 0 &&
+				errno != EAGAIN && errno != EWOULDBLOCK)
+			logger_debug(player_log, "Server notification failed");
+	}
+} /* End of 'server_post_notify' function */
+
+/* End of 'server.c' file */
@@ -24,6 +24,16 @@
 #define __SG_MPFC_SERVER_H__
 
 #include "types.h"
+#include "dir_cache.h"
+#include "json_helpers.h"
+#include "server_client.h"
+
+/* Directory listings sent to clients */
+extern dcache_t *server_dir_cache;
+
+/* Maximal size of unsent output a client may have when the next message
+ * to it is started */
+extern int server_max_output;
 
 /* Start the server */
 bool_t server_start( void );
@@ -31,6 +41,34 @@ bool_t server_start( void );
 /* Stop server */
 void server_stop( void );
 
+/* Write out as much of connection output as socket accepts */
+void server_conn_flush( server_conn_desc_t *conn );
+
+/* Rearm play time notifications timer after subscriptions change */
+void server_update_time_timer( void );
+
+/* Pass command to the main thread. Returns FALSE if it can't be done.
+ * Exclusive call looks as one change to the other clients */
+bool_t server_call_post( server_conn_desc_t *conn, char *cmd, 
+		bool_t exclusive );
+
+/* Execute command passed to the main thread and hand the result back
+ * to the server thread */
+void server_call_run( server_call_t *call );
+
+/* Start adding files in background. Returns job id or -1 */
+int server_job_start( server_conn_desc_t *conn, char *path );
+
+/* Cancel job. Returns FALSE if there is no such job running */
+bool_t server_job_cancel( int id );
+
+/* Cancel all jobs and wait for them to finish. No new jobs are started
+ * after this */
+void server_stop_jobs( void );
+
+/* Write server statistics object */
+void server_write_stats( js_writer_t *w );
+
 #endif
 
 /* End of 'server.h' file */
@@ -21,18 +21,23 @@
  */
 
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <json-glib/json-glib.h>
-#include "file_utils.h"
+#include "change_log.h"
+#include "dir_cache.h"
 #include "json_helpers.h"
 #include "player.h"
+#include "plist.h"
+#include "server.h"
 #include "server_client.h"
+#include "server_stats.h"
+#include "song.h"
 #include "util.h"
 
 typedef union
@@ -48,32 +53,73 @@ typedef enum
 	PARAM_STRING
 } param_kind_t;
 
-/* Parse command */
-static bool_t server_client_parse_cmd( char *cmd, char **cmd_name,
-	  	                               param_kind_t *param_kind, param_t *param )
+/* Command execution status */
+typedef enum
 {
-	(*cmd_name) = cmd;
+	SERVER_EXEC_OK,
+	SERVER_EXEC_UNKNOWN,
+	SERVER_EXEC_BYE
+} server_exec_status_t;
 
-	/* Skip command name */
-	for ( ;; cmd++ )
-	{
-		 if (!(isalnum(*cmd) || (*cmd) == '_'))
-			 break;
-	}
+/* Message body collected before it is sent */
+typedef struct
+{
+	char *m_data;
+	size_t m_len, m_size;
+} server_body_t;
 
-	if (!(*cmd))
-	{
-		(*param_kind) = PARAM_NONE;
-		return TRUE;
-	}
+/* Response being written to client */
+typedef struct
+{
+	server_conn_desc_t *m_conn;
 
-	/* Must be a space */
-	if ((*cmd) != ' ')
-		return FALSE;
+	/* Response is sent in chunks while it is being built */
+	bool_t m_chunked;
+	bool_t m_started;
 
-	/* Make command name null-terminated */
-	(*cmd++) = 0;
+	/* Response is built by the main thread and is sent later by the 
+	 * server thread */
+	bool_t m_detached;
+
+	/* Otherwise it is collected here */
+	server_body_t m_body;
 
+	js_writer_t m_writer;
+} server_response_t;
+
+/* Chunked response is written out to socket when this much output
+ * is queued */
+#define SERVER_FLUSH_SIZE (64 * 1024)
+
+/* Maximal number of command parameters */
+#define SERVER_MAX_PARAMS 4
+
+/* Song fields sent in play list */
+#define SERVER_FIELD_TITLE		0x01
+#define SERVER_FIELD_LENGTH		0x02
+#define SERVER_FIELD_ARTIST		0x04
+#define SERVER_FIELD_ALBUM		0x08
+#define SERVER_FIELD_PATH		0x10
+#define SERVER_FIELD_INFO_READY	0x20
+
+/* Fields sent if client doesn't specify them */
+#define SERVER_DEF_FIELDS (SERVER_FIELD_TITLE | SERVER_FIELD_LENGTH)
+
+/* Commands changing player state. They are executed by the main thread
+ * which owns the play list and the windows. Batch may contain only these
+ * (but another batch), since it is executed by the main thread as a 
+ * whole and the rest touch the server thread data */
+static const char *server_main_thread_cmds[] = 
+{
+	"play", "resume", "pause", "stop", "next", "prev", "time_back",
+	"set_volume", "seek", "remove", "clear_playlist", "queue",
+	"queue_move", "unqueue", "clear_queue", "batch", NULL
+};
+
+/* Parse a single command parameter */
+static char *server_client_parse_param( char *cmd, param_kind_t *param_kind,
+										param_t *param )
+{
 	/* Starting a number */
 	if ((*cmd) == '-' || isdigit(*cmd))
 	{
@@ -82,15 +128,15 @@ static bool_t server_client_parse_cmd( char *cmd, char **cmd_name,
 		errno = 0;
 		double v = strtold(cmd, &endptr);
 		if (errno)
-			return FALSE;
+			return NULL;
 
-		/* Something left: it's an error */
-		if (*endptr)
-			return FALSE;
+		/* Something but a separator left: it's an error */
+		if ((*endptr) && (*endptr) != ' ')
+			return NULL;
 
 		(*param_kind) = PARAM_NUMBER;
 		param->num_param = v;
-		return TRUE;
+		return endptr;
 	}
 
 	/* Starting a string */
@@ -103,34 +149,299 @@ static bool_t server_client_parse_cmd( char *cmd, char **cmd_name,
 		for ( ; *cmd && (*cmd) != '"'; cmd++ )
 			;
 		if (!(*cmd))
-			return FALSE;
-		(*cmd) = 0;
+			return NULL;
+		(*cmd++) = 0;
+		if ((*cmd) && (*cmd) != ' ')
+			return NULL;
 		(*param_kind) = PARAM_STRING;
 		param->str_param = p;
-		return TRUE;
+		return cmd;
 	}
 
-	return FALSE;
+	return NULL;
+} /* End of 'server_client_parse_param' function */
+
+/* Parse command */
+static bool_t server_client_parse_cmd( char *cmd, char **cmd_name,
+										int *num_params, param_kind_t *param_kinds, 
+										param_t *params )
+{
+	(*cmd_name) = cmd;
+	(*num_params) = 0;
+	for ( int i = 0; i < SERVER_MAX_PARAMS; i++ )
+		param_kinds[i] = PARAM_NONE;
+
+	/* Skip command name */
+	for ( ;; cmd++ )
+	{
+		 if (!(isalnum(*cmd) || (*cmd) == '_'))
+			 break;
+	}
+
+	if (!(*cmd))
+		return TRUE;
+
+	/* Must be a space */
+	if ((*cmd) != ' ')
+		return FALSE;
+
+	/* Make command name null-terminated */
+	(*cmd++) = 0;
+
+	/* Parse space-separated parameters */
+	for ( ;; )
+	{
+		if ((*num_params) >= SERVER_MAX_PARAMS)
+			return FALSE;
+
+		cmd = server_client_parse_param(cmd, &param_kinds[*num_params],
+				&params[*num_params]);
+		if (!cmd)
+			return FALSE;
+		(*num_params)++;
+
+		if (!(*cmd))
+			break;
+		cmd++;
+	}
+	return TRUE;
 } /* End of 'server_client_parse_cmd' function */
 
-/* Send a buffer */
+/* Get integer value of a number parameter */
+static int server_client_param_int( param_t *param )
+{
+	if (param->num_param >= INT_MAX)
+		return INT_MAX;
+	if (param->num_param <= INT_MIN)
+		return INT_MIN;
+	return (int)param->num_param;
+} /* End of 'server_client_param_int' function */
+
+/* Parse comma-separated list of song fields */
+static int server_client_parse_fields( char *list )
+{
+	static const struct
+	{
+		const char *m_name;
+		int m_flag;
+	} fields[] = 
+	{
+		{ "title", SERVER_FIELD_TITLE },
+		{ "length", SERVER_FIELD_LENGTH },
+		{ "artist", SERVER_FIELD_ARTIST },
+		{ "album", SERVER_FIELD_ALBUM },
+		{ "path", SERVER_FIELD_PATH },
+		{ "info_ready", SERVER_FIELD_INFO_READY }
+	};
+	int res = 0;
+
+	for ( char *p = list; *p; )
+	{
+		size_t len = strcspn(p, ",");
+		for ( int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++ )
+		{
+			if (strlen(fields[i].m_name) == len && 
+					!strncmp(p, fields[i].m_name, len))
+				res |= fields[i].m_flag;
+		}
+		p += len;
+		if (*p)
+			p++;
+	}
+	return res;
+} /* End of 'server_client_parse_fields' function */
+
+/* Write play list song object with the specified fields */
+static void server_client_write_song( js_writer_t *w, song_t *s, int fields )
+{
+	js_writer_begin_object(w);
+	if (fields & SERVER_FIELD_TITLE)
+		js_writer_string_member(w, "title", STR_TO_CPTR(s->m_title));
+	if (fields & SERVER_FIELD_LENGTH)
+		js_writer_int_member(w, "length", s->m_len);
+	if (fields & SERVER_FIELD_PATH)
+		js_writer_string_member(w, "path", 
+				s->m_filename ? s->m_filename : s->m_fullname);
+
+	/* Info is replaced by info reading thread */
+	if (fields & (SERVER_FIELD_ARTIST | SERVER_FIELD_ALBUM | 
+				SERVER_FIELD_INFO_READY))
+	{
+		song_lock(s);
+		song_info_t *si = s->m_info;
+		bool_t ready = (si && (si->m_flags & SI_INITIALIZED));
+		if (fields & SERVER_FIELD_ARTIST)
+			js_writer_string_member(w, "artist", 
+					ready && si->m_artist ? si->m_artist : "");
+		if (fields & SERVER_FIELD_ALBUM)
+			js_writer_string_member(w, "album", 
+					ready && si->m_album ? si->m_album : "");
+		if (fields & SERVER_FIELD_INFO_READY)
+			js_writer_boolean_member(w, "info_ready", 
+					ready && !(s->m_flags & SONG_INFO_READ));
+		song_unlock(s);
+	}
+	js_writer_end_object(w);
+} /* End of 'server_client_write_song' function */
+
+/* Play list changes being written */
+typedef struct
+{
+	js_writer_t *m_writer;
+	bool_t m_started;
+} server_changes_writer_t;
+
+/* Write change log entry. Changes array is started with the first one */
+static void server_client_write_change( chlog_entry_t *e, void *ctx )
+{
+	server_changes_writer_t *cw = (server_changes_writer_t *)ctx;
+	js_writer_t *w = cw->m_writer;
+
+	if (!cw->m_started)
+	{
+		js_writer_key(w, "changes");
+		js_writer_begin_array(w);
+		cw->m_started = TRUE;
+	}
+
+	js_writer_begin_object(w);
+	js_writer_int_member(w, "v", e->m_version);
+	js_writer_string_member(w, "type", chlog_type_name(e->m_type));
+	switch (e->m_type)
+	{
+		case CHLOG_INSERT:
+			js_writer_int_member(w, "pos", e->m_start);
+			js_writer_int_member(w, "count", e->m_end);
+			break;
+		case CHLOG_REMOVE:
+			js_writer_int_member(w, "start", e->m_start);
+			js_writer_int_member(w, "end", e->m_end);
+			break;
+		case CHLOG_MOVE:
+			js_writer_int_member(w, "start", e->m_start);
+			js_writer_int_member(w, "end", e->m_end);
+			js_writer_int_member(w, "to", e->m_to);
+			break;
+		case CHLOG_SORT:
+			js_writer_key(w, "transform");
+			js_writer_begin_array(w);
+			for ( int i = 0; i < e->m_end; i++ )
+				js_writer_int(w, e->m_transform[i]);
+			js_writer_end_array(w);
+			break;
+		case CHLOG_INFO:
+		case CHLOG_CUR_SONG:
+			js_writer_int_member(w, "pos", e->m_start);
+			break;
+	}
+	js_writer_end_object(w);
+} /* End of 'server_client_write_change' function */
+
+/* Write members with play list changes made after the given version to 
+ * the current object. If they are not available client is asked to 
+ * reload the whole list */
+static void server_client_write_changes( js_writer_t *w, uint64_t since, 
+		uint64_t *version )
+{
+	server_changes_writer_t cw = { w, FALSE };
+
+	if (chlog_foreach_since(player_plist->m_changes, since, 
+				server_client_write_change, &cw, version))
+	{
+		if (!cw.m_started)
+		{
+			js_writer_key(w, "changes");
+			js_writer_begin_array(w);
+		}
+		js_writer_end_array(w);
+	}
+	else
+	{
+		plist_lock(player_plist);
+		(*version) = player_plist->m_version;
+		plist_unlock(player_plist);
+		js_writer_boolean_member(w, "resync", TRUE);
+	}
+	js_writer_int_member(w, "version", *version);
+} /* End of 'server_client_write_changes' function */
+
+/* Collect message data */
+static void server_body_write( void *ctx, const char *data, size_t len )
+{
+	server_body_t *b = (server_body_t *)ctx;
+
+	/* Reallocate memory */
+	if (b->m_len + len > b->m_size)
+	{
+		size_t size = b->m_size ? b->m_size : JS_WRITER_BUF_SIZE;
+		while (size < b->m_len + len)
+			size *= 2;
+		char *data_new = (char *)realloc(b->m_data, size);
+		if (!data_new)
+		{
+			logger_error(player_log, 0, _("No enough memory!"));
+			return;
+		}
+		b->m_data = data_new;
+		b->m_size = size;
+	}
+	memcpy(&b->m_data[b->m_len], data, len);
+	b->m_len += len;
+} /* End of 'server_body_write' function */
+
+/* Send a buffer. Data is queued and written out by the server loop */
 bool_t server_conn_send_buf(server_conn_desc_t *d, const char *msg, int len)
 {
-	while (len > 0)
+	if (d->m_dead)
+		return FALSE;
+
+	/* Drop already sent data */
+	if (d->m_out_pos && d->m_out_len + len > d->m_out_size)
 	{
-		int sent = send(d->m_socket, msg, len, 0);
-		if (sent < 0)
+		memmove(d->m_out, &d->m_out[d->m_out_pos], d->m_out_len - d->m_out_pos);
+		d->m_out_len -= d->m_out_pos;
+		d->m_out_pos = 0;
+	}
+
+	/* Reallocate memory */
+	size_t need = d->m_out_len + len;
+	if (need > d->m_out_size)
+	{
+		size_t size = d->m_out_size ? d->m_out_size : 4096;
+		while (size < need)
+			size *= 2;
+		char *out = (char *)realloc(d->m_out, size);
+		if (!out)
 		{
-			logger_debug(player_log, "Error sending response");
+			logger_error(player_log, 0, _("No enough memory!"));
+			d->m_dead = TRUE;
 			return FALSE;
 		}
-
-		len -= sent;
-		msg += sent;
+		d->m_out = out;
+		d->m_out_size = size;
 	}
+
+	memcpy(&d->m_out[d->m_out_len], msg, len);
+	d->m_out_len += len;
 	return TRUE;
 } /* End of 'server_conn_send_buf' function */
 
+/* Check that client reads its output before starting a new message to
+ * it. Only the data queued before counts, so that a large response is
+ * not a reason to drop the client. Returns FALSE if client is dropped */
+static bool_t server_conn_check_output( server_conn_desc_t *d )
+{
+	if (d->m_dead)
+		return FALSE;
+	if (d->m_out_len - d->m_out_pos > (size_t)server_max_output)
+	{
+		logger_debug(player_log, "Client doesn't read responses; dropping it");
+		d->m_dead = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+} /* End of 'server_conn_check_output' function */
+
 /* Build notification message */
 void server_conn_notification_msg(char nv, char *msg, int buf_size)
 {
@@ -148,38 +459,209 @@ void server_conn_notification_msg(char nv, char *msg, int buf_size)
 	}
 } /* End of 'server_conn_notification_msg' function */
 
+/* Send a notification message */
+static void server_conn_send_notification(server_conn_desc_t *d, 
+		const char *msg, size_t len)
+{
+	char header[128];
+
+	if (!server_conn_check_output(d))
+		return;
+	server_stats.m_notifications++;
+	snprintf(header, sizeof(header), "Msg-Length: %zd\nMsg-Type: n\n", len);
+	if (!server_conn_send_buf(d, header, strlen(header)))
+		return;
+	server_conn_send_buf(d, msg, len);
+} /* End of 'server_conn_send_notification' function */
+
+/* Send play list changes to a subscribed client */
+static void server_conn_notify_changes(server_conn_desc_t *d)
+{
+	server_body_t body = { NULL, 0, 0 };
+	js_writer_t w;
+	uint64_t version;
+
+	js_writer_init(&w, server_body_write, &body);
+	js_writer_begin_object(&w);
+	js_writer_string_member(&w, "type", "changes");
+	server_client_write_changes(&w, d->m_changes_version, &version);
+	js_writer_end_object(&w);
+
+	/* Message is short without changes, so it is still in writer 
+	 * buffer and nothing is allocated */
+	if (version != d->m_changes_version)
+	{
+		d->m_changes_version = version;
+		js_writer_flush(&w);
+		server_conn_send_notification(d, body.m_data, body.m_len);
+	}
+	if (body.m_data)
+		free(body.m_data);
+} /* End of 'server_conn_notify_changes' function */
+
+/* Send play time to a subscribed client if it has changed */
+void server_conn_notify_time(server_conn_desc_t *d)
+{
+	int64_t tm = player_context->m_cur_time;
+	int cur_song = player_plist->m_cur_song;
+	server_body_t body = { NULL, 0, 0 };
+	js_writer_t w;
+
+	if (tm == d->m_time_sent && cur_song == d->m_time_song)
+		return;
+	d->m_time_sent = tm;
+	d->m_time_song = cur_song;
+
+	js_writer_init(&w, server_body_write, &body);
+	js_writer_begin_object(&w);
+	js_writer_string_member(&w, "type", "time");
+	js_writer_int_member(&w, "position", cur_song);
+	js_writer_int_member(&w, "time", tm);
+	js_writer_end_object(&w);
+	js_writer_flush(&w);
+	server_conn_send_notification(d, body.m_data, body.m_len);
+	if (body.m_data)
+		free(body.m_data);
+} /* End of 'server_conn_notify_time' function */
+
+/* Send job progress to client */
+void server_conn_notify_job( server_conn_desc_t *d, int id, int added,
+		const char *state )
+{
+	server_body_t body = { NULL, 0, 0 };
+	js_writer_t w;
+
+	js_writer_init(&w, server_body_write, &body);
+	js_writer_begin_object(&w);
+	js_writer_string_member(&w, "type", "job");
+	js_writer_int_member(&w, "job", id);
+	js_writer_int_member(&w, "added", added);
+	js_writer_string_member(&w, "state", state);
+	js_writer_end_object(&w);
+	js_writer_flush(&w);
+	server_conn_send_notification(d, body.m_data, body.m_len);
+	if (body.m_data)
+		free(body.m_data);
+} /* End of 'server_conn_notify_job' function */
+
 /* Send a notification to client */
 void server_conn_client_notify(server_conn_desc_t *d, char nv)
 {
 	char msg[128];
-	char header[128];
-	int len;
 
-	server_conn_notification_msg(nv, msg, sizeof(msg));
-	len = strlen(msg);
+	/* Subscribed clients get the play list changes themselves */
+	if (d->m_changes_subscribed)
+	{
+		if (nv == SERVER_NOTIFY_PLAYLIST || nv == SERVER_NOTIFY_PLAYLIST_INFO)
+		{
+			server_conn_notify_changes(d);
+			return;
+		}
 
-	snprintf(header, sizeof(header), "Msg-Length: %d\nMsg-Type: n\n", len);
-	if (!server_conn_send_buf(d, header, strlen(header)))
+		/* Current song could change too */
+		if (nv == SERVER_NOTIFY_STATUS)
+			server_conn_notify_changes(d);
+	}
+	else if (nv == SERVER_NOTIFY_PLAYLIST_INFO)
 		return;
-	server_conn_send_buf(d, msg, len);
+
+	server_conn_notification_msg(nv, msg, sizeof(msg));
+	server_conn_send_notification(d, msg, strlen(msg));
 } /* End of 'server_conn_client_notify' function */
 
-/* Send a response to client and free message memory */
-static void server_conn_response(server_conn_desc_t *d, JsonNode *node)
+/* Send a complete response body */
+static void server_conn_send_response( server_conn_desc_t *d, 
+		const char *body, size_t len )
 {
-	size_t len;
-	char *msg = js_to_string(node, &len);
+	char header[128];
+
+	if (d->m_protocol >= SERVER_PROTOCOL_CHUNKED)
+		snprintf(header, sizeof(header), 
+				"Msg-Type: r\nMsg-Chunked: 1\nChunk-Length: %zd\n", len);
+	else
+		snprintf(header, sizeof(header), "Msg-Length: %zd\nMsg-Type: r\n", 
+				len);
+	if (!server_conn_check_output(d) ||
+			!server_conn_send_buf(d, header, strlen(header)) ||
+			!server_conn_send_buf(d, body, len))
+		return;
+	if (d->m_protocol >= SERVER_PROTOCOL_CHUNKED)
+	{
+		const char *end = "Chunk-Length: 0\n";
+		server_conn_send_buf(d, end, strlen(end));
+	}
+} /* End of 'server_conn_send_response' function */
 
+/* Write response data. In chunked mode it goes to the client right 
+ * away, otherwise it is collected to be sent with its length */
+static void server_response_write( void *ctx, const char *data, size_t len )
+{
+	server_response_t *r = (server_response_t *)ctx;
+	server_conn_desc_t *d = r->m_conn;
 	char header[128];
-	snprintf(header, sizeof(header), "Msg-Length: %zd\nMsg-Type: r\n", len);
-	if (!server_conn_send_buf(d, header, strlen(header)))
-		goto finally;
-	server_conn_send_buf(d, msg, len);
 
-finally:
-	g_free(msg);
-	json_node_free(node);
-} /* End of 'server_conn_response' function */
+	if (r->m_chunked && !r->m_detached)
+	{
+		if (!r->m_started)
+		{
+			if (!server_conn_check_output(d))
+				return;
+			r->m_started = TRUE;
+			const char *start = "Msg-Type: r\nMsg-Chunked: 1\n";
+			server_conn_send_buf(d, start, strlen(start));
+		}
+		snprintf(header, sizeof(header), "Chunk-Length: %zd\n", len);
+		if (!server_conn_send_buf(d, header, strlen(header)))
+			return;
+		server_conn_send_buf(d, data, len);
+
+		/* Let the client have the data while the rest is being built */
+		if (d->m_out_len - d->m_out_pos >= SERVER_FLUSH_SIZE)
+			server_conn_flush(d);
+		return;
+	}
+
+	server_body_write(&r->m_body, data, len);
+} /* End of 'server_response_write' function */
+
+/* Start a response to client */
+static void server_response_init( server_response_t *r, server_conn_desc_t *d,
+		bool_t detached )
+{
+	r->m_conn = d;
+	r->m_chunked = (d->m_protocol >= SERVER_PROTOCOL_CHUNKED);
+	r->m_started = FALSE;
+	r->m_detached = detached;
+	r->m_body.m_data = NULL;
+	r->m_body.m_len = r->m_body.m_size = 0;
+	js_writer_init(&r->m_writer, server_response_write, r);
+	d->m_responding = TRUE;
+} /* End of 'server_response_init' function */
+
+/* Finish response. Nothing is sent if nothing was written. Detached 
+ * response body is left to the caller */
+static void server_response_finish( server_response_t *r )
+{
+	server_conn_desc_t *d = r->m_conn;
+
+	js_writer_flush(&r->m_writer);
+	d->m_responding = FALSE;
+	if (r->m_detached)
+		return;
+
+	if (r->m_chunked)
+	{
+		if (r->m_started)
+		{
+			const char *end = "Chunk-Length: 0\n";
+			server_conn_send_buf(d, end, strlen(end));
+		}
+	}
+	else if (r->m_writer.m_total)
+		server_conn_send_response(d, r->m_body.m_data, r->m_body.m_len);
+	if (r->m_body.m_data)
+		free(r->m_body.m_data);
+} /* End of 'server_response_finish' function */
 
 /* Validate file name. It shall not contain '..' */
 static bool_t is_valid_file_name(char *name)
@@ -216,71 +698,153 @@ static char *translate_file_name(char *name)
 	return util_strcat(r, name, NULL);
 } /* End of 'translate_file_name' function */
 
-/* Execute 'list_dir' command */
-static void server_conn_list_dir(char *name, JsonArray *js)
+/* Execute 'list_dir' command. Entries are sorted by name; those
+ * starting with 'prefix' (if it is not NULL) are taken and 'limit' of 
+ * them (all if it is negative) starting with 'offset' are sent. If 
+ * 'paged' is set the page is sent along with the total entries number */
+static void server_conn_list_dir(char *name, int offset, int limit, 
+		char *prefix, bool_t paged, js_writer_t *w)
 {
-	char *real_name = NULL;
-	fu_dir_t *dir = NULL;
+	dcache_dir_t *dir = NULL;
+	int start = 0, end = 0;
 
 	/* Translate virtual directory name */
-	real_name = translate_file_name(name);
-	if (!real_name)
-		goto finally;
-
-	/* Open directory */
-	dir = fu_opendir(real_name);
-	if (!dir)
-		goto finally;
+	char *real_name = translate_file_name(name);
+	if (real_name)
+		dir = dcache_get(server_dir_cache, real_name);
 
-	for ( ;; )
+	/* Find entries with the prefix */
+	if (dir)
 	{
-		struct dirent *de = fu_readdir(dir);
-		if (!de)
-			break;
-
-		/* Skip special dirs */
-		if (fu_is_special_dir(de->d_name))
-			continue;
-
-		/* Determine file type */
-		bool_t is_dir;
+		end = dir->m_num;
+		if (prefix && *prefix)
 		{
-			char *full_name = util_strcat(real_name, "/", de->d_name, NULL);
-			bool_t ok = fu_file_type(full_name, &is_dir);
-			free(full_name);
-			if (!ok)
-				continue;
+			size_t len = strlen(prefix);
+			start = end = dcache_lower_bound(dir, prefix);
+			while (end < dir->m_num && 
+					!strncmp(DCACHE_NAME(dir, end), prefix, len))
+				end++;
 		}
+	}
+	int total = end - start;
+
+	if (offset < 0)
+		offset = 0;
+	start += offset;
+	if (start > end)
+		start = end;
+	if (limit >= 0 && limit < end - start)
+		end = start + limit;
 
-		JsonObject *js_child = json_object_new();
-		json_object_set_string_member(js_child, "name", de->d_name);
-		json_object_set_string_member(js_child, "type", is_dir ? "d" : "f");
-		json_array_add_object_element(js, js_child);
+	if (paged)
+	{
+		js_writer_begin_object(w);
+		js_writer_int_member(w, "offset", offset);
+		js_writer_int_member(w, "total", total);
+		js_writer_key(w, "entries");
 	}
+	js_writer_begin_array(w);
+	for ( int i = start; i < end; i++ )
+	{
+		js_writer_begin_object(w);
+		js_writer_string_member(w, "name", DCACHE_NAME(dir, i));
+		js_writer_string_member(w, "type", 
+				dir->m_entries[i].m_is_dir ? "d" : "f");
+		js_writer_end_object(w);
+	}
+	js_writer_end_array(w);
+	if (paged)
+		js_writer_end_object(w);
 
-finally:
-	if (dir)
-		fu_closedir(dir);
 	if (real_name)
+	{
+		dcache_release(server_dir_cache);
 		free(real_name);
+	}
 } /* End of 'server_conn_list_dir' function */
 
-/* Execute a command received from client */
-bool_t server_conn_exec_command(server_conn_desc_t *d)
+/* Check if all the query words occur in the song search key */
+static bool_t server_conn_song_matches( song_t *s, char **words, 
+		int num_words )
 {
-	char *cmd_name;
-	param_kind_t param_kind;
-	param_t param;
-	char *cmd = d->m_cur_cmd->m_data;
+	bool_t res = TRUE;
 
-	logger_debug(player_log, "Received command '%s'", cmd);
+	song_lock(s);
+	const char *key = song_get_search_key(s);
+	for ( int i = 0; i < num_words && res; i++ )
+		res = (strstr(key, words[i]) != NULL);
+	song_unlock(s);
+	return res;
+} /* End of 'server_conn_song_matches' function */
+
+/* Search play list for songs containing all the query words in title,
+ * artist, album, name or path (ignoring case). Positions of up to 'limit'
+ * (all if it is negative) first matches are sent along with their 
+ * 'fields' and the total matches number */
+static void server_conn_search(char *query, int fields, int limit, 
+		js_writer_t *w)
+{
+	char *folded = song_fold_case(query);
+	char **words = NULL;
+	int num_words = 0, *positions = NULL, num_positions = 0, total = 0;
 
-	if (!server_client_parse_cmd(cmd, &cmd_name, &param_kind, &param))
+	/* Split query into words */
+	if (folded)
 	{
-		logger_debug(player_log, "Error parsing command");
-		return TRUE;
+		words = (char **)malloc(sizeof(char *) * (strlen(folded) / 2 + 1));
+		char *saveptr = NULL;
+		for ( char *word = strtok_r(folded, " \t", &saveptr); 
+				word != NULL && words != NULL; 
+				word = strtok_r(NULL, " \t", &saveptr) )
+			words[num_words++] = word;
+	}
+
+	js_writer_begin_object(w);
+	plist_lock(player_plist);
+	js_writer_int_member(w, "version", player_plist->m_version);
+	if (limit < 0 || limit > player_plist->m_len)
+		limit = player_plist->m_len;
+	positions = (int *)malloc(sizeof(int) * (limit + 1));
+	for ( int i = 0; i < player_plist->m_len; i++ )
+	{
+		if (!server_conn_song_matches(player_plist->m_list[i], 
+					words, num_words))
+			continue;
+		if (positions && num_positions < limit)
+			positions[num_positions++] = i;
+		total++;
 	}
 
+	js_writer_int_member(w, "total", total);
+	js_writer_key(w, "positions");
+	js_writer_begin_array(w);
+	for ( int i = 0; i < num_positions; i++ )
+		js_writer_int(w, positions[i]);
+	js_writer_end_array(w);
+	js_writer_key(w, "songs");
+	js_writer_begin_array(w);
+	for ( int i = 0; i < num_positions; i++ )
+		server_client_write_song(w, player_plist->m_list[positions[i]], 
+				fields);
+	js_writer_end_array(w);
+	plist_unlock(player_plist);
+	js_writer_end_object(w);
+
+	free(positions);
+	free(words);
+	free(folded);
+} /* End of 'server_conn_search' function */
+
+/* Execute a parsed command. Response (if command has it) is written 
+ * with 'w' */
+static server_exec_status_t server_conn_exec( server_conn_desc_t *d, 
+		char *cmd_name, int num_params, param_kind_t *param_kinds, 
+		param_t *params, js_writer_t *w )
+{
+	/* Most commands have a single parameter */
+	param_kind_t param_kind = param_kinds[0];
+	param_t param = params[0];
+
 	/* Execute */
 	if (!strcmp(cmd_name, "play"))
 	{
@@ -313,17 +877,17 @@ bool_t server_conn_exec_command(server_conn_desc_t *d)
 	}
 	else if (!strcmp(cmd_name, "get_cur_song"))
 	{
-		JsonObject *js = json_object_new();
 		int cur_song = player_plist->m_cur_song;
 
-		json_object_set_int_member(js, "position", cur_song);
+		js_writer_begin_object(w);
+		js_writer_int_member(w, "position", cur_song);
 		if (cur_song >= 0)
 		{
 			const char *status = "";
 			song_t *s = player_plist->m_list[cur_song];
-			json_object_set_string_member(js, "title", STR_TO_CPTR(s->m_title));
-			json_object_set_int_member(js, "time", player_context->m_cur_time);
-			json_object_set_int_member(js, "length", s->m_len);
+			js_writer_string_member(w, "title", STR_TO_CPTR(s->m_title));
+			js_writer_int_member(w, "time", player_context->m_cur_time);
+			js_writer_int_member(w, "length", s->m_len);
 
 			if (player_context->m_status == PLAYER_STATUS_PLAYING)
 				status = "playing";
@@ -331,32 +895,137 @@ bool_t server_conn_exec_command(server_conn_desc_t *d)
 				status = "paused";
 			else if (player_context->m_status == PLAYER_STATUS_STOPPED)
 				status = "stopped";
-			json_object_set_string_member(js, "play_status", status);
+			js_writer_string_member(w, "play_status", status);
 		}
-
-		server_conn_response(d, js_make_node(js));
+		js_writer_end_object(w);
 	}
 	else if (!strcmp(cmd_name, "get_playlist"))
 	{
-		JsonArray *js = json_array_new();
-
-		for ( int i = 0; i < player_plist->m_len; i++ )
+		/* Without parameters the whole list of titles and lengths is sent */
+		if (!num_params)
+		{
+			js_writer_begin_array(w);
+			plist_lock(player_plist);
+			for ( int i = 0; i < player_plist->m_len; i++ )
+			{
+				server_client_write_song(w, player_plist->m_list[i], 
+						SERVER_DEF_FIELDS);
+			}
+			plist_unlock(player_plist);
+			js_writer_end_array(w);
+		}
+		/* Parameters are offset, limit (negative for no limit) and 
+		 * comma-separated fields list; all are optional */
+		else
 		{
-			JsonObject *js_child = json_object_new();
-			song_t *s = player_plist->m_list[i];
-			json_object_set_string_member(js_child, "title", STR_TO_CPTR(s->m_title));
-			json_object_set_int_member(js_child, "length", s->m_len);
+			int offset = 0, limit = -1, num_numbers = 0;
+			int fields = SERVER_DEF_FIELDS;
+			for ( int i = 0; i < num_params; i++ )
+			{
+				if (param_kinds[i] == PARAM_STRING)
+					fields = server_client_parse_fields(params[i].str_param);
+				else if (num_numbers++ == 0)
+					offset = server_client_param_int(&params[i]);
+				else
+					limit = server_client_param_int(&params[i]);
+			}
+			if (offset < 0)
+				offset = 0;
+
+			js_writer_begin_object(w);
+			js_writer_int_member(w, "offset", offset);
+
+			plist_lock(player_plist);
+			js_writer_int_member(w, "version", player_plist->m_version);
+			js_writer_int_member(w, "total", player_plist->m_len);
+			int end = player_plist->m_len;
+			if (limit >= 0 && limit < end - offset)
+				end = offset + limit;
+			js_writer_key(w, "songs");
+			js_writer_begin_array(w);
+			for ( int i = offset; i < end; i++ )
+				server_client_write_song(w, player_plist->m_list[i], fields);
+			js_writer_end_array(w);
+			plist_unlock(player_plist);
 
-			json_array_add_object_element(js, js_child);
+			js_writer_end_object(w);
 		}
+	}
+	else if (!strcmp(cmd_name, "subscribe_changes"))
+	{
+		/* Changes are sent starting from the given version or from the 
+		 * current one. Response contains changes client has missed */
+		uint64_t since, version;
+
+		plist_lock(player_plist);
+		since = player_plist->m_version;
+		plist_unlock(player_plist);
+		if (param_kind == PARAM_NUMBER && param.num_param >= 0 && 
+				param.num_param <= since)
+			since = (uint64_t)param.num_param;
 
-		server_conn_response(d, js_make_array_node(js));
+		js_writer_begin_object(w);
+		server_client_write_changes(w, since, &version);
+		js_writer_end_object(w);
+		d->m_changes_subscribed = TRUE;
+		d->m_changes_version = version;
+	}
+	else if (!strcmp(cmd_name, "unsubscribe_changes"))
+	{
+		d->m_changes_subscribed = FALSE;
+	}
+	else if (!strcmp(cmd_name, "subscribe_time"))
+	{
+		/* Parameter is the notifications interval in milliseconds */
+		int interval = SERVER_DEF_TIME_INTERVAL;
+		if (param_kind == PARAM_NUMBER)
+			interval = server_client_param_int(&param);
+		if (interval < SERVER_MIN_TIME_INTERVAL)
+			interval = SERVER_MIN_TIME_INTERVAL;
+
+		d->m_time_interval = interval;
+		d->m_time_next = 0;
+		d->m_time_sent = -1;
+		server_conn_notify_time(d);
+	}
+	else if (!strcmp(cmd_name, "unsubscribe_time"))
+	{
+		d->m_time_interval = 0;
+	}
+	else if (!strcmp(cmd_name, "get_changes"))
+	{
+		uint64_t since = 0, version;
+		if (param_kind == PARAM_NUMBER && param.num_param >= 0)
+			since = (uint64_t)param.num_param;
+		js_writer_begin_object(w);
+		server_client_write_changes(w, since, &version);
+		js_writer_end_object(w);
+	}
+	else if (!strcmp(cmd_name, "protocol"))
+	{
+		/* Client tells the protocol version it supports; the one to be
+		 * used is responded */
+		int version = SERVER_PROTOCOL_VERSION;
+		if (param_kind == PARAM_NUMBER)
+			version = server_client_param_int(&param);
+		if (version < 1)
+			version = 1;
+		if (version > SERVER_PROTOCOL_VERSION)
+			version = SERVER_PROTOCOL_VERSION;
+
+		js_writer_begin_object(w);
+		js_writer_int_member(w, "protocol", version);
+		js_writer_end_object(w);
+
+		/* This response still goes with the old framing */
+		d->m_protocol = version;
 	}
 	else if (!strcmp(cmd_name, "get_volume"))
 	{
-		JsonObject *js = json_object_new();
-		json_object_set_double_member(js, "volume", player_context->m_volume);
-		server_conn_response(d, js_make_node(js));
+		js_writer_begin_object(w);
+		js_writer_key(w, "volume");
+		js_writer_double(w, player_context->m_volume);
+		js_writer_end_object(w);
 	}
 	else if (!strcmp(cmd_name, "set_volume"))
 	{
@@ -367,20 +1036,87 @@ bool_t server_conn_exec_command(server_conn_desc_t *d)
 	}
 	else if (!strcmp(cmd_name, "list_dir"))
 	{
-		JsonArray *js = json_array_new();
-		if (param_kind == PARAM_STRING)
-			server_conn_list_dir(param.str_param, js);
-		server_conn_response(d, js_make_array_node(js));
+		/* Parameters are directory name, then optional offset, limit 
+		 * (negative for no limit) and name prefix. With any of them
+		 * a page object is sent instead of plain entries array */
+		char *name = NULL, *prefix = NULL;
+		int offset = 0, limit = -1, num_numbers = 0;
+		for ( int i = 0; i < num_params; i++ )
+		{
+			if (param_kinds[i] != PARAM_STRING)
+			{
+				if (num_numbers++ == 0)
+					offset = server_client_param_int(&params[i]);
+				else
+					limit = server_client_param_int(&params[i]);
+			}
+			else if (!name)
+				name = params[i].str_param;
+			else
+				prefix = params[i].str_param;
+		}
+
+		if (name)
+			server_conn_list_dir(name, offset, limit, prefix, 
+					num_params > 1, w);
+		else
+		{
+			js_writer_begin_array(w);
+			js_writer_end_array(w);
+		}
+	}
+	else if (!strcmp(cmd_name, "get_stats"))
+	{
+		server_write_stats(w);
+	}
+	else if (!strcmp(cmd_name, "search"))
+	{
+		/* Parameters are query, then optional comma-separated fields 
+		 * list and matches limit (negative for no limit) */
+		char *query = NULL;
+		int fields = SERVER_DEF_FIELDS, limit = -1;
+		for ( int i = 0; i < num_params; i++ )
+		{
+			if (param_kinds[i] != PARAM_STRING)
+				limit = server_client_param_int(&params[i]);
+			else if (!query)
+				query = params[i].str_param;
+			else
+				fields = server_client_parse_fields(params[i].str_param);
+		}
+
+		if (query)
+			server_conn_search(query, fields, limit, w);
 	}
 	else if (!strcmp(cmd_name, "add"))
 	{
+		/* Files are added by a job; its progress is notified */
 		if (param_kind == PARAM_STRING)
 		{
 			char *real_name = translate_file_name(param.str_param);
-			plist_add(player_plist, real_name);
-			free(real_name);
+			int id = -1;
+			if (real_name)
+			{
+				id = server_job_start(d, real_name);
+				free(real_name);
+			}
+
+			js_writer_begin_object(w);
+			js_writer_int_member(w, "job", id);
+			js_writer_end_object(w);
+		}
+	}
+	else if (!strcmp(cmd_name, "cancel_job"))
+	{
+		if (param_kind == PARAM_NUMBER)
+		{
+			int id = server_client_param_int(&param);
+
+			js_writer_begin_object(w);
+			js_writer_int_member(w, "job", id);
+			js_writer_boolean_member(w, "cancelled", server_job_cancel(id));
+			js_writer_end_object(w);
 		}
-					
 	}
 	else if (!strcmp(cmd_name, "remove"))
 	{
@@ -400,6 +1136,52 @@ bool_t server_conn_exec_command(server_conn_desc_t *d)
 			player_queue_song();
 		}
 	}
+	else if (!strcmp(cmd_name, "get_queue"))
+	{
+		js_writer_begin_array(w);
+		plist_lock(player_plist);
+		pq_lock(player_queue);
+		for ( int i = 0; i < player_queue->m_len; i++ )
+		{
+			song_t *s = pq_get(player_queue, i);
+			int pos = -1;
+			for ( int j = 0; j < player_plist->m_len; j++ )
+			{
+				if (player_plist->m_list[j] == s)
+				{
+					pos = j;
+					break;
+				}
+			}
+			js_writer_begin_object(w);
+			js_writer_int_member(w, "position", pos);
+			js_writer_string_member(w, "title", STR_TO_CPTR(s->m_title));
+			js_writer_int_member(w, "length", s->m_len);
+			js_writer_end_object(w);
+		}
+		pq_unlock(player_queue);
+		plist_unlock(player_plist);
+		js_writer_end_array(w);
+	}
+	else if (!strcmp(cmd_name, "queue_move"))
+	{
+		if (num_params == 2 && param_kinds[0] == PARAM_NUMBER &&
+				param_kinds[1] == PARAM_NUMBER)
+		{
+			pq_move(player_queue, params[0].num_param, params[1].num_param);
+		}
+	}
+	else if (!strcmp(cmd_name, "unqueue"))
+	{
+		if (param_kind == PARAM_NUMBER)
+		{
+			pq_remove(player_queue, param.num_param);
+		}
+	}
+	else if (!strcmp(cmd_name, "clear_queue"))
+	{
+		pq_clear(player_queue);
+	}
 	else if (!strcmp(cmd_name, "seek"))
 	{
 		if (param_kind == PARAM_NUMBER)
@@ -414,11 +1196,232 @@ bool_t server_conn_exec_command(server_conn_desc_t *d)
 	}
 	else if (!strcmp(cmd_name, "bye"))
 	{
+		return SERVER_EXEC_BYE;
+	}
+	else
+	{
+		logger_debug(player_log, "Unknown command '%s'", cmd_name);
+		return SERVER_EXEC_UNKNOWN;
+	}
+	return SERVER_EXEC_OK;
+} /* End of 'server_conn_exec' function */
+
+/* Get command name and parameters from a JSON array */
+static bool_t server_client_parse_json_cmd( JsonNode *node, char **cmd_name,
+										int *num_params, param_kind_t *param_kinds, 
+										param_t *params )
+{
+	if (!node || !JSON_NODE_HOLDS_ARRAY(node))
+		return FALSE;
+
+	JsonArray *js = json_node_get_array(node);
+	int len = json_array_get_length(js);
+	if (len < 1 || len > SERVER_MAX_PARAMS + 1)
 		return FALSE;
+
+	for ( int i = 0; i < SERVER_MAX_PARAMS; i++ )
+		param_kinds[i] = PARAM_NONE;
+	for ( int i = 0; i < len; i++ )
+	{
+		JsonNode *js_param = json_array_get_element(js, i);
+		if (!JSON_NODE_HOLDS_VALUE(js_param))
+			return FALSE;
+
+		GType type = json_node_get_value_type(js_param);
+		if (type == G_TYPE_STRING)
+		{
+			char *str = (char *)json_node_get_string(js_param);
+			if (i == 0)
+				(*cmd_name) = str;
+			else
+			{
+				param_kinds[i - 1] = PARAM_STRING;
+				params[i - 1].str_param = str;
+			}
+		}
+		else if (i > 0 && type == G_TYPE_INT64)
+		{
+			param_kinds[i - 1] = PARAM_NUMBER;
+			params[i - 1].num_param = json_node_get_int(js_param);
+		}
+		else if (i > 0 && type == G_TYPE_DOUBLE)
+		{
+			param_kinds[i - 1] = PARAM_NUMBER;
+			params[i - 1].num_param = json_node_get_double(js_param);
+		}
+		else
+			return FALSE;
+	}
+	(*num_params) = len - 1;
+	return TRUE;
+} /* End of 'server_client_parse_json_cmd' function */
+
+/* Check if command is to be executed by the main thread */
+static bool_t server_client_for_main_thread( char *cmd )
+{
+	size_t len;
+
+	for ( len = 0; isalnum(cmd[len]) || cmd[len] == '_'; len++ )
+		;
+	for ( int i = 0; server_main_thread_cmds[i]; i++ )
+	{
+		if (strlen(server_main_thread_cmds[i]) == len &&
+				!strncmp(server_main_thread_cmds[i], cmd, len))
+			return TRUE;
+	}
+	return FALSE;
+} /* End of 'server_client_for_main_thread' function */
+
+/* Execute a batch of commands. Parameter is a JSON array of commands,
+ * each being an array of command name and parameters. Response is an
+ * array of the commands responses; commands without response give 
+ * 'true' and failed ones give 'false'. Batch is executed by the main 
+ * thread, so commands not changing player state are refused */
+static server_exec_status_t server_conn_exec_batch( server_conn_desc_t *d,
+		char *batch, js_writer_t *w )
+{
+	JsonParser *parser = json_parser_new();
+	JsonNode *root;
+	server_exec_status_t ret = SERVER_EXEC_OK;
+
+	if (!json_parser_load_from_data(parser, batch, -1, NULL))
+		goto failed;
+	root = json_parser_get_root(parser);
+	if (!root || !JSON_NODE_HOLDS_ARRAY(root))
+		goto failed;
+
+	JsonArray *js_cmds = json_node_get_array(root);
+	int num_cmds = json_array_get_length(js_cmds);
+	js_writer_begin_array(w);
+	for ( int i = 0; i < num_cmds && ret != SERVER_EXEC_BYE; i++ )
+	{
+		char *cmd_name;
+		int num_params;
+		param_kind_t param_kinds[SERVER_MAX_PARAMS];
+		param_t params[SERVER_MAX_PARAMS];
+		size_t was_total = w->m_total;
+		server_exec_status_t status = SERVER_EXEC_UNKNOWN;
+
+		if (server_client_parse_json_cmd(json_array_get_element(js_cmds, i),
+					&cmd_name, &num_params, param_kinds, params) &&
+				server_client_for_main_thread(cmd_name) &&
+				strcmp(cmd_name, "batch"))
+		{
+			status = server_conn_exec(d, cmd_name, num_params, param_kinds,
+					params, w);
+		}
+		if (status == SERVER_EXEC_BYE)
+			ret = SERVER_EXEC_BYE;
+
+		/* Command has written nothing */
+		if (w->m_total == was_total)
+			js_writer_boolean(w, status != SERVER_EXEC_UNKNOWN);
 	}
+	js_writer_end_array(w);
+
+	g_object_unref(parser);
+	return ret;
+
+failed:
+	logger_debug(player_log, "Error parsing batch");
+	g_object_unref(parser);
+	return SERVER_EXEC_UNKNOWN;
+} /* End of 'server_conn_exec_batch' function */
+
+/* Parse and execute a command line */
+static server_exec_status_t server_conn_exec_line( server_conn_desc_t *d,
+		char *cmd, js_writer_t *w )
+{
+	char *cmd_name;
+	int num_params;
+	param_kind_t param_kinds[SERVER_MAX_PARAMS];
+	param_t params[SERVER_MAX_PARAMS];
+
+	/* Batch has a JSON parameter */
+	if (!strncmp(cmd, "batch ", 6))
+		return server_conn_exec_batch(d, &cmd[6], w);
+
+	if (!server_client_parse_cmd(cmd, &cmd_name, &num_params, 
+				param_kinds, params))
+	{
+		logger_debug(player_log, "Error parsing command");
+		return SERVER_EXEC_UNKNOWN;
+	}
+	return server_conn_exec(d, cmd_name, num_params, param_kinds, 
+			params, w);
+} /* End of 'server_conn_exec_line' function */
+
+/* Execute a command received from client */
+bool_t server_conn_exec_command(server_conn_desc_t *d, char *cmd)
+{
+	server_response_t r;
+	server_exec_status_t status;
+	int time_interval = d->m_time_interval;
+	int64_t start = server_stats_now();
+
+	logger_debug(player_log, "Received command '%s'", cmd);
+
+	/* Player state is changed only by the main thread. Response is sent
+	 * when it is done. If the command can't be passed there (no memory or
+	 * player is shutting down) it fails */
+	bool_t main_thread = server_client_for_main_thread(cmd);
+	if (main_thread && server_call_post(d, cmd, !strncmp(cmd, "batch ", 6)))
+		return TRUE;
+
+	server_response_init(&r, d, FALSE);
+	if (main_thread)
+	{
+		logger_debug(player_log, "Command '%s' is not executed", cmd);
+		js_writer_boolean(&r.m_writer, FALSE);
+		status = SERVER_EXEC_UNKNOWN;
+	}
+	else
+		status = server_conn_exec_line(d, cmd, &r.m_writer);
+	server_response_finish(&r);
+	server_stats_command(cmd, server_stats_now() - start);
+
+	if (d->m_time_interval != time_interval)
+		server_update_time_timer();
+
+	if (status == SERVER_EXEC_BYE)
+		return FALSE;
 	wnd_invalidate(player_wnd);
 	return TRUE;
 } /* End of 'server_conn_exec_command' function */
 
+/* Execute command passed to the main thread */
+void server_conn_exec_call( server_call_t *call )
+{
+	server_response_t r;
+	server_exec_status_t status;
+
+	/* Batch goes as a whole: songs added by jobs wait for it, and the
+	 * server thread doesn't read play list or notify meanwhile */
+	if (call->m_exclusive)
+		plist_hold(player_plist);
+	server_response_init(&r, call->m_conn, TRUE);
+	status = server_conn_exec_line(call->m_conn, call->m_cmd, &r.m_writer);
+	server_response_finish(&r);
+	if (call->m_exclusive)
+		plist_release(player_plist);
+
+	call->m_body = r.m_body.m_data;
+	call->m_body_len = r.m_body.m_len;
+	call->m_bye = (status == SERVER_EXEC_BYE);
+	if (!call->m_bye)
+		wnd_invalidate(player_wnd);
+} /* End of 'server_conn_exec_call' function */
+
+/* Send response of the command executed by the main thread. Returns 
+ * FALSE if connection is to be closed */
+bool_t server_conn_finish_call( server_call_t *call )
+{
+	server_stats_command(call->m_cmd, server_stats_now() - call->m_start);
+	if (call->m_body_len)
+		server_conn_send_response(call->m_conn, call->m_body, 
+				call->m_body_len);
+	return !call->m_bye;
+} /* End of 'server_conn_finish_call' function */
+
 /* End of 'server_client.c' file */
 
@@ -23,37 +23,127 @@
 #ifndef __SG_MPFC_SERVER_CLIENT_H__
 #define __SG_MPFC_SERVER_CLIENT_H__
 
-#include <pthread.h>
-#include "mystring.h"
-#include "rd_with_notify.h"
+#include <stdint.h>
+#include "types.h"
+
+struct tag_server_call_t;
 
 /* Connection descriptor */
 typedef struct tag_server_conn_desc_t
 {
 	int m_socket;
-	pthread_t m_tid;
-	rd_with_notify_t *m_rdwn;
 
-	char m_buf[1024];
-	int m_buf_pos;
-	str_t *m_cur_cmd;
+	/* Received data. Commands are parsed in place; first 'm_in_scanned'
+	 * bytes are known to have no line end */
+	char *m_in;
+	size_t m_in_len, m_in_scanned, m_in_size;
+
+	/* Data waiting for the socket to become writable */
+	char *m_out;
+	size_t m_out_len, m_out_pos, m_out_size;
+
+	/* Events the connection is waiting for */
+	uint32_t m_events;
+
+	/* Connection is closed after output is sent */
+	bool_t m_closing;
+
+	/* Connection is to be destroyed */
+	bool_t m_dead;
+
+	/* Notifications postponed until client reads its output (bit 
+	 * per notification code) */
+	unsigned m_notify_pending;
+
+	/* Protocol version used by client */
+	int m_protocol;
+
+	/* Response is being sent; notifications must wait */
+	bool_t m_responding;
+
+	/* Client receives play list changes starting from this version */
+	bool_t m_changes_subscribed;
+	uint64_t m_changes_version;
+
+	/* Play time notifications interval in milliseconds (0 if client is 
+	 * not subscribed), time of the next notification and the last sent
+	 * position */
+	int m_time_interval;
+	int64_t m_time_next;
+	int64_t m_time_sent;
+	int m_time_song;
+
+	/* Command being executed by the main thread. Server thread doesn't
+	 * touch the connection until it is done */
+	struct tag_server_call_t *m_call;
 
 	struct tag_server_conn_desc_t *m_next, *m_prev;
 } server_conn_desc_t;
 
+/* Command passed to the main thread and its result */
+typedef struct tag_server_call_t
+{
+	server_conn_desc_t *m_conn;
+	char *m_cmd;
+
+	/* Response body (without header) and whether client said 'bye' */
+	char *m_body;
+	size_t m_body_len;
+	bool_t m_bye;
+
+	/* Time the command was received (for statistics) */
+	int64_t m_start;
+
+	/* Other clients wait until the call is done, and the play list is
+	 * held while it is executed */
+	bool_t m_exclusive;
+
+	struct tag_server_call_t *m_next;
+} server_call_t;
+
+/* Protocol version supported by the server and the version which 
+ * introduced chunked responses */
+#define SERVER_PROTOCOL_VERSION 2
+#define SERVER_PROTOCOL_CHUNKED 2
+
 /* Notification codes */
 enum
 {
 	SERVER_NOTIFY_EXIT = 0,
 	SERVER_NOTIFY_PLAYLIST,
 	SERVER_NOTIFY_STATUS,
+	SERVER_NOTIFY_PLAYLIST_INFO,
+	SERVER_NOTIFY_TIME,
+	SERVER_NOTIFY_CALLS,
+	SERVER_NOTIFY_JOBS,
 };
 
+/* Notification bit in pending masks */
+#define SERVER_NOTIFY_BIT(nv) (1u << (nv))
+
+/* Play time notification intervals limits (in milliseconds) */
+#define SERVER_MIN_TIME_INTERVAL 100
+#define SERVER_DEF_TIME_INTERVAL 1000
+
 /* Send a notification to client */
 void server_conn_client_notify(server_conn_desc_t *d, char nv);
 
-/* Execute a command received from client */
-bool_t server_conn_exec_command(server_conn_desc_t *d);
+/* Send play time to a subscribed client if it has changed */
+void server_conn_notify_time(server_conn_desc_t *d);
+
+/* Send job progress to client */
+void server_conn_notify_job( server_conn_desc_t *d, int id, int added,
+		const char *state );
+
+/* Execute a command received from client. Command string is modified */
+bool_t server_conn_exec_command(server_conn_desc_t *d, char *cmd);
+
+/* Execute command passed to the main thread */
+void server_conn_exec_call( server_call_t *call );
+
+/* Send response of the command executed by the main thread. Returns 
+ * FALSE if connection is to be closed */
+bool_t server_conn_finish_call( server_call_t *call );
 
 #endif
 
@@ -0,0 +1,157 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Remote control server statistics implementation.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "server_stats.h"
+
+/* Counters */
+server_stats_t server_stats;
+
+/* Reset counters */
+void server_stats_reset( void )
+{
+	memset(&server_stats, 0, sizeof(server_stats));
+	strcpy(server_stats.m_all.m_name, "all");
+} /* End of 'server_stats_reset' function */
+
+/* Get monotonic time in microseconds */
+int64_t server_stats_now( void )
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* End of 'server_stats_now' function */
+
+/* Find command type counters */
+static server_cmd_stats_t *server_stats_find( const char *cmd )
+{
+	char name[SERVER_STATS_NAME_LEN];
+	size_t len;
+
+	/* Command name is the leading word */
+	for ( len = 0; isalnum(cmd[len]) || cmd[len] == '_'; len++ )
+		;
+	if (len == 0)
+		strcpy(name, "unknown");
+	else if (len >= sizeof(name))
+		strcpy(name, "other");
+	else
+	{
+		memcpy(name, cmd, len);
+		name[len] = 0;
+	}
+
+	for ( int i = 0; i < server_stats.m_num_cmds; i++ )
+	{
+		if (!strcmp(server_stats.m_cmds[i].m_name, name))
+			return &server_stats.m_cmds[i];
+	}
+
+	/* Last slot is shared by the commands not fitting into table */
+	server_cmd_stats_t *s;
+	if (server_stats.m_num_cmds == SERVER_STATS_MAX_CMDS - 1)
+		strcpy(name, "other");
+	if (server_stats.m_num_cmds == SERVER_STATS_MAX_CMDS)
+		return &server_stats.m_cmds[SERVER_STATS_MAX_CMDS - 1];
+	s = &server_stats.m_cmds[server_stats.m_num_cmds++];
+	strcpy(s->m_name, name);
+	return s;
+} /* End of 'server_stats_find' function */
+
+/* Add time to counters */
+static void server_stats_add_time( server_cmd_stats_t *s, uint64_t us )
+{
+	int bucket = 0;
+
+	while (bucket < SERVER_STATS_BUCKETS - 1 && (us >> bucket) != 0)
+		bucket++;
+	s->m_hist[bucket]++;
+	s->m_count++;
+	s->m_total_us += us;
+	if (us > s->m_max_us)
+		s->m_max_us = us;
+} /* End of 'server_stats_add_time' function */
+
+/* Register command execution */
+void server_stats_command( const char *cmd, int64_t elapsed_us )
+{
+	if (elapsed_us < 0)
+		elapsed_us = 0;
+	server_stats_add_time(&server_stats.m_all, elapsed_us);
+	server_stats_add_time(server_stats_find(cmd), elapsed_us);
+} /* End of 'server_stats_command' function */
+
+/* Get time percentile estimate (histogram bucket upper bound) */
+static uint64_t server_stats_percentile( server_cmd_stats_t *s, int p )
+{
+	uint64_t need = (s->m_count * p + 99) / 100, num = 0;
+
+	for ( int i = 0; i < SERVER_STATS_BUCKETS; i++ )
+	{
+		num += s->m_hist[i];
+		if (num >= need)
+		{
+			uint64_t bound = (uint64_t)1 << i;
+			return (bound < s->m_max_us ? bound : s->m_max_us);
+		}
+	}
+	return s->m_max_us;
+} /* End of 'server_stats_percentile' function */
+
+/* Write command type counters */
+static void server_stats_write_cmd( js_writer_t *w, server_cmd_stats_t *s )
+{
+	js_writer_begin_object(w);
+	js_writer_string_member(w, "name", s->m_name);
+	js_writer_int_member(w, "count", s->m_count);
+	js_writer_int_member(w, "mean_us", 
+			s->m_count ? s->m_total_us / s->m_count : 0);
+	js_writer_int_member(w, "p50_us", server_stats_percentile(s, 50));
+	js_writer_int_member(w, "p90_us", server_stats_percentile(s, 90));
+	js_writer_int_member(w, "p99_us", server_stats_percentile(s, 99));
+	js_writer_int_member(w, "max_us", s->m_max_us);
+	js_writer_end_object(w);
+} /* End of 'server_stats_write_cmd' function */
+
+/* Write counters as members of the current object */
+void server_stats_write( js_writer_t *w )
+{
+	js_writer_int_member(w, "bytes_in", server_stats.m_bytes_in);
+	js_writer_int_member(w, "bytes_out", server_stats.m_bytes_out);
+	js_writer_int_member(w, "connections_total", server_stats.m_connections);
+	js_writer_int_member(w, "notifications", server_stats.m_notifications);
+
+	js_writer_key(w, "latency");
+	server_stats_write_cmd(w, &server_stats.m_all);
+	js_writer_key(w, "commands");
+	js_writer_begin_array(w);
+	for ( int i = 0; i < server_stats.m_num_cmds; i++ )
+		server_stats_write_cmd(w, &server_stats.m_cmds[i]);
+	js_writer_end_array(w);
+} /* End of 'server_stats_write' function */
+
+/* End of 'server_stats.c' file */
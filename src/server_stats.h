@@ -0,0 +1,78 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Remote control server statistics interface.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+
+#ifndef __SG_MPFC_SERVER_STATS_H__
+#define __SG_MPFC_SERVER_STATS_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "json_helpers.h"
+
+/* Number of latency histogram buckets. Bucket 'i' counts times below 
+ * 2^i microseconds */
+#define SERVER_STATS_BUCKETS 24
+
+/* Maximal number of command types counted separately and command name
+ * length. The rest are counted as 'other' */
+#define SERVER_STATS_MAX_CMDS 48
+#define SERVER_STATS_NAME_LEN 24
+
+/* Command execution times */
+typedef struct
+{
+	char m_name[SERVER_STATS_NAME_LEN];
+	uint64_t m_count;
+	uint64_t m_total_us, m_max_us;
+	uint64_t m_hist[SERVER_STATS_BUCKETS];
+} server_cmd_stats_t;
+
+/* Server counters. They are changed by the server thread only */
+typedef struct
+{
+	uint64_t m_bytes_in, m_bytes_out;
+	uint64_t m_connections;
+	uint64_t m_notifications;
+
+	/* All commands and commands by type */
+	server_cmd_stats_t m_all;
+	server_cmd_stats_t m_cmds[SERVER_STATS_MAX_CMDS];
+	int m_num_cmds;
+} server_stats_t;
+
+extern server_stats_t server_stats;
+
+/* Reset counters */
+void server_stats_reset( void );
+
+/* Get monotonic time in microseconds */
+int64_t server_stats_now( void );
+
+/* Register command execution. 'cmd' is the command line */
+void server_stats_command( const char *cmd, int64_t elapsed_us );
+
+/* Write counters as members of the current object */
+void server_stats_write( js_writer_t *w );
+
+#endif
+
+/* End of 'server_stats.h' file */
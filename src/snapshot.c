@@ -0,0 +1,358 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Binary player state snapshot functions implementation.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <glib.h>
+#include "types.h"
+#include "journal.h"
+#include "player.h"
+#include "plist.h"
+#include "snapshot.h"
+#include "song.h"
+#include "song_info.h"
+#include "util.h"
+
+/* String table being built */
+typedef struct
+{
+	/* Strings data */
+	char *m_data;
+	size_t m_len, m_allocated;
+
+	/* Offsets of already added strings (lots of strings like artist or
+	 * album names are repeated) */
+	GHashTable *m_index;
+} snapshot_strings_t;
+
+/* Add a string to the table. Returns string offset */
+static uint32_t snapshot_add_string( snapshot_strings_t *st, const char *str )
+{
+	gpointer offset;
+
+	if (str == NULL)
+		return SNAPSHOT_NO_STRING;
+
+	/* Already added */
+	if (g_hash_table_lookup_extended(st->m_index, str, NULL, &offset))
+		return GPOINTER_TO_UINT(offset);
+
+	/* Reallocate memory */
+	size_t len = strlen(str) + 1;
+	if (st->m_len + len >= SNAPSHOT_NO_STRING)
+		return SNAPSHOT_NO_STRING;
+	if (st->m_len + len > st->m_allocated)
+	{
+		size_t allocated = st->m_allocated ? st->m_allocated : 4096;
+		while (allocated < st->m_len + len)
+			allocated *= 2;
+		char *data = (char *)realloc(st->m_data, allocated);
+		if (data == NULL)
+			return SNAPSHOT_NO_STRING;
+		st->m_data = data;
+		st->m_allocated = allocated;
+	}
+
+	uint32_t res = st->m_len;
+	memcpy(&st->m_data[st->m_len], str, len);
+	st->m_len += len;
+	g_hash_table_insert(st->m_index, strdup(str), GUINT_TO_POINTER(res));
+	return res;
+} /* End of 'snapshot_add_string' function */
+
+/* Fill song record */
+static void snapshot_fill_record( snapshot_song_t *r, song_t *s, 
+		snapshot_strings_t *st )
+{
+	memset(r, 0, sizeof(*r));
+	r->m_fullname = snapshot_add_string(st, s->m_fullname);
+	r->m_filename = snapshot_add_string(st, s->m_filename);
+	r->m_title = snapshot_add_string(st, s->m_default_title);
+	r->m_len = s->m_full_len;
+	r->m_start_time = s->m_start_time;
+	r->m_end_time = s->m_end_time;
+	for ( int i = 0; i < SNAPSHOT_NUM_INFO; i ++ )
+		r->m_info[i] = SNAPSHOT_NO_STRING;
+
+	song_lock(s);
+	song_info_t *si = s->m_info;
+	if (si && (si->m_flags & SI_INITIALIZED))
+	{
+		r->m_flags |= SNAPSHOT_SONG_HAS_INFO;
+		if (s->m_flags & SONG_STATIC_INFO)
+			r->m_flags |= SNAPSHOT_SONG_STATIC_INFO;
+		r->m_info[SNAPSHOT_INFO_ARTIST] = snapshot_add_string(st, si->m_artist);
+		r->m_info[SNAPSHOT_INFO_NAME] = snapshot_add_string(st, si->m_name);
+		r->m_info[SNAPSHOT_INFO_ALBUM] = snapshot_add_string(st, si->m_album);
+		r->m_info[SNAPSHOT_INFO_YEAR] = snapshot_add_string(st, si->m_year);
+		r->m_info[SNAPSHOT_INFO_GENRE] = snapshot_add_string(st, si->m_genre);
+		r->m_info[SNAPSHOT_INFO_COMMENTS] = 
+			snapshot_add_string(st, si->m_comments);
+		r->m_info[SNAPSHOT_INFO_TRACK] = snapshot_add_string(st, si->m_track);
+		r->m_info[SNAPSHOT_INFO_OWN_DATA] = 
+			snapshot_add_string(st, si->m_own_data);
+	}
+	song_unlock(s);
+} /* End of 'snapshot_fill_record' function */
+
+/* Save play list and player state to a snapshot file (play list may be
+ * NULL to save only the state) */
+bool_t snapshot_save( const char *filename, plist_t *pl, 
+		snapshot_state_t *state )
+{
+	bool_t ret = FALSE;
+	FILE *fd = NULL;
+	snapshot_song_t *records = NULL;
+	snapshot_header_t header;
+	snapshot_strings_t st;
+	char *tmp_name = util_strcat(filename, ".tmp", NULL);
+
+	memset(&st, 0, sizeof(st));
+	st.m_index = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.m_version = SNAPSHOT_VERSION;
+	header.m_record_size = sizeof(snapshot_song_t);
+
+	/* Build records and string table */
+	if (pl != NULL)
+		plist_lock(pl);
+	header.m_journal_seq = jrn_get_seq();
+	header.m_num_songs = (pl != NULL) ? pl->m_len : 0;
+	records = (snapshot_song_t *)malloc(sizeof(*records) * 
+			(header.m_num_songs ? header.m_num_songs : 1));
+	if (records == NULL)
+	{
+		if (pl != NULL)
+			plist_unlock(pl);
+		goto finally;
+	}
+	for ( uint32_t i = 0; i < header.m_num_songs; i ++ )
+		snapshot_fill_record(&records[i], pl->m_list[i], &st);
+	if (pl != NULL)
+		plist_unlock(pl);
+
+	header.m_strings_size = st.m_len;
+	header.m_cur_time = state->m_cur_time;
+	header.m_cur_song = state->m_cur_song;
+	header.m_status = state->m_status;
+	header.m_start = state->m_start;
+	header.m_end = state->m_end;
+	header.m_volume = state->m_volume;
+
+	/* Write to a temporary file and then replace the snapshot at once */
+	fd = fopen(tmp_name, "wb");
+	if (fd == NULL)
+		goto finally;
+	if (fwrite(&header, sizeof(header), 1, fd) != 1)
+		goto finally;
+	if (header.m_num_songs && fwrite(records, sizeof(*records), 
+				header.m_num_songs, fd) != header.m_num_songs)
+		goto finally;
+	if (st.m_len && fwrite(st.m_data, 1, st.m_len, fd) != st.m_len)
+		goto finally;
+	if (fflush(fd) || fsync(fileno(fd)))
+		goto finally;
+	ret = (fclose(fd) == 0);
+	fd = NULL;
+	if (ret && rename(tmp_name, filename))
+		ret = FALSE;
+
+finally:
+	if (fd != NULL)
+		fclose(fd);
+	if (!ret)
+	{
+		logger_error(player_log, 0, _("Unable to save state snapshot %s: %s"),
+				filename, strerror(errno));
+		unlink(tmp_name);
+	}
+	if (records != NULL)
+		free(records);
+	if (st.m_data != NULL)
+		free(st.m_data);
+	g_hash_table_destroy(st.m_index);
+	free(tmp_name);
+	return ret;
+} /* End of 'snapshot_save' function */
+
+/* Get string from the table */
+static const char *snapshot_get_string( const char *strings, uint64_t size,
+		uint32_t offset )
+{
+	if (offset == SNAPSHOT_NO_STRING || offset >= size)
+		return NULL;
+	return &strings[offset];
+} /* End of 'snapshot_get_string' function */
+
+/* Create song info from fields stored in the snapshot */
+song_info_t *snapshot_info_new( const char **fields )
+{
+	song_info_t *si = si_new();
+	if (si == NULL)
+		return NULL;
+	si_set_artist	(si, fields[SNAPSHOT_INFO_ARTIST]);
+	si_set_name		(si, fields[SNAPSHOT_INFO_NAME]);
+	si_set_album	(si, fields[SNAPSHOT_INFO_ALBUM]);
+	si_set_year		(si, fields[SNAPSHOT_INFO_YEAR]);
+	si_set_genre	(si, fields[SNAPSHOT_INFO_GENRE]);
+	si_set_comments	(si, fields[SNAPSHOT_INFO_COMMENTS]);
+	si_set_track	(si, fields[SNAPSHOT_INFO_TRACK]);
+	if (fields[SNAPSHOT_INFO_OWN_DATA])
+		si_set_own_data(si, fields[SNAPSHOT_INFO_OWN_DATA]);
+	si->m_flags |= SI_INITIALIZED;
+	return si;
+} /* End of 'snapshot_info_new' function */
+
+/* Create song info from record */
+static song_info_t *snapshot_make_info( const snapshot_song_t *r, 
+		const char *strings, uint64_t size )
+{
+	const char *f[SNAPSHOT_NUM_INFO];
+
+	for ( int i = 0; i < SNAPSHOT_NUM_INFO; i ++ )
+		f[i] = snapshot_get_string(strings, size, r->m_info[i]);
+	return snapshot_info_new(f);
+} /* End of 'snapshot_make_info' function */
+
+/* Load play list and player state from a snapshot file */
+bool_t snapshot_load( const char *filename, plist_t *pl, 
+		snapshot_state_t *state )
+{
+	bool_t ret = FALSE;
+	void *data = MAP_FAILED;
+	song_t **songs = NULL;
+	struct stat st;
+	size_t size = 0;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return FALSE;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(snapshot_header_t))
+		goto finally;
+	size = st.st_size;
+
+	/* Map the file. Records are walked once from start to end */
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto finally;
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	/* Validate header */
+	const snapshot_header_t *header = (const snapshot_header_t *)data;
+	if (memcmp(header->m_magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+			header->m_version != SNAPSHOT_VERSION ||
+			header->m_record_size != sizeof(snapshot_song_t))
+	{
+		logger_error(player_log, 0, 
+				_("State snapshot %s has unsupported format"), filename);
+		goto finally;
+	}
+	uint64_t records_size = (uint64_t)header->m_num_songs * 
+		sizeof(snapshot_song_t);
+	if (sizeof(*header) + records_size + header->m_strings_size != size)
+	{
+		logger_error(player_log, 0, _("State snapshot %s is corrupted"),
+				filename);
+		goto finally;
+	}
+	const snapshot_song_t *records = (const snapshot_song_t *)(header + 1);
+	const char *strings = (const char *)records + records_size;
+	uint64_t strings_size = header->m_strings_size;
+	if (strings_size && strings[strings_size - 1] != 0)
+	{
+		logger_error(player_log, 0, _("State snapshot %s is corrupted"),
+				filename);
+		goto finally;
+	}
+
+	/* Create songs */
+	int num_songs = 0;
+	songs = (song_t **)malloc(sizeof(song_t *) * 
+			(header->m_num_songs ? header->m_num_songs : 1));
+	if (songs == NULL)
+		goto finally;
+	for ( uint32_t i = 0; i < header->m_num_songs; i ++ )
+	{
+		const snapshot_song_t *r = &records[i];
+		const char *fullname = snapshot_get_string(strings, strings_size,
+				r->m_fullname);
+		if (fullname == NULL)
+			continue;
+
+		song_metadata_t metadata = SONG_METADATA_EMPTY;
+		metadata.m_title = snapshot_get_string(strings, strings_size,
+				r->m_title);
+		metadata.m_len = r->m_len;
+		metadata.m_start_time = r->m_start_time;
+		metadata.m_end_time = r->m_end_time;
+
+		song_info_t *si = NULL;
+		if (r->m_flags & SNAPSHOT_SONG_HAS_INFO)
+			si = snapshot_make_info(r, strings, strings_size);
+		bool_t is_static_info = (r->m_flags & SNAPSHOT_SONG_STATIC_INFO);
+		if (is_static_info)
+			metadata.m_song_info = si;
+
+		song_t *s = song_new_from_names(fullname, 
+				snapshot_get_string(strings, strings_size, r->m_filename),
+				&metadata);
+		if (s == NULL)
+		{
+			if (si)
+				si_free(si);
+			continue;
+		}
+		if (!is_static_info && si)
+			song_set_info(s, si);
+		songs[num_songs++] = s;
+	}
+	plist_append_songs(pl, songs, num_songs);
+
+	/* Player state */
+	state->m_cur_song = header->m_cur_song;
+	state->m_cur_time = header->m_cur_time;
+	state->m_status = header->m_status;
+	state->m_start = header->m_start;
+	state->m_end = header->m_end;
+	state->m_volume = header->m_volume;
+	state->m_journal_seq = header->m_journal_seq;
+	ret = TRUE;
+
+finally:
+	if (songs != NULL)
+		free(songs);
+	if (data != MAP_FAILED)
+		munmap(data, size);
+	close(fd);
+	return ret;
+} /* End of 'snapshot_load' function */
+
+/* End of 'snapshot.c' file */
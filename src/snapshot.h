@@ -0,0 +1,110 @@
+/******************************************************************
+ * Copyright (C) 2011 by SG Software.
+ *
+ * SG MPFC. Interface for binary player state snapshot functions.
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or 
+ * modify it under the terms of the GNU General Public License 
+ * as published by the Free Software Foundation; either version 2 
+ * of the License, or (at your option) any later version.
+ *  
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *  
+ * You should have received a copy of the GNU General Public 
+ * License along with this program; if not, write to the Free 
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, 
+ * MA 02111-1307, USA.
+ */
+
+#ifndef __SG_MPFC_SNAPSHOT_H__
+#define __SG_MPFC_SNAPSHOT_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "main_types.h"
+
+/* Snapshot file format:
+ *  - header (snapshot_header_t)
+ *  - m_num_songs fixed-size song records (snapshot_song_t)
+ *  - string table: NUL-terminated strings referred by offsets 
+ * All numbers are stored in host byte order; the file is not meant to
+ * be moved between machines */
+#define SNAPSHOT_MAGIC		"MPFCSNP"
+#define SNAPSHOT_VERSION	2
+
+/* Offset of a missing string */
+#define SNAPSHOT_NO_STRING	0xFFFFFFFF
+
+/* Song info fields stored in the snapshot */
+#define SNAPSHOT_INFO_ARTIST	0
+#define SNAPSHOT_INFO_NAME		1
+#define SNAPSHOT_INFO_ALBUM		2
+#define SNAPSHOT_INFO_YEAR		3
+#define SNAPSHOT_INFO_GENRE		4
+#define SNAPSHOT_INFO_COMMENTS	5
+#define SNAPSHOT_INFO_TRACK		6
+#define SNAPSHOT_INFO_OWN_DATA	7
+#define SNAPSHOT_NUM_INFO		8
+
+/* Song record flags */
+#define SNAPSHOT_SONG_HAS_INFO		0x00000001
+#define SNAPSHOT_SONG_STATIC_INFO	0x00000002
+
+/* Player state stored along with the play list */
+typedef struct
+{
+	int m_cur_song;
+	song_time_t m_cur_time;
+	int m_status;
+	int m_start, m_end;
+	double m_volume;
+
+	/* Last play list journal record reflected by the snapshot */
+	uint64_t m_journal_seq;
+} snapshot_state_t;
+
+/* File header */
+typedef struct
+{
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_record_size;
+	uint32_t m_num_songs;
+	uint32_t m_reserved;
+	uint64_t m_strings_size;
+
+	/* Player state */
+	int64_t m_cur_time;
+	int32_t m_cur_song, m_status, m_start, m_end;
+	double m_volume;
+	uint64_t m_journal_seq;
+} snapshot_header_t;
+
+/* Song record */
+typedef struct
+{
+	uint32_t m_fullname, m_filename, m_title;
+	uint32_t m_flags;
+	int64_t m_len, m_start_time, m_end_time;
+	uint32_t m_info[SNAPSHOT_NUM_INFO];
+} snapshot_song_t;
+
+/* Save play list and player state to a snapshot file (play list may be
+ * NULL to save only the state) */
+bool_t snapshot_save( const char *filename, plist_t *pl, 
+		snapshot_state_t *state );
+
+/* Load play list and player state from a snapshot file */
+bool_t snapshot_load( const char *filename, plist_t *pl, 
+		snapshot_state_t *state );
+
+/* Create song info from fields stored in the snapshot */
+song_info_t *snapshot_info_new( const char **fields );
+
+#endif
+
+/* End of 'snapshot.h' file */
@@ -20,8 +20,10 @@
  * MA 02111-1307, USA.
  */
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <glib.h>
 #include <gst/gst.h>
 #include "types.h"
 #include "cfg.h"
@@ -124,6 +126,23 @@ song_t *song_new_from_uri( const char *uri, song_metadata_t *metadata )
 	return song_add_ref(song);
 } /* End of 'song_new' function */
 
+/* Create a new song from known full name and file name (no checks
+ * and conversions are made) */
+song_t *song_new_from_names( const char *fullname, const char *filename,
+		song_metadata_t *metadata )
+{
+	song_t *song = song_new(metadata);
+	if (song == NULL)
+		return NULL;
+	song->m_fullname = strdup(fullname);
+	if (filename)
+		song->m_filename = strdup(filename);
+
+	song_set_title(song, metadata);
+
+	return song_add_ref(song);
+} /* End of 'song_new_from_names' function */
+
 /* Add a reference to the song object */
 song_t *song_add_ref( song_t *song )
 {
@@ -152,6 +171,8 @@ void song_free( song_t *song )
 		free(song->m_fullname);
 		if (song->m_default_title != NULL)
 			free(song->m_default_title);
+		if (song->m_search_key != NULL)
+			free(song->m_search_key);
 		pthread_mutex_destroy(&song->m_mutex);
 		free(song);
 	}
@@ -229,7 +250,16 @@ void song_update_title( song_t *song )
 	bool_t finish = FALSE;
 	song_info_t *info;
 
-	if (song == NULL || song->m_default_title != NULL)
+	if (song == NULL)
+		return;
+
+	/* Search key depends on both title and info */
+	if (song->m_search_key != NULL)
+	{
+		free(song->m_search_key);
+		song->m_search_key = NULL;
+	}
+	if (song->m_default_title != NULL)
 		return;
 
 	/* Free current title */
@@ -324,6 +354,58 @@ void song_update_title( song_t *song )
 	}
 } /* End of 'song_get_title_from_info' function */
 
+/* Fold text case for searching */
+char *song_fold_case( const char *text )
+{
+	const char *p;
+
+	/* Plain ASCII (and invalid UTF-8) is lowered byte by byte */
+	for ( p = text; *p && !(*p & 0x80); p ++ );
+	if (*p && g_utf8_validate(text, -1, NULL))
+	{
+		char *folded = g_utf8_casefold(text, -1);
+		char *res = strdup(folded);
+		g_free(folded);
+		return res;
+	}
+
+	char *res = strdup(text);
+	if (res == NULL)
+		return NULL;
+	for ( char *q = res; *q; q ++ )
+		*q = tolower((unsigned char)*q);
+	return res;
+} /* End of 'song_fold_case' function */
+
+/* Get song search key. Song must be locked */
+const char *song_get_search_key( song_t *song )
+{
+	if (song->m_search_key != NULL)
+		return song->m_search_key;
+
+	/* Fields are separated with new lines so that a query word never
+	 * matches across them */
+	str_t *text = str_new(STR_TO_CPTR(song->m_title));
+	song_info_t *info = song->m_info;
+	if (info != NULL && (info->m_flags & SI_INITIALIZED))
+	{
+		const char *items[] = { info->m_artist, info->m_album, info->m_name };
+		for ( int i = 0; i < sizeof(items) / sizeof(items[0]); i ++ )
+		{
+			if (items[i] == NULL || !(*items[i]))
+				continue;
+			str_insert_char(text, '\n', text->m_len);
+			str_cat_cptr(text, items[i]);
+		}
+	}
+	str_insert_char(text, '\n', text->m_len);
+	str_cat_cptr(text, song_get_name(song));
+
+	song->m_search_key = song_fold_case(STR_TO_CPTR(text));
+	str_free(text);
+	return (song->m_search_key == NULL ? "" : song->m_search_key);
+} /* End of 'song_get_search_key' function */
+
 /* Write song info */
 void song_write_info( song_t *s )
 {
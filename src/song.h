@@ -35,6 +35,10 @@ song_t *song_new_from_file( const char *file, song_metadata_t *metadata );
 /* Create a new song */
 song_t *song_new_from_uri( const char *uri, song_metadata_t *metadata);
 
+/* Create a new song from known full name and file name */
+song_t *song_new_from_names( const char *fullname, const char *filename,
+		song_metadata_t *metadata );
+
 /* Add a reference to the song object */
 song_t *song_add_ref( song_t *song );
 
@@ -53,6 +57,12 @@ void song_update_title( song_t *song );
 /* Write song info */
 void song_write_info( song_t *song );
 
+/* Fold text case for searching */
+char *song_fold_case( const char *text );
+
+/* Get song search key. Song must be locked */
+const char *song_get_search_key( song_t *song );
+
 /* Get song file name or full name if it's uri-based */
 static inline const char* song_get_name( song_t *song )
 {
@@ -21,11 +21,16 @@
  */
 
 #include <pthread.h>
+#include <sys/time.h>
 #include "types.h"
 #include "player.h"
 #include "test.h"
+#include "util.h"
 #include "wnd_root.h"
 
+/* Number of keys injected by the latency test */
+#define TEST_LATENCY_KEYS 200
+
 /* Test thread data */
 pthread_t test_pid;
 bool_t test_stop_job = FALSE;
@@ -66,6 +71,9 @@ void *test_thread( void *arg )
 	case TEST_WNDLIB_PERFOMANCE:
 		test_wndlib_perfomance();
 		break;
+	case TEST_KEY_LATENCY:
+		test_key_latency();
+		break;
 	}
 	test_job = TEST_NO_JOB;
 	return NULL;
@@ -92,5 +100,55 @@ void test_wndlib_perfomance( void )
 	}
 } /* End of 'test_wndlib_perfomance' function */
 
+/* Measure latency from key press to the screen synchronization. Keys
+ * go through the keyboard thread like the real ones */
+void test_key_latency( void )
+{
+	wnd_global_data_t *global = WND_GLOBAL(player_wnd);
+	int i, num = 0;
+	long total = 0, max = 0;
+
+	for ( i = 0; i < TEST_LATENCY_KEYS && (!test_stop_job); i ++ )
+	{
+		struct timeval tv;
+		int64_t start;
+		dword syncs;
+		long latency;
+		int j;
+
+		/* Move cursor down and up, so that every key changes the screen */
+		syncs = __atomic_load_n(&global->m_num_syncs, __ATOMIC_ACQUIRE);
+		gettimeofday(&tv, NULL);
+		start = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+		wnd_kbd_push_key(global->m_kbd_data, (i & 1) ? 'k' : 'j');
+
+		/* Wait for the screen synchronization */
+		for ( j = 0; j < 10000; j ++ )
+		{
+			if (__atomic_load_n(&global->m_num_syncs, __ATOMIC_ACQUIRE) != 
+					syncs)
+				break;
+			util_delay(0, 10000);
+		}
+		if (j == 10000)
+			continue;
+		latency = __atomic_load_n(&global->m_last_sync, __ATOMIC_ACQUIRE) -
+			start;
+		total += latency;
+		if (latency > max)
+			max = latency;
+		num ++;
+
+		/* Let the screen settle down */
+		util_delay(0, 20000000);
+	}
+	if (num > 0)
+		logger_message(player_log, 0, 
+				_("Key latency: %d keys, average %ld us, maximum %ld us"),
+				num, total / num, max);
+	else
+		logger_message(player_log, 0, _("Key latency: no screen updates"));
+} /* End of 'test_key_latency' function */
+
 /* End of 'test.c' file */
 
@@ -30,6 +30,7 @@ enum
 {
 	TEST_NO_JOB = -1,
 	TEST_WNDLIB_PERFOMANCE,
+	TEST_KEY_LATENCY,
 	TEST_NUMBER
 };
 
@@ -45,6 +46,9 @@ void *test_thread( void *arg );
 /* Test the window library perfomance */
 void test_wndlib_perfomance( void );
 
+/* Measure latency from key press to the screen synchronization */
+void test_key_latency( void );
+
 #endif
 
 /* End of 'test.h' file */
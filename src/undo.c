@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "types.h"
+#include "journal.h"
 #include "player.h"
 #include "plist.h"
 #include "undo.h"
@@ -166,6 +167,9 @@ void undo_do( struct tag_undo_list_item_t *item )
 		if (player_plist->m_cur_song >= 0)
 			player_plist->m_cur_song = 
 				data->m_transform[player_plist->m_cur_song];
+		jrn_log_sort(player_plist->m_len, data->m_transform);
+		plist_changed(player_plist, CHLOG_SORT, 0, player_plist->m_len, 0,
+				data->m_transform);
 		plist_unlock(player_plist);
 		free(list);
 	}
@@ -255,6 +259,21 @@ void undo_undo( struct tag_undo_list_item_t *item )
 		for ( i = 0; i < player_plist->m_len; i ++ )
 			player_plist->m_list[i] = list[data->m_transform[i]];
 		player_plist->m_cur_song = data->m_was_song;
+		{
+			/* Journal and change log need the inverse permutation */
+			int *transform = (int *)malloc(sizeof(int) * 
+					player_plist->m_len);
+			if (transform != NULL)
+			{
+				for ( i = 0; i < player_plist->m_len; i ++ )
+					transform[data->m_transform[i]] = i;
+			}
+			jrn_log_sort(player_plist->m_len, transform);
+			plist_changed(player_plist, CHLOG_SORT, 0, player_plist->m_len,
+					0, transform);
+			if (transform != NULL)
+				free(transform);
+		}
 		plist_unlock(player_plist);
 		free(list);
 	}